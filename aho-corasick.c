@@ -0,0 +1,170 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aho-corasick.h"
+
+#include <string.h>
+
+void aho_corasick_init(AhoCorasick *ac) {
+    memset(ac, 0, sizeof(AhoCorasick));
+    ac->states_alloc = 64;
+    ac->states = malloc(ac->states_alloc * sizeof(AcState));
+    ac->states[0].edges = AHO_CORASICK_NONE;
+    ac->states[0].fail = 0;
+    ac->states[0].pattern = AHO_CORASICK_NONE;
+    ac->states[0].output = AHO_CORASICK_NONE;
+    ac->nstates = 1;
+}
+
+void aho_corasick_free(AhoCorasick *ac) {
+    free(ac->states);
+    free(ac->edges);
+    free(ac->same);
+    memset(ac, 0, sizeof(AhoCorasick));
+}
+
+static uint32_t state_new(AhoCorasick *ac) {
+    if(ac->nstates == ac->states_alloc) {
+        ac->states_alloc *= 2;
+        ac->states = realloc(ac->states, ac->states_alloc * sizeof(AcState));
+    }
+    AcState *s = &ac->states[ac->nstates];
+    s->edges = AHO_CORASICK_NONE;
+    s->fail = 0;
+    s->pattern = AHO_CORASICK_NONE;
+    s->output = AHO_CORASICK_NONE;
+    return ac->nstates++;
+}
+
+/*
+ * returns the trie child of a state or AHO_CORASICK_NONE
+ */
+static uint32_t child(AhoCorasick *ac, uint32_t state, unsigned char c) {
+    if(state == 0) {
+        return ac->root[c] ? ac->root[c] : AHO_CORASICK_NONE;
+    }
+    for(uint32_t e=ac->states[state].edges;e!=AHO_CORASICK_NONE;e=ac->edges[e].next) {
+        if(ac->edges[e].byte == c) {
+            return ac->edges[e].target;
+        }
+    }
+    return AHO_CORASICK_NONE;
+}
+
+static uint32_t child_add(AhoCorasick *ac, uint32_t state, unsigned char c) {
+    uint32_t target = state_new(ac);
+    if(state == 0) {
+        ac->root[c] = target;
+        return target;
+    }
+    if(ac->nedges == ac->edges_alloc) {
+        ac->edges_alloc = ac->edges_alloc ? ac->edges_alloc * 2 : 64;
+        ac->edges = realloc(ac->edges, ac->edges_alloc * sizeof(AcEdge));
+    }
+    AcEdge *edge = &ac->edges[ac->nedges];
+    edge->next = ac->states[state].edges;
+    edge->target = target;
+    edge->byte = c;
+    ac->states[state].edges = ac->nedges++;
+    return target;
+}
+
+void aho_corasick_add(AhoCorasick *ac, const char *pattern, size_t len) {
+    uint32_t state = 0;
+    for(size_t i=0;i<len;i++) {
+        unsigned char c = pattern[i];
+        uint32_t next = child(ac, state, c);
+        state = next != AHO_CORASICK_NONE ? next : child_add(ac, state, c);
+    }
+    
+    if(ac->npatterns == ac->patterns_alloc) {
+        ac->patterns_alloc = ac->patterns_alloc ? ac->patterns_alloc * 2 : 16;
+        ac->same = realloc(ac->same, ac->patterns_alloc * sizeof(uint32_t));
+    }
+    // patterns with the same string end in the same state
+    uint32_t id = ac->npatterns++;
+    ac->same[id] = ac->states[state].pattern;
+    ac->states[state].pattern = id;
+    if(len > ac->max_len) {
+        ac->max_len = len;
+    }
+}
+
+/*
+ * goto function: follows the fail links, until a transition for c is found
+ */
+static uint32_t transition(AhoCorasick *ac, uint32_t state, unsigned char c) {
+    for(;;) {
+        uint32_t next = child(ac, state, c);
+        if(next != AHO_CORASICK_NONE) {
+            return next;
+        }
+        if(state == 0) {
+            return 0;
+        }
+        state = ac->states[state].fail;
+    }
+}
+
+void aho_corasick_build(AhoCorasick *ac) {
+    // breadth-first: the fail state of a node is always computed before
+    // the node itself
+    uint32_t *queue = malloc(ac->nstates * sizeof(uint32_t));
+    size_t head = 0;
+    size_t tail = 0;
+    for(int c=0;c<256;c++) {
+        uint32_t s = ac->root[c];
+        if(s) {
+            ac->states[s].fail = 0;
+            ac->states[s].output = AHO_CORASICK_NONE;
+            queue[tail++] = s;
+        }
+    }
+    while(head < tail) {
+        uint32_t s = queue[head++];
+        for(uint32_t e=ac->states[s].edges;e!=AHO_CORASICK_NONE;e=ac->edges[e].next) {
+            uint32_t t = ac->edges[e].target;
+            uint32_t f = transition(ac, ac->states[s].fail, ac->edges[e].byte);
+            ac->states[t].fail = f;
+            ac->states[t].output = ac->states[f].pattern != AHO_CORASICK_NONE ? f : ac->states[f].output;
+            queue[tail++] = t;
+        }
+    }
+    free(queue);
+}
+
+uint32_t aho_corasick_scan(
+        AhoCorasick *ac,
+        uint32_t state,
+        const char *str,
+        size_t len,
+        char *found)
+{
+    const unsigned char *s = (const unsigned char*)str;
+    for(size_t i=0;i<len;i++) {
+        state = transition(ac, state, s[i]);
+        uint32_t out = ac->states[state].pattern != AHO_CORASICK_NONE ? state : ac->states[state].output;
+        while(out != AHO_CORASICK_NONE) {
+            for(uint32_t p=ac->states[out].pattern;p!=AHO_CORASICK_NONE;p=ac->same[p]) {
+                found[p] = 1;
+            }
+            out = ac->states[out].output;
+        }
+    }
+    return state;
+}
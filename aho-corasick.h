@@ -0,0 +1,122 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_AHO_CORASICK_H
+#define RTR_AHO_CORASICK_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * no state, edge or pattern
+ */
+#define AHO_CORASICK_NONE UINT32_MAX
+
+typedef struct AcEdge {
+    /*
+     * next edge of the same state or AHO_CORASICK_NONE
+     */
+    uint32_t next;
+    uint32_t target;
+    unsigned char byte;
+} AcEdge;
+
+typedef struct AcState {
+    /*
+     * first outgoing edge or AHO_CORASICK_NONE
+     */
+    uint32_t edges;
+    
+    /*
+     * state of the longest proper suffix, that is a prefix of a pattern
+     */
+    uint32_t fail;
+    
+    /*
+     * pattern, that ends in this state, or AHO_CORASICK_NONE
+     */
+    uint32_t pattern;
+    
+    /*
+     * next state on the fail chain, that ends a pattern, or
+     * AHO_CORASICK_NONE
+     */
+    uint32_t output;
+} AcState;
+
+/*
+ * Aho-Corasick automaton, that finds all occurrences of a set of literal
+ * strings in a single pass
+ * 
+ * State 0 is the root. Transitions of the root are stored in a table,
+ * transitions of all other states are stored as edge lists.
+ */
+typedef struct AhoCorasick {
+    AcState *states;
+    size_t nstates;
+    size_t states_alloc;
+    
+    AcEdge *edges;
+    size_t nedges;
+    size_t edges_alloc;
+    
+    uint32_t root[256];
+    
+    /*
+     * next pattern with the same string or AHO_CORASICK_NONE
+     */
+    uint32_t *same;
+    size_t npatterns;
+    size_t patterns_alloc;
+    
+    /*
+     * length of the longest pattern
+     */
+    size_t max_len;
+} AhoCorasick;
+
+void aho_corasick_init(AhoCorasick *ac);
+
+void aho_corasick_free(AhoCorasick *ac);
+
+/*
+ * adds a pattern, patterns are numbered in the order of the calls
+ * len must not be 0
+ */
+void aho_corasick_add(AhoCorasick *ac, const char *pattern, size_t len);
+
+/*
+ * computes the fail links, must be called after the last pattern was added
+ */
+void aho_corasick_build(AhoCorasick *ac);
+
+/*
+ * Scans str and sets found[i] to 1 for every pattern i, that occurs in str
+ * 
+ * The scan starts in state and returns the state after the last byte,
+ * therefore a text, that is split into several pieces, can be scanned
+ * piece by piece. A new text starts in state 0.
+ */
+uint32_t aho_corasick_scan(
+        AhoCorasick *ac,
+        uint32_t state,
+        const char *str,
+        size_t len,
+        char *found);
+
+#endif /* RTR_AHO_CORASICK_H */
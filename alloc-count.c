@@ -0,0 +1,53 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "alloc-count.h"
+
+static int count_allocs;
+static unsigned long nallocs;
+
+#ifdef ALLOC_COUNT_ENABLED
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+
+void* malloc(size_t size) {
+    if(count_allocs) nallocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    if(count_allocs) nallocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void *ptr, size_t size) {
+    if(count_allocs) nallocs++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+void alloc_count_start(void) {
+    nallocs = 0;
+    count_allocs = 1;
+}
+
+unsigned long alloc_count_stop(void) {
+    count_allocs = 0;
+    return nallocs;
+}
@@ -0,0 +1,52 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_ALLOC_COUNT_H
+#define RTR_ALLOC_COUNT_H
+
+// defines __GLIBC__
+#include <stdlib.h>
+
+/*
+ * Heap allocation counter for the test, bench and e2e binaries
+ * 
+ * alloc-count.c replaces malloc, calloc and realloc with wrappers, that
+ * count the calls between alloc_count_start and alloc_count_stop. g_malloc
+ * uses malloc, therefore glib allocations are counted too. The wrappers
+ * need glibc and are not used with AddressSanitizer, which replaces malloc
+ * itself. ALLOC_COUNT_ENABLED is defined, if allocations are counted.
+ * 
+ * Must not be linked into the plugin.
+ */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define ALLOC_COUNT_ENABLED
+#endif
+
+/*
+ * resets the counter and starts counting
+ */
+void alloc_count_start(void);
+
+/*
+ * stops counting and returns the number of allocations since
+ * alloc_count_start
+ * returns 0 if ALLOC_COUNT_ENABLED is not defined
+ */
+unsigned long alloc_count_stop(void);
+
+#endif /* RTR_ALLOC_COUNT_H */
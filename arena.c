@@ -0,0 +1,103 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+
+#include <string.h>
+
+#define ARENA_ALIGN(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static ArenaBlock* arena_add_block(Arena *arena, size_t min_size) {
+    size_t size = ARENA_BLOCK_SIZE;
+    while(size < min_size) {
+        size *= 2;
+    }
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+    arena->blocks = block;
+    arena->heap_allocs++;
+    return block;
+}
+
+void arena_init(Arena *arena) {
+    memset(arena, 0, sizeof(Arena));
+}
+
+void* arena_alloc(Arena *arena, size_t size) {
+    size = ARENA_ALIGN(size);
+    ArenaBlock *block = arena->blocks;
+    if(!block || block->size - block->used < size) {
+        block = arena_add_block(arena, size);
+    }
+    char *ptr = block->data + block->used;
+    block->used += size;
+    arena->last = ptr;
+    arena->total += size;
+    arena->allocs++;
+    return ptr;
+}
+
+void* arena_realloc(Arena *arena, void *ptr, size_t oldsize, size_t newsize) {
+    ArenaBlock *block = arena->blocks;
+    if(ptr && ptr == arena->last) {
+        // resize the most recent allocation in place
+        size_t offset = arena->last - block->data;
+        size_t old = block->used - offset;
+        if(offset + ARENA_ALIGN(newsize) <= block->size) {
+            block->used = offset + ARENA_ALIGN(newsize);
+            arena->total = arena->total - old + (block->used - offset);
+            return ptr;
+        }
+    }
+    void *newptr = arena_alloc(arena, newsize);
+    if(ptr) {
+        memcpy(newptr, ptr, oldsize < newsize ? oldsize : newsize);
+    }
+    return newptr;
+}
+
+void arena_reset(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    if(block && block->next) {
+        // replace all blocks with one block, that is large enough for
+        // the next message of the same size
+        while(block) {
+            ArenaBlock *next = block->next;
+            free(block);
+            block = next;
+        }
+        arena->blocks = NULL;
+        arena_add_block(arena, arena->total);
+    } else if(block) {
+        block->used = 0;
+    }
+    arena->last = NULL;
+    arena->total = 0;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while(block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    memset(arena, 0, sizeof(Arena));
+}
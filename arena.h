@@ -0,0 +1,91 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_ARENA_H
+#define RTR_ARENA_H
+
+#include <stdlib.h>
+#include <stddef.h>
+
+/*
+ * default size of an arena block
+ */
+#define ARENA_BLOCK_SIZE 16384
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+} ArenaBlock;
+
+/*
+ * Bump allocator for temporary memory
+ * 
+ * Memory is allocated sequentially from blocks and released all at once
+ * with arena_reset. After a reset, the arena keeps one block, that is large
+ * enough for everything allocated before the reset, therefore repeated
+ * workloads of the same size don't need any heap allocations.
+ */
+typedef struct Arena {
+    /*
+     * current block first
+     */
+    ArenaBlock *blocks;
+    
+    /*
+     * most recent allocation, that can be resized in place
+     */
+    char *last;
+    
+    /*
+     * total size of all allocations since the last reset
+     */
+    size_t total;
+    
+    /*
+     * statistics: number of arena allocations and heap allocations
+     */
+    unsigned long allocs;
+    unsigned long heap_allocs;
+} Arena;
+
+void arena_init(Arena *arena);
+
+/*
+ * allocates size bytes, aligned for any type
+ */
+void* arena_alloc(Arena *arena, size_t size);
+
+/*
+ * resizes an allocation
+ * 
+ * If ptr is the most recent allocation and the block has enough space,
+ * it is resized in place, otherwise the data is copied.
+ * ptr can be NULL.
+ */
+void* arena_realloc(Arena *arena, void *ptr, size_t oldsize, size_t newsize);
+
+/*
+ * releases all allocations
+ */
+void arena_reset(Arena *arena);
+
+void arena_free(Arena *arena);
+
+#endif /* RTR_ARENA_H */
@@ -0,0 +1,455 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks for the rule engine
+ * 
+ * The results are written to stdout as JSON, the progress to stderr.
+ * Rules files and messages are generated, the rules file is written to
+ * the current directory and removed afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "regex-text-replacement.h"
+#include "alloc-count.h"
+
+#define BENCH_RULES_FILE "bench.rules"
+
+/*
+ * min time and iterations of a benchmark
+ */
+#define BENCH_MIN_TIME_NS 200000000ULL
+#define BENCH_QUICK_MIN_TIME_NS 20000000ULL
+#define BENCH_MIN_ITERATIONS 3
+
+/*
+ * max number of latency samples, the benchmark stops after this number
+ * of iterations
+ */
+#define BENCH_MAX_SAMPLES 200000
+
+typedef void (*bench_func)(void *ctx);
+
+typedef struct Benchmark {
+    const char *name;
+    char params[256];
+    
+    /*
+     * called before every operation, not measured
+     */
+    bench_func prepare;
+    /*
+     * measured operation
+     */
+    bench_func op;
+    void *ctx;
+    
+    /*
+     * processed message bytes per operation or 0
+     */
+    size_t bytes;
+} Benchmark;
+
+static unsigned long long min_time_ns = BENCH_MIN_TIME_NS;
+static const char *name_filter;
+static int nresults;
+
+static uint64_t *samples;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sample_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_enabled(const char *name) {
+    return !name_filter || strstr(name, name_filter);
+}
+
+/*
+ * runs the benchmark and writes the result as JSON object
+ */
+static void bench_run(Benchmark *b) {
+    fprintf(stderr, "%s %s\n", b->name, b->params);
+    
+    // warm up: scratch buffers and DFA states
+    if(b->prepare) {
+        b->prepare(b->ctx);
+    }
+    b->op(b->ctx);
+    
+    size_t n = 0;
+    uint64_t total = 0;
+    unsigned long allocs = 0;
+    while(n < BENCH_MAX_SAMPLES && (total < min_time_ns || n < BENCH_MIN_ITERATIONS)) {
+        if(b->prepare) {
+            b->prepare(b->ctx);
+        }
+        alloc_count_start();
+        uint64_t start = now_ns();
+        b->op(b->ctx);
+        uint64_t t = now_ns() - start;
+        allocs += alloc_count_stop();
+        samples[n++] = t;
+        total += t;
+    }
+    qsort(samples, n, sizeof(uint64_t), sample_cmp);
+    
+    double ns_per_op = (double)total / n;
+    printf("%s\n    {\"name\": \"%s\", %s, \"iterations\": %zu, \"ns_per_op\": %.1f, ",
+            nresults > 0 ? "," : "",
+            b->name,
+            b->params,
+            n,
+            ns_per_op);
+    if(b->bytes > 0) {
+        printf("\"bytes_per_sec\": %.0f, ", b->bytes / (ns_per_op / 1e9));
+    }
+#ifdef ALLOC_COUNT_ENABLED
+    printf("\"allocs_per_op\": %.2f, ", (double)allocs / n);
+#endif
+    printf("\"p50_ns\": %llu, \"p99_ns\": %llu}",
+            (unsigned long long)samples[n / 2],
+            (unsigned long long)samples[n * 99 / 100]);
+    fflush(stdout);
+    nresults++;
+}
+
+/* ------------------------- generators ------------------------- */
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng_next(void) {
+    // xorshift32, the generated data is the same for every run
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+/*
+ * rule i is a literal rule, if i % 100 < literal_percent
+ */
+static int rule_is_literal(size_t i, int literal_percent) {
+    return (int)(i % 100) < literal_percent;
+}
+
+/*
+ * writes a rules file with nrules rules
+ * literal rules replace lit<i>, regex rules replace re<i>-<number>
+ */
+static void gen_rules_file(size_t nrules, int literal_percent, const char *options) {
+    FILE *out = fopen(BENCH_RULES_FILE, "w");
+    fprintf(out, "?v1%s%s\n", options ? " " : "", options ? options : "");
+    for(size_t i=0;i<nrules;i++) {
+        if(rule_is_literal(i, literal_percent)) {
+            fprintf(out, "lit%05zu\tL%05zu\n", i, i);
+        } else {
+            fprintf(out, "re%05zu-([0-9]+)\t<$1>\n", i);
+        }
+    }
+    fclose(out);
+    // compiled rules from a previous benchmark are not used
+    unlink(BENCH_RULES_FILE ".snapshot");
+}
+
+/*
+ * generates a message with len bytes
+ * density: percent of the words, that match a rule
+ */
+static char* gen_message(size_t len, int density, size_t nrules, int literal_percent) {
+    static const char *words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "the", "quick", "brown",
+        "fox", "jumps", "over", "lazy", "dog", "hello", "world", "pidgin"
+    };
+    char *msg = g_malloc(len + 32);
+    size_t pos = 0;
+    while(pos < len) {
+        if(nrules > 0 && (int)(rng_next() % 100) < density) {
+            size_t r = rng_next() % nrules;
+            if(rule_is_literal(r, literal_percent)) {
+                pos += sprintf(msg + pos, "lit%05zu ", r);
+            } else {
+                pos += sprintf(msg + pos, "re%05zu-%u ", r, rng_next() % 1000);
+            }
+        } else {
+            pos += sprintf(msg + pos, "%s ", words[rng_next() % 16]);
+        }
+    }
+    msg[len] = '\0';
+    return msg;
+}
+
+static void params_message(Benchmark *b, size_t nrules, int literal_percent, size_t len, int density) {
+    snprintf(b->params, sizeof(b->params),
+            "\"rules\": %zu, \"literal_percent\": %d, \"message_bytes\": %zu, \"match_density\": %d",
+            nrules,
+            literal_percent,
+            len,
+            density);
+}
+
+/* ------------------------- apply_rule ------------------------- */
+
+typedef struct ApplyCtx {
+    TextReplacementRule *rule;
+    const char *msg;
+    size_t len;
+    char *work;
+    size_t worklen;
+} ApplyCtx;
+
+static void apply_prepare(void *data) {
+    ApplyCtx *ctx = data;
+    g_free(ctx->work);
+    ctx->work = g_strndup(ctx->msg, ctx->len);
+    ctx->worklen = ctx->len;
+}
+
+static void apply_rule_op(void *data) {
+    ApplyCtx *ctx = data;
+    size_t outlen;
+    ctx->work = apply_rule_n(ctx->work, ctx->worklen, ctx->rule, NULL, &outlen);
+}
+
+static void bench_apply_rule(size_t len, int literal, int density) {
+    if(!bench_enabled("apply_rule")) {
+        return;
+    }
+    gen_rules_file(1, literal ? 100 : 0, NULL);
+    TextReplacementRule *rules;
+    size_t nrules;
+    if(load_rules(BENCH_RULES_FILE, &rules, &nrules, NULL)) {
+        return;
+    }
+    char *msg = gen_message(len, density, 1, literal ? 100 : 0);
+    ApplyCtx ctx = { &rules[0], msg, len, NULL, 0 };
+    Benchmark b = { "apply_rule", "", apply_prepare, apply_rule_op, &ctx, len };
+    params_message(&b, 1, literal ? 100 : 0, len, density);
+    bench_run(&b);
+    g_free(ctx.work);
+    g_free(msg);
+    free_rules(rules, nrules);
+}
+
+/* ------------------------- apply_all_rules ------------------------- */
+
+static void apply_all_op(void *data) {
+    ApplyCtx *ctx = data;
+    apply_all_rules_n(&ctx->work, &ctx->worklen);
+}
+
+/*
+ * budget: 1 uses the default time_limit, step_limit and message_limit like
+ * the plugin, 0 disables the limits to measure only the rule engine
+ */
+static void bench_apply_all_rules(size_t nrules, int literal_percent, size_t len, int density, int budget) {
+    if(!bench_enabled("apply_all_rules")) {
+        return;
+    }
+    gen_rules_file(nrules, literal_percent, budget ? NULL : "time_limit=0 step_limit=0 message_limit=0");
+    if(rules_init(BENCH_RULES_FILE)) {
+        return;
+    }
+    char *msg = gen_message(len, density, nrules, literal_percent);
+    ApplyCtx ctx = { NULL, msg, len, NULL, 0 };
+    Benchmark b = { "apply_all_rules", "", apply_prepare, apply_all_op, &ctx, len };
+    params_message(&b, nrules, literal_percent, len, density);
+    size_t plen = strlen(b.params);
+    snprintf(b.params + plen, sizeof(b.params) - plen, ", \"budget\": %d", budget);
+    bench_run(&b);
+    g_free(ctx.work);
+    g_free(msg);
+    rules_cleanup();
+}
+
+/* ------------------------- str_unescape_and_replace ------------------------- */
+
+static void unescape_op(void *data) {
+    ApplyCtx *ctx = data;
+    free(str_unescape_and_replace(ctx->msg, "$1", ":)"));
+}
+
+static void bench_str_unescape_and_replace(size_t len, int density) {
+    if(!bench_enabled("str_unescape_and_replace")) {
+        return;
+    }
+    char *msg = g_malloc(len + 1);
+    for(size_t i=0;i<len;i++) {
+        int r = rng_next() % 100;
+        if(r < density && i + 2 <= len) {
+            // $1 or an escape sequence
+            memcpy(msg + i, r % 2 ? "$1" : "\\t", 2);
+            i++;
+        } else {
+            msg[i] = 'a' + r % 26;
+        }
+    }
+    msg[len] = '\0';
+    ApplyCtx ctx = { NULL, msg, len, NULL, 0 };
+    Benchmark b = { "str_unescape_and_replace", "", NULL, unescape_op, &ctx, len };
+    snprintf(b.params, sizeof(b.params), "\"message_bytes\": %zu, \"match_density\": %d", len, density);
+    bench_run(&b);
+    g_free(msg);
+}
+
+/* ------------------------- load_rules ------------------------- */
+
+typedef struct LoadCtx {
+    TextReplacementRule *rules;
+    size_t nrules;
+    int initialized;
+} LoadCtx;
+
+static void load_prepare(void *data) {
+    LoadCtx *ctx = data;
+    free_rules(ctx->rules, ctx->nrules);
+    ctx->rules = NULL;
+    ctx->nrules = 0;
+}
+
+static void load_op(void *data) {
+    LoadCtx *ctx = data;
+    load_rules(BENCH_RULES_FILE, &ctx->rules, &ctx->nrules, NULL);
+}
+
+static void rules_init_prepare(void *data) {
+    LoadCtx *ctx = data;
+    if(ctx->initialized) {
+        rules_cleanup();
+    }
+    unlink(BENCH_RULES_FILE ".snapshot");
+}
+
+static void rules_init_op(void *data) {
+    LoadCtx *ctx = data;
+    rules_init(BENCH_RULES_FILE);
+    ctx->initialized = 1;
+}
+
+static void bench_load_rules(size_t nrules, int literal_percent) {
+    if(!bench_enabled("load_rules")) {
+        return;
+    }
+    gen_rules_file(nrules, literal_percent, NULL);
+    LoadCtx ctx = { NULL, 0, 0 };
+    Benchmark b = { "load_rules", "", load_prepare, load_op, &ctx, 0 };
+    snprintf(b.params, sizeof(b.params), "\"rules\": %zu, \"literal_percent\": %d", nrules, literal_percent);
+    bench_run(&b);
+    load_prepare(&ctx);
+}
+
+/*
+ * startup time of the plugin: eager compilation of all rules or lazy=1
+ */
+static void bench_rules_init(size_t nrules, int lazy) {
+    if(!bench_enabled("rules_init")) {
+        return;
+    }
+    gen_rules_file(nrules, 70, lazy ? "lazy=1" : NULL);
+    LoadCtx ctx = { NULL, 0, 0 };
+    Benchmark b = { "rules_init", "", rules_init_prepare, rules_init_op, &ctx, 0 };
+    snprintf(b.params, sizeof(b.params), "\"rules\": %zu, \"literal_percent\": 70, \"lazy\": %d", nrules, lazy);
+    bench_run(&b);
+    rules_init_prepare(&ctx);
+}
+
+int main(int argc, char **argv) {
+    int quick = 0;
+    for(int i=1;i<argc;i++) {
+        if(!strcmp(argv[i], "--quick")) {
+            quick = 1;
+        } else if(!strcmp(argv[i], "--filter") && i+1 < argc) {
+            name_filter = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: bench [--quick] [--filter name]\n");
+            return 2;
+        }
+    }
+    if(quick) {
+        min_time_ns = BENCH_QUICK_MIN_TIME_NS;
+    }
+    samples = malloc(BENCH_MAX_SAMPLES * sizeof(uint64_t));
+    
+    static const size_t sizes[] = { 40, 1024, 65536, 1048576 };
+    size_t nsizes = quick ? 3 : 4;
+    static const int densities[] = { 0, 5, 50 };
+    static const size_t rule_counts[] = { 1, 10, 100, 1000, 20000 };
+    size_t ncounts = quick ? 4 : 5;
+    static const int literal_percents[] = { 0, 70, 100 };
+    
+    printf("{\"quick\": %d, \"min_time_ns\": %llu, \"benchmarks\": [", quick, min_time_ns);
+    
+    for(size_t s=0;s<nsizes;s++) {
+        for(int d=0;d<3;d++) {
+            bench_apply_rule(sizes[s], 1, densities[d]);
+            bench_apply_rule(sizes[s], 0, densities[d]);
+        }
+    }
+    
+    for(size_t c=0;c<ncounts;c++) {
+        for(int l=0;l<3;l++) {
+            for(size_t s=0;s<nsizes;s++) {
+                // large rule sets with large messages take too long
+                if(rule_counts[c] * sizes[s] > 1000 * 65536) {
+                    continue;
+                }
+                // both budgets get the same messages
+                uint32_t seed = rng_state;
+                for(int budget=0;budget<2;budget++) {
+                    rng_state = seed;
+                    bench_apply_all_rules(rule_counts[c], literal_percents[l], sizes[s], 0, budget);
+                    bench_apply_all_rules(rule_counts[c], literal_percents[l], sizes[s], 5, budget);
+                }
+            }
+        }
+    }
+    
+    for(size_t s=0;s<nsizes;s++) {
+        for(int d=0;d<3;d++) {
+            bench_str_unescape_and_replace(sizes[s], densities[d]);
+        }
+    }
+    
+    for(size_t c=2;c<ncounts;c++) {
+        bench_load_rules(rule_counts[c], 0);
+        bench_load_rules(rule_counts[c], 100);
+        bench_rules_init(rule_counts[c], 0);
+        bench_rules_init(rule_counts[c], 1);
+    }
+    
+    printf("\n]}\n");
+    free(samples);
+    unlink(BENCH_RULES_FILE);
+    unlink(BENCH_RULES_FILE ".snapshot");
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compile-worker.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+static GThread *worker;
+static GAsyncQueue *jobs;
+static GAsyncQueue *results;
+
+/*
+ * source id of the idle callback for delivering results or 0
+ * set by the worker thread, protected by deliver_lock
+ */
+static guint deliver_source;
+static GMutex deliver_lock;
+
+/*
+ * number of submitted jobs, that are not completed
+ * only used by the main thread
+ */
+static size_t pending;
+
+/*
+ * pushed to the job queue to stop the worker
+ */
+static CompileJob stop_job;
+
+CompileJob* compile_job_new(
+        TextReplacementRule *rules,
+        size_t nrules,
+        const char *dir,
+        compile_job_func done,
+        void *userdata)
+{
+    CompileJob *job = calloc(1, sizeof(CompileJob));
+    job->rules = rules;
+    job->nrules = nrules;
+    job->dir = dir ? strdup(dir) : NULL;
+    job->done = done;
+    job->userdata = userdata;
+    return job;
+}
+
+void compile_job_free(CompileJob *job) {
+    free_rules(job->rules, job->nrules);
+    free(job->dir);
+    free(job);
+}
+
+static void job_compile(CompileJob *job) {
+    for(size_t i=0;i<job->nrules;i++) {
+        rule_compile_dir(&job->rules[i], job->dir);
+    }
+}
+
+static void job_complete(CompileJob *job) {
+    pending--;
+    job->done(job);
+}
+
+static gboolean deliver_results(gpointer data) {
+    g_mutex_lock(&deliver_lock);
+    deliver_source = 0;
+    g_mutex_unlock(&deliver_lock);
+    if(!results) {
+        return FALSE;
+    }
+    CompileJob *job;
+    while((job = g_async_queue_try_pop(results)) != NULL) {
+        job_complete(job);
+    }
+    return FALSE;
+}
+
+static gpointer worker_thread(gpointer data) {
+    for(;;) {
+        CompileJob *job = g_async_queue_pop(jobs);
+        if(job == &stop_job) {
+            break;
+        }
+        job_compile(job);
+        g_async_queue_push(results, job);
+        // the lock is held until the id is stored, deliver_results
+        // can't reset the id before
+        g_mutex_lock(&deliver_lock);
+        if(!deliver_source) {
+            deliver_source = g_idle_add(deliver_results, NULL);
+        }
+        g_mutex_unlock(&deliver_lock);
+    }
+    return NULL;
+}
+
+void compile_worker_start(void) {
+    if(worker) {
+        return;
+    }
+    jobs = g_async_queue_new();
+    results = g_async_queue_new();
+    worker = g_thread_new("rtr-compile", worker_thread, NULL);
+}
+
+void compile_worker_stop(void) {
+    if(!worker) {
+        return;
+    }
+    g_async_queue_push(jobs, &stop_job);
+    g_thread_join(worker);
+    worker = NULL;
+    
+    // the plugin could be unloaded, before the results are delivered
+    g_mutex_lock(&deliver_lock);
+    if(deliver_source) {
+        g_source_remove(deliver_source);
+        deliver_source = 0;
+    }
+    g_mutex_unlock(&deliver_lock);
+    
+    CompileJob *job;
+    while((job = g_async_queue_try_pop(jobs)) != NULL) {
+        compile_job_free(job);
+    }
+    while((job = g_async_queue_try_pop(results)) != NULL) {
+        compile_job_free(job);
+    }
+    g_async_queue_unref(jobs);
+    g_async_queue_unref(results);
+    jobs = NULL;
+    results = NULL;
+    pending = 0;
+}
+
+void compile_worker_submit(CompileJob *job) {
+    pending++;
+    if(!worker) {
+        job_compile(job);
+        job_complete(job);
+        return;
+    }
+    g_async_queue_push(jobs, job);
+}
+
+size_t compile_worker_pending(void) {
+    return pending;
+}
+
+void compile_worker_wait(void) {
+    while(pending > 0 && results) {
+        job_complete(g_async_queue_pop(results));
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_COMPILE_WORKER_H
+#define RTR_COMPILE_WORKER_H
+
+#include "regex-text-replacement.h"
+
+typedef struct CompileJob CompileJob;
+
+typedef void (*compile_job_func)(CompileJob *job);
+
+/*
+ * rules, that are compiled by the worker thread
+ */
+struct CompileJob {
+    /*
+     * rules with pattern, replacement and engine
+     * the job is the only user of the rules and strings
+     */
+    TextReplacementRule *rules;
+    size_t nrules;
+    
+    /*
+     * directory of the rules file, relative dictionary paths are resolved
+     * against this directory
+     * the worker doesn't use the directory of the current rules, because
+     * the main thread replaces it, when the rules file is reloaded
+     */
+    char *dir;
+    
+    /*
+     * header options, if the job contains all rules of a rules file
+     */
+    RulesFileOptions options;
+    
+    /*
+     * called in the main thread, after all rules of the job were compiled
+     * the callback owns the job and must free it with compile_job_free
+     */
+    compile_job_func done;
+    void *userdata;
+};
+
+/*
+ * creates a job for the rules array, the job takes ownership of the array
+ * dir: directory of the rules file or NULL, the job stores a copy
+ */
+CompileJob* compile_job_new(
+        TextReplacementRule *rules,
+        size_t nrules,
+        const char *dir,
+        compile_job_func done,
+        void *userdata);
+
+/*
+ * frees the job and all rules
+ */
+void compile_job_free(CompileJob *job);
+
+/*
+ * Starts the worker thread
+ * 
+ * Jobs are compiled in the worker thread and the done callbacks are
+ * called from the GLib main loop. As long as the worker is not running,
+ * jobs are compiled immediately in compile_worker_submit.
+ */
+void compile_worker_start(void);
+
+/*
+ * Stops the worker thread
+ * Jobs, that are not completed, are freed without calling the callback.
+ */
+void compile_worker_stop(void);
+
+void compile_worker_submit(CompileJob *job);
+
+/*
+ * returns the number of submitted jobs, that are not completed
+ */
+size_t compile_worker_pending(void);
+
+/*
+ * waits until all submitted jobs are compiled and calls the callbacks
+ */
+void compile_worker_wait(void);
+
+#endif /* RTR_COMPILE_WORKER_H */
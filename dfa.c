@@ -0,0 +1,1428 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dfa.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/* ------------------------- parser ------------------------- */
+
+typedef enum AstType {
+    AST_EMPTY = 0,
+    AST_CLASS,
+    AST_CAT,
+    AST_ALT,
+    AST_REPEAT,
+    AST_GROUP,
+    AST_BOL,
+    AST_EOL
+} AstType;
+
+typedef struct AstNode {
+    AstType type;
+    /*
+     * AST_CLASS: class index, AST_GROUP: group number
+     */
+    int n;
+    /*
+     * AST_REPEAT: max < 0 means unbounded
+     */
+    int min;
+    int max;
+    /*
+     * node indices of the children, AST_REPEAT/AST_GROUP only use left
+     */
+    int left;
+    int right;
+} AstNode;
+
+typedef struct Parser {
+    const char *p;
+    
+    AstNode *nodes;
+    size_t nnodes;
+    size_t nodes_alloc;
+    
+    uint8_t *classes;
+    uint32_t nclasses;
+    uint32_t classes_alloc;
+    
+    int ngroups;
+    int error;
+    
+    /*
+     * DFA_ICASE: all classes contain both cases of ASCII letters
+     */
+    int icase;
+} Parser;
+
+#define CLASS_SET(set, b) ((set)[(b) / 8] |= 1 << ((b) % 8))
+#define CLASS_HAS(set, b) ((set)[(b) / 8] & (1 << ((b) % 8)))
+
+static int ast_new(Parser *ps, AstType type, int left, int right) {
+    if(ps->nnodes == ps->nodes_alloc) {
+        ps->nodes_alloc = ps->nodes_alloc ? ps->nodes_alloc * 2 : 64;
+        ps->nodes = realloc(ps->nodes, ps->nodes_alloc * sizeof(AstNode));
+    }
+    AstNode *node = &ps->nodes[ps->nnodes];
+    memset(node, 0, sizeof(AstNode));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return ps->nnodes++;
+}
+
+/*
+ * adds a class to the class table and returns an AST_CLASS node
+ * identical classes are stored only once
+ */
+/*
+ * adds the other case of all ASCII letters in the set
+ */
+static void class_fold(uint8_t *set) {
+    for(int b='A';b<='Z';b++) {
+        if(CLASS_HAS(set, b) || CLASS_HAS(set, b + 32)) {
+            CLASS_SET(set, b);
+            CLASS_SET(set, b + 32);
+        }
+    }
+}
+
+static int ast_class(Parser *ps, const uint8_t *set) {
+    uint8_t folded[32];
+    if(ps->icase) {
+        memcpy(folded, set, 32);
+        class_fold(folded);
+        set = folded;
+    }
+    uint32_t cls;
+    for(cls=0;cls<ps->nclasses;cls++) {
+        if(!memcmp(ps->classes + cls*32, set, 32)) {
+            break;
+        }
+    }
+    if(cls == ps->nclasses) {
+        if(ps->nclasses == ps->classes_alloc) {
+            ps->classes_alloc = ps->classes_alloc ? ps->classes_alloc * 2 : 16;
+            ps->classes = realloc(ps->classes, ps->classes_alloc * 32);
+        }
+        memcpy(ps->classes + cls*32, set, 32);
+        ps->nclasses++;
+    }
+    int node = ast_new(ps, AST_CLASS, -1, -1);
+    ps->nodes[node].n = cls;
+    return node;
+}
+
+static int ast_range(Parser *ps, int from, int to) {
+    uint8_t set[32];
+    memset(set, 0, 32);
+    for(int b=from;b<=to;b++) {
+        CLASS_SET(set, b);
+    }
+    return ast_class(ps, set);
+}
+
+static int ast_cat(Parser *ps, int left, int right) {
+    if(left < 0) return right;
+    if(right < 0) return left;
+    return ast_new(ps, AST_CAT, left, right);
+}
+
+static int ast_alt(Parser *ps, int left, int right) {
+    if(left < 0) return right;
+    if(right < 0) return left;
+    return ast_new(ps, AST_ALT, left, right);
+}
+
+/*
+ * returns a node, that matches any multi-byte UTF-8 sequence and
+ * bytes, that can't start a valid sequence
+ */
+static int ast_utf8_multibyte(Parser *ps) {
+    int cont = ast_range(ps, 0x80, 0xBF);
+    int seq2 = ast_cat(ps, ast_range(ps, 0xC2, 0xDF), cont);
+    int seq3 = ast_cat(ps, ast_range(ps, 0xE0, 0xEF), ast_cat(ps, cont, cont));
+    int seq4 = ast_cat(ps, ast_range(ps, 0xF0, 0xF4), ast_cat(ps, cont, ast_cat(ps, cont, cont)));
+    int invalid1 = ast_range(ps, 0x80, 0xC1);
+    int invalid2 = ast_range(ps, 0xF5, 0xFF);
+    return ast_alt(ps, seq2, ast_alt(ps, seq3, ast_alt(ps, seq4, ast_alt(ps, invalid1, invalid2))));
+}
+
+/*
+ * returns the length of the UTF-8 sequence starting with c
+ */
+static int utf8_len(unsigned char c) {
+    if(c >= 0xF0 && c <= 0xF4) return 4;
+    if(c >= 0xE0 && c <= 0xEF) return 3;
+    if(c >= 0xC2 && c <= 0xDF) return 2;
+    return 1;
+}
+
+/*
+ * parses the byte sequence of a single character
+ * returns the number of bytes or 0, if the sequence is invalid
+ */
+static int utf8_seq(const char *p) {
+    int len = utf8_len(*p);
+    for(int i=1;i<len;i++) {
+        if((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+static int ast_bytes(Parser *ps, const char *p, int len) {
+    int node = -1;
+    for(int i=0;i<len;i++) {
+        int b = (unsigned char)p[i];
+        node = ast_cat(ps, node, ast_range(ps, b, b));
+    }
+    return node;
+}
+
+static int char_class_add(uint8_t *set, const char *name, size_t len) {
+    int (*fn)(int) = NULL;
+    if(len == 5 && !memcmp(name, "alpha", 5)) fn = isalpha;
+    else if(len == 5 && !memcmp(name, "digit", 5)) fn = isdigit;
+    else if(len == 5 && !memcmp(name, "alnum", 5)) fn = isalnum;
+    else if(len == 5 && !memcmp(name, "upper", 5)) fn = isupper;
+    else if(len == 5 && !memcmp(name, "lower", 5)) fn = islower;
+    else if(len == 5 && !memcmp(name, "space", 5)) fn = isspace;
+    else if(len == 5 && !memcmp(name, "blank", 5)) fn = isblank;
+    else if(len == 5 && !memcmp(name, "punct", 5)) fn = ispunct;
+    else if(len == 5 && !memcmp(name, "print", 5)) fn = isprint;
+    else if(len == 5 && !memcmp(name, "graph", 5)) fn = isgraph;
+    else if(len == 5 && !memcmp(name, "cntrl", 5)) fn = iscntrl;
+    else if(len == 6 && !memcmp(name, "xdigit", 6)) fn = isxdigit;
+    if(!fn) {
+        return 1;
+    }
+    // only ASCII characters, independent of the locale
+    for(int b=0;b<128;b++) {
+        if(fn(b)) {
+            CLASS_SET(set, b);
+        }
+    }
+    return 0;
+}
+
+/*
+ * escape sequences for classes: \w \W \s \S \d \D
+ * returns 1 if c is a class escape and sets the negated flag
+ */
+static int escape_class(int c, uint8_t *set, int *negated) {
+    memset(set, 0, 32);
+    switch(tolower(c)) {
+        case 'w': char_class_add(set, "alnum", 5); CLASS_SET(set, '_'); break;
+        case 's': char_class_add(set, "space", 5); break;
+        case 'd': char_class_add(set, "digit", 5); break;
+        default: return 0;
+    }
+    *negated = isupper(c);
+    return 1;
+}
+
+/*
+ * returns a node for the ASCII complement of set plus all multi-byte
+ * sequences
+ */
+static int ast_negated(Parser *ps, const uint8_t *set) {
+    // [^a] doesn't match A in case-insensitive patterns
+    uint8_t folded[32];
+    if(ps->icase) {
+        memcpy(folded, set, 32);
+        class_fold(folded);
+        set = folded;
+    }
+    uint8_t neg[32];
+    memset(neg, 0, 32);
+    for(int b=0;b<128;b++) {
+        if(!CLASS_HAS(set, b)) {
+            CLASS_SET(neg, b);
+        }
+    }
+    return ast_alt(ps, ast_class(ps, neg), ast_utf8_multibyte(ps));
+}
+
+static int parse_bracket(Parser *ps) {
+    // ps->p points behind '['
+    const char *p = ps->p;
+    int negated = 0;
+    if(*p == '^') {
+        negated = 1;
+        p++;
+    }
+    
+    uint8_t set[32];
+    memset(set, 0, 32);
+    int multibyte = -1; // alternatives for non-ASCII characters
+    int first = 1;
+    while(*p && (*p != ']' || first)) {
+        first = 0;
+        int c = (unsigned char)*p;
+        if(c == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+            char delim = p[1];
+            const char *name = p+2;
+            const char *end = name;
+            while(*end && !(*end == delim && end[1] == ']')) end++;
+            if(*end == '\0') {
+                ps->error = 1;
+                return -1;
+            }
+            if(delim == ':') {
+                if(char_class_add(set, name, end - name)) {
+                    ps->error = 1;
+                    return -1;
+                }
+            } else if(end - name == 1) {
+                // collating symbol or equivalence class of a single char
+                CLASS_SET(set, (unsigned char)*name);
+            } else {
+                ps->error = 1;
+                return -1;
+            }
+            p = end + 2;
+            continue;
+        }
+        
+        if(c >= 0x80) {
+            int len = utf8_seq(p);
+            if(len < 2 || negated || p[len] == '-') {
+                // negated multi-byte characters and non-ASCII ranges
+                // are not supported
+                ps->error = 1;
+                return -1;
+            }
+            multibyte = ast_alt(ps, multibyte, ast_bytes(ps, p, len));
+            p += len;
+            continue;
+        }
+        
+        if(p[1] == '-' && p[2] && p[2] != ']') {
+            int to = (unsigned char)p[2];
+            if(to >= 0x80 || to < c) {
+                ps->error = 1;
+                return -1;
+            }
+            for(int b=c;b<=to;b++) {
+                CLASS_SET(set, b);
+            }
+            p += 3;
+            continue;
+        }
+        
+        CLASS_SET(set, c);
+        p++;
+    }
+    if(*p != ']') {
+        ps->error = 1;
+        return -1;
+    }
+    ps->p = p+1;
+    
+    if(negated) {
+        return ast_negated(ps, set);
+    }
+    return ast_alt(ps, ast_class(ps, set), multibyte);
+}
+
+static int parse_alt(Parser *ps);
+
+static int parse_atom(Parser *ps) {
+    const char *p = ps->p;
+    int c = (unsigned char)*p;
+    switch(c) {
+        case '(': {
+            int group = ++ps->ngroups;
+            ps->p++;
+            int inner = parse_alt(ps);
+            if(ps->error || *ps->p != ')') {
+                ps->error = 1;
+                return -1;
+            }
+            ps->p++;
+            int node = ast_new(ps, AST_GROUP, inner, -1);
+            ps->nodes[node].n = group;
+            return node;
+        }
+        case '[': {
+            ps->p++;
+            return parse_bracket(ps);
+        }
+        case '.': {
+            ps->p++;
+            return ast_alt(ps, ast_range(ps, 0, 0x7F), ast_utf8_multibyte(ps));
+        }
+        case '^': {
+            ps->p++;
+            return ast_new(ps, AST_BOL, -1, -1);
+        }
+        case '$': {
+            ps->p++;
+            return ast_new(ps, AST_EOL, -1, -1);
+        }
+        case '\\': {
+            int e = (unsigned char)p[1];
+            if(e == '\0') {
+                ps->error = 1;
+                return -1;
+            }
+            ps->p += 2;
+            uint8_t set[32];
+            int negated;
+            if(escape_class(e, set, &negated)) {
+                return negated ? ast_negated(ps, set) : ast_class(ps, set);
+            }
+            if(isdigit(e) || e == 'b' || e == 'B' || e == '<' || e == '>' || e == '`' || e == '\'') {
+                // back-references and word boundaries are not supported
+                ps->error = 1;
+                return -1;
+            }
+            return ast_range(ps, e, e);
+        }
+        case '*':
+        case '+':
+        case '?':
+        case '{': {
+            // quantifier without atom
+            ps->error = 1;
+            return -1;
+        }
+    }
+    
+    int len = c >= 0x80 ? utf8_seq(p) : 1;
+    if(len == 0) {
+        len = 1;
+    }
+    ps->p += len;
+    return ast_bytes(ps, p, len);
+}
+
+/*
+ * parses a {m,n} interval
+ * returns 0 on success
+ */
+static int parse_interval(Parser *ps, int *min, int *max) {
+    const char *p = ps->p + 1;
+    if(!isdigit((unsigned char)*p)) {
+        return 1;
+    }
+    *min = 0;
+    while(isdigit((unsigned char)*p)) {
+        *min = *min * 10 + (*p - '0');
+        if(*min > DFA_MAX_REPEAT) return 1;
+        p++;
+    }
+    *max = *min;
+    if(*p == ',') {
+        p++;
+        if(isdigit((unsigned char)*p)) {
+            *max = 0;
+            while(isdigit((unsigned char)*p)) {
+                *max = *max * 10 + (*p - '0');
+                if(*max > DFA_MAX_REPEAT) return 1;
+                p++;
+            }
+            if(*max < *min) return 1;
+        } else {
+            *max = -1;
+        }
+    }
+    if(*p != '}') {
+        return 1;
+    }
+    ps->p = p+1;
+    return 0;
+}
+
+static int parse_repeat(Parser *ps) {
+    int atom = parse_atom(ps);
+    while(!ps->error) {
+        int min, max;
+        switch(*ps->p) {
+            case '*': min = 0; max = -1; ps->p++; break;
+            case '+': min = 1; max = -1; ps->p++; break;
+            case '?': min = 0; max = 1; ps->p++; break;
+            case '{': {
+                if(parse_interval(ps, &min, &max)) {
+                    ps->error = 1;
+                    return -1;
+                }
+                break;
+            }
+            default: return atom;
+        }
+        if(atom < 0) {
+            // quantified empty group
+            continue;
+        }
+        int node = ast_new(ps, AST_REPEAT, atom, -1);
+        ps->nodes[node].min = min;
+        ps->nodes[node].max = max;
+        atom = node;
+    }
+    return -1;
+}
+
+static int parse_cat(Parser *ps) {
+    int node = -1;
+    while(*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->error) {
+        node = ast_cat(ps, node, parse_repeat(ps));
+    }
+    return node;
+}
+
+static int parse_alt(Parser *ps) {
+    int node = parse_cat(ps);
+    while(*ps->p == '|' && !ps->error) {
+        ps->p++;
+        int right = parse_cat(ps);
+        // empty alternatives are represented as AST_EMPTY
+        if(node < 0) node = ast_new(ps, AST_EMPTY, -1, -1);
+        if(right < 0) right = ast_new(ps, AST_EMPTY, -1, -1);
+        node = ast_new(ps, AST_ALT, node, right);
+    }
+    return node;
+}
+
+/* ------------------------- NFA compiler ------------------------- */
+
+typedef struct Compiler {
+    Parser *ps;
+    NfaProgram *prog;
+    uint32_t insts_alloc;
+    int reverse;
+    int error;
+} Compiler;
+
+static uint32_t emit(Compiler *c, NfaOp op, uint32_t n, uint32_t x, uint32_t y) {
+    NfaProgram *prog = c->prog;
+    if(prog->ninsts >= DFA_MAX_INSTS) {
+        c->error = 1;
+        return 0;
+    }
+    if(prog->ninsts == c->insts_alloc) {
+        c->insts_alloc = c->insts_alloc ? c->insts_alloc * 2 : 64;
+        prog->insts = realloc(prog->insts, c->insts_alloc * sizeof(NfaInst));
+    }
+    NfaInst *inst = &prog->insts[prog->ninsts];
+    inst->op = op;
+    inst->n = n;
+    inst->x = x;
+    inst->y = y;
+    return prog->ninsts++;
+}
+
+/*
+ * compiles an AST node, that continues with next
+ * returns the entry instruction of the node
+ */
+static uint32_t compile_node(Compiler *c, int index, uint32_t next) {
+    if(index < 0 || c->error) {
+        return next;
+    }
+    AstNode *node = &c->ps->nodes[index];
+    switch(node->type) {
+        case AST_EMPTY: return next;
+        case AST_CLASS: return emit(c, NFA_CLASS, node->n, next, 0);
+        case AST_CAT: {
+            if(c->reverse) {
+                uint32_t left = compile_node(c, node->left, next);
+                return compile_node(c, node->right, left);
+            }
+            uint32_t right = compile_node(c, node->right, next);
+            return compile_node(c, node->left, right);
+        }
+        case AST_ALT: {
+            uint32_t left = compile_node(c, node->left, next);
+            uint32_t right = compile_node(c, node->right, next);
+            return emit(c, NFA_SPLIT, 0, left, right);
+        }
+        case AST_GROUP: {
+            if(c->reverse) {
+                return compile_node(c, node->left, next);
+            }
+            uint32_t end = emit(c, NFA_SAVE, node->n*2+1, next, 0);
+            uint32_t body = compile_node(c, node->left, end);
+            return emit(c, NFA_SAVE, node->n*2, body, 0);
+        }
+        case AST_BOL: return emit(c, c->reverse ? NFA_EOL : NFA_BOL, 0, next, 0);
+        case AST_EOL: return emit(c, c->reverse ? NFA_BOL : NFA_EOL, 0, next, 0);
+        case AST_REPEAT: {
+            int child = node->left;
+            int min = node->min;
+            int max = node->max;
+            uint32_t tail = next;
+            if(max < 0) {
+                // loop: L: split body, next; body: child -> L
+                uint32_t loop = emit(c, NFA_SPLIT, 0, 0, next);
+                uint32_t body = compile_node(c, child, loop);
+                if(c->error) return 0;
+                c->prog->insts[loop].x = body;
+                tail = loop;
+            } else {
+                for(int i=min;i<max;i++) {
+                    uint32_t body = compile_node(c, child, tail);
+                    tail = emit(c, NFA_SPLIT, 0, body, next);
+                }
+            }
+            for(int i=0;i<min;i++) {
+                tail = compile_node(c, child, tail);
+            }
+            return tail;
+        }
+    }
+    return next;
+}
+
+static int compile_program(Parser *ps, int root, int reverse, NfaProgram *prog) {
+    Compiler c;
+    memset(&c, 0, sizeof(Compiler));
+    memset(prog, 0, sizeof(NfaProgram));
+    c.ps = ps;
+    c.prog = prog;
+    c.reverse = reverse;
+    
+    uint32_t match = emit(&c, NFA_MATCH, 0, 0, 0);
+    prog->start = compile_node(&c, root, match);
+    prog->classes = ps->classes;
+    prog->nclasses = ps->nclasses;
+    if(c.error) {
+        free(prog->insts);
+        prog->insts = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/* ------------------------- lazy DFA ------------------------- */
+
+#define DFA_HASH_SIZE 512
+
+typedef struct DfaState {
+    struct DfaState *hash_next;
+    uint32_t hash;
+    uint32_t keylen;
+    /*
+     * forward: a thread group reached NFA_MATCH
+     * reverse: NFA_MATCH reached
+     */
+    int match;
+    /*
+     * NFA_MATCH is reachable at the end of the string
+     */
+    int eol_match;
+    /*
+     * no thread is alive and no new threads are started
+     */
+    int dead;
+    /*
+     * state key:
+     * [injecting, ngroups, len0, pcs0..., len1, pcs1..., ...]
+     */
+    int32_t *key;
+    /*
+     * transitions for each byte class, NULL if not computed yet
+     */
+    struct DfaState *next[];
+} DfaState;
+
+typedef struct Dfa {
+    NfaProgram *prog;
+    
+    /*
+     * byte to byte class mapping, shared with the DfaRegex
+     */
+    const uint8_t *byteclass;
+    const uint8_t *classrep;
+    uint32_t nbyteclasses;
+    
+    DfaState **buckets;
+    size_t nstates;
+    
+    /*
+     * start states, index: beginning of line
+     */
+    DfaState *start[2];
+    
+    /*
+     * scratch memory for computing states
+     */
+    uint32_t *stamp;
+    uint32_t stamp_gen;
+    uint32_t *stack;
+    int32_t *keybuf;
+    size_t keybuf_alloc;
+    size_t keylen;
+} Dfa;
+
+struct DfaRegex {
+    Parser parser;
+    NfaProgram fwd;
+    NfaProgram rev;
+    
+    uint8_t byteclass[256];
+    uint8_t classrep[256];
+    uint32_t nbyteclasses;
+    
+    Dfa fdfa;
+    Dfa rdfa;
+    
+    size_t nsub;
+    
+    /*
+     * pike vm scratch memory for capture groups
+     */
+    uint32_t *pike_pcs[2];
+    regoff_t *pike_caps[2];
+    regoff_t *pike_work;
+    uint32_t *pike_stamp;
+    uint32_t pike_gen;
+    uint32_t *pike_stack;
+    
+    /*
+     * fwd and rev are not owned by the regex (dfa_load)
+     */
+    int borrowed;
+};
+
+static void dfa_init(Dfa *d, NfaProgram *prog, DfaRegex *re) {
+    memset(d, 0, sizeof(Dfa));
+    d->prog = prog;
+    d->byteclass = re->byteclass;
+    d->classrep = re->classrep;
+    d->nbyteclasses = re->nbyteclasses;
+    d->buckets = calloc(DFA_HASH_SIZE, sizeof(DfaState*));
+    d->stamp = calloc(prog->ninsts, sizeof(uint32_t));
+    d->stack = malloc((prog->ninsts + 1) * 2 * sizeof(uint32_t));
+    d->keybuf_alloc = prog->ninsts * 2 + 16;
+    d->keybuf = malloc(d->keybuf_alloc * sizeof(int32_t));
+}
+
+static void dfa_flush(Dfa *d) {
+    for(size_t i=0;i<DFA_HASH_SIZE;i++) {
+        DfaState *s = d->buckets[i];
+        while(s) {
+            DfaState *next = s->hash_next;
+            free(s);
+            s = next;
+        }
+        d->buckets[i] = NULL;
+    }
+    d->nstates = 0;
+    d->start[0] = NULL;
+    d->start[1] = NULL;
+}
+
+static void dfa_destroy(Dfa *d) {
+    if(!d->buckets) {
+        return;
+    }
+    dfa_flush(d);
+    free(d->buckets);
+    free(d->stamp);
+    free(d->stack);
+    free(d->keybuf);
+}
+
+static void keybuf_add(Dfa *d, int32_t value) {
+    if(d->keylen == d->keybuf_alloc) {
+        d->keybuf_alloc *= 2;
+        d->keybuf = realloc(d->keybuf, d->keybuf_alloc * sizeof(int32_t));
+    }
+    d->keybuf[d->keylen++] = value;
+}
+
+static void next_stamp(Dfa *d) {
+    if(++d->stamp_gen == 0) {
+        memset(d->stamp, 0, d->prog->ninsts * sizeof(uint32_t));
+        d->stamp_gen = 1;
+    }
+}
+
+/*
+ * adds the epsilon closure of pc to the key buffer
+ * NFA_EOL instructions are added as pending, if eol is not set
+ * returns 1 if NFA_MATCH was added
+ */
+static int closure(Dfa *d, uint32_t pc, int bol, int eol) {
+    NfaInst *insts = d->prog->insts;
+    int match = 0;
+    size_t sp = 0;
+    d->stack[sp++] = pc;
+    while(sp > 0) {
+        pc = d->stack[--sp];
+        if(d->stamp[pc] == d->stamp_gen) {
+            continue;
+        }
+        d->stamp[pc] = d->stamp_gen;
+        NfaInst *inst = &insts[pc];
+        switch(inst->op) {
+            case NFA_JMP:
+            case NFA_SAVE: d->stack[sp++] = inst->x; break;
+            case NFA_SPLIT: {
+                d->stack[sp++] = inst->y;
+                d->stack[sp++] = inst->x;
+                break;
+            }
+            case NFA_BOL: {
+                if(bol) {
+                    d->stack[sp++] = inst->x;
+                }
+                break;
+            }
+            case NFA_EOL: {
+                if(eol) {
+                    d->stack[sp++] = inst->x;
+                } else {
+                    keybuf_add(d, pc);
+                }
+                break;
+            }
+            case NFA_MATCH: match = 1; // fallthrough
+            case NFA_CLASS: keybuf_add(d, pc); break;
+        }
+    }
+    return match;
+}
+
+static int cmp_int32(const void *a, const void *b) {
+    int32_t x = *(const int32_t*)a;
+    int32_t y = *(const int32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * closes the current group in the key buffer
+ * returns 0 if the group is empty and was removed
+ */
+static int end_group(Dfa *d, size_t group_start) {
+    size_t len = d->keylen - group_start - 1;
+    if(len == 0) {
+        d->keylen = group_start;
+        return 0;
+    }
+    d->keybuf[group_start] = len;
+    qsort(d->keybuf + group_start + 1, len, sizeof(int32_t), cmp_int32);
+    return 1;
+}
+
+/*
+ * checks if NFA_MATCH is reachable from pending NFA_EOL instructions
+ */
+static int key_eol_match(Dfa *d, const int32_t *key) {
+    NfaInst *insts = d->prog->insts;
+    size_t saved_keylen = d->keylen;
+    int match = 0;
+    next_stamp(d);
+    size_t k = 2;
+    for(int32_t g=0;g<key[1] && !match;g++) {
+        int32_t len = key[k++];
+        for(int32_t i=0;i<len && !match;i++) {
+            NfaInst *inst = &insts[key[k+i]];
+            if(inst->op == NFA_EOL) {
+                match = closure(d, inst->x, 0, 1);
+            }
+        }
+        k += len;
+    }
+    d->keylen = saved_keylen;
+    return match;
+}
+
+static uint32_t key_hash(const int32_t *key, size_t len) {
+    uint32_t h = 2166136261u;
+    for(size_t i=0;i<len;i++) {
+        h = (h ^ (uint32_t)key[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * returns the cached state for the key in the key buffer or creates it
+ * flushed: set to 1, if the cache was flushed
+ */
+static DfaState* dfa_state(Dfa *d, int match, int *flushed) {
+    int32_t *key = d->keybuf;
+    size_t keylen = d->keylen;
+    uint32_t hash = key_hash(key, keylen);
+    DfaState *s = d->buckets[hash % DFA_HASH_SIZE];
+    while(s) {
+        if(s->hash == hash && s->keylen == keylen && !memcmp(s->key, key, keylen * sizeof(int32_t))) {
+            return s;
+        }
+        s = s->hash_next;
+    }
+    
+    if(d->nstates >= DFA_MAX_STATES) {
+        dfa_flush(d);
+        *flushed = 1;
+    }
+    
+    size_t nextsize = d->nbyteclasses * sizeof(DfaState*);
+    s = calloc(1, sizeof(DfaState) + nextsize + keylen * sizeof(int32_t));
+    s->key = (int32_t*)((char*)s->next + nextsize);
+    memcpy(s->key, key, keylen * sizeof(int32_t));
+    s->keylen = keylen;
+    s->hash = hash;
+    s->match = match;
+    s->dead = key[0] == 0 && key[1] == 0;
+    s->eol_match = key_eol_match(d, key);
+    s->hash_next = d->buckets[hash % DFA_HASH_SIZE];
+    d->buckets[hash % DFA_HASH_SIZE] = s;
+    d->nstates++;
+    return s;
+}
+
+/*
+ * returns the start state
+ * forward DFAs start new threads at every position (injecting)
+ */
+static DfaState* dfa_start(Dfa *d, int bol, int injecting) {
+    if(d->start[bol]) {
+        return d->start[bol];
+    }
+    d->keylen = 0;
+    keybuf_add(d, injecting);
+    keybuf_add(d, 0);
+    next_stamp(d);
+    size_t group_start = d->keylen;
+    keybuf_add(d, 0);
+    int match = closure(d, d->prog->start, bol, 0);
+    if(end_group(d, group_start)) {
+        d->keybuf[1] = 1;
+    }
+    if(match) {
+        // empty match: no later start can be leftmost
+        d->keybuf[0] = 0;
+    }
+    int flushed = 0;
+    DfaState *s = dfa_state(d, match, &flushed);
+    d->start[bol] = s;
+    return s;
+}
+
+/*
+ * computes the transition of state s for byte b
+ */
+static DfaState* dfa_step(Dfa *d, DfaState *s, unsigned char b) {
+    uint8_t bc = d->byteclass[b];
+    DfaState *next = s->next[bc];
+    if(next) {
+        return next;
+    }
+    
+    NfaInst *insts = d->prog->insts;
+    const uint8_t *classes = d->prog->classes;
+    const int32_t *key = s->key;
+    int injecting = key[0];
+    int ngroups = key[1];
+    
+    d->keylen = 0;
+    keybuf_add(d, injecting);
+    keybuf_add(d, 0);
+    next_stamp(d);
+    
+    // advance all thread groups in order
+    // threads, that reach a pc, which is already part of an earlier group,
+    // are dropped, because the earlier group started at a lower position
+    int match = 0;
+    int new_groups = 0;
+    size_t k = 2;
+    for(int g=0;g<ngroups;g++) {
+        int32_t len = key[k++];
+        size_t group_start = d->keylen;
+        keybuf_add(d, 0);
+        int group_match = 0;
+        for(int32_t i=0;i<len;i++) {
+            NfaInst *inst = &insts[key[k+i]];
+            if(inst->op == NFA_CLASS && CLASS_HAS(classes + inst->n*32, b)) {
+                group_match |= closure(d, inst->x, 0, 0);
+            }
+        }
+        k += len;
+        if(end_group(d, group_start)) {
+            new_groups++;
+            if(group_match) {
+                // groups, that started later, can't produce the
+                // leftmost match anymore
+                match = 1;
+                break;
+            }
+        }
+    }
+    
+    if(injecting && !match) {
+        size_t group_start = d->keylen;
+        keybuf_add(d, 0);
+        match = closure(d, d->prog->start, 0, 0);
+        if(end_group(d, group_start)) {
+            new_groups++;
+        }
+    }
+    if(match) {
+        // stop starting new threads after the first match
+        d->keybuf[0] = 0;
+    }
+    d->keybuf[1] = new_groups;
+    
+    int flushed = 0;
+    next = dfa_state(d, match, &flushed);
+    if(!flushed) {
+        s->next[bc] = next;
+    }
+    return next;
+}
+
+/* ------------------------- capture groups ------------------------- */
+
+/*
+ * adds the thread pc with the capture slots work to the list
+ */
+static void pike_add(
+        DfaRegex *re,
+        uint32_t *pcs,
+        regoff_t *caps,
+        size_t *n,
+        uint32_t pc,
+        size_t nslots,
+        size_t pos,
+        int bol,
+        int eol)
+{
+    NfaInst *insts = re->fwd.insts;
+    regoff_t *work = re->pike_work;
+    uint32_t *stack = re->pike_stack;
+    size_t sp = 0;
+    // stack entries: pc or restore entries (slot | 1<<31, value)
+    stack[sp++] = pc;
+    while(sp > 0) {
+        uint32_t entry = stack[--sp];
+        if(entry & 0x80000000) {
+            uint32_t slot = entry & 0x7FFFFFFF;
+            work[slot] = (regoff_t)stack[--sp] - 1;
+            continue;
+        }
+        pc = entry;
+        if(re->pike_stamp[pc] == re->pike_gen) {
+            continue;
+        }
+        re->pike_stamp[pc] = re->pike_gen;
+        NfaInst *inst = &insts[pc];
+        switch(inst->op) {
+            case NFA_JMP: stack[sp++] = inst->x; break;
+            case NFA_SPLIT: {
+                stack[sp++] = inst->y;
+                stack[sp++] = inst->x;
+                break;
+            }
+            case NFA_SAVE: {
+                if(inst->n < nslots) {
+                    stack[sp++] = (uint32_t)(work[inst->n] + 1);
+                    stack[sp++] = inst->n | 0x80000000;
+                    work[inst->n] = pos;
+                }
+                stack[sp++] = inst->x;
+                break;
+            }
+            case NFA_BOL: {
+                if(bol) stack[sp++] = inst->x;
+                break;
+            }
+            case NFA_EOL: {
+                if(eol) stack[sp++] = inst->x;
+                break;
+            }
+            default: {
+                pcs[*n] = pc;
+                memcpy(caps + *n * nslots, work, nslots * sizeof(regoff_t));
+                (*n)++;
+            }
+        }
+    }
+}
+
+/*
+ * computes the capture groups of the match so-eo
+ */
+static void pike_captures(
+        DfaRegex *re,
+        const char *str,
+        size_t len,
+        size_t so,
+        size_t eo,
+        int notbol,
+        size_t nmatch,
+        regmatch_t *pmatch)
+{
+    size_t nslots = (nmatch < re->nsub+1 ? nmatch : re->nsub+1) * 2;
+    NfaInst *insts = re->fwd.insts;
+    const uint8_t *classes = re->fwd.classes;
+    
+    for(size_t i=0;i<nslots;i++) {
+        re->pike_work[i] = -1;
+    }
+    
+    int cur = 0;
+    size_t n = 0;
+    if(++re->pike_gen == 0) {
+        memset(re->pike_stamp, 0, re->fwd.ninsts * sizeof(uint32_t));
+        re->pike_gen = 1;
+    }
+    pike_add(re, re->pike_pcs[cur], re->pike_caps[cur], &n, re->fwd.start, nslots, so, so == 0 && !notbol, so == len);
+    
+    regoff_t *result = NULL;
+    for(size_t pos=so;n>0;pos++) {
+        if(pos == eo) {
+            // the first thread with priority, that matches at eo
+            for(size_t t=0;t<n;t++) {
+                if(insts[re->pike_pcs[cur][t]].op == NFA_MATCH) {
+                    result = re->pike_caps[cur] + t*nslots;
+                    break;
+                }
+            }
+            break;
+        }
+        
+        unsigned char b = str[pos];
+        int nxt = 1 - cur;
+        size_t nn = 0;
+        if(++re->pike_gen == 0) {
+            memset(re->pike_stamp, 0, re->fwd.ninsts * sizeof(uint32_t));
+            re->pike_gen = 1;
+        }
+        for(size_t t=0;t<n;t++) {
+            NfaInst *inst = &insts[re->pike_pcs[cur][t]];
+            if(inst->op == NFA_CLASS && CLASS_HAS(classes + inst->n*32, b)) {
+                memcpy(re->pike_work, re->pike_caps[cur] + t*nslots, nslots * sizeof(regoff_t));
+                pike_add(re, re->pike_pcs[nxt], re->pike_caps[nxt], &nn, inst->x, nslots, pos+1, 0, pos+1 == len);
+            }
+        }
+        cur = nxt;
+        n = nn;
+    }
+    
+    for(size_t i=1;i<nmatch;i++) {
+        if(result && i*2+1 < nslots) {
+            pmatch[i].rm_so = result[i*2];
+            pmatch[i].rm_eo = result[i*2+1];
+            if(pmatch[i].rm_so < 0 || pmatch[i].rm_eo < 0) {
+                pmatch[i].rm_so = -1;
+                pmatch[i].rm_eo = -1;
+            }
+        } else {
+            pmatch[i].rm_so = -1;
+            pmatch[i].rm_eo = -1;
+        }
+    }
+}
+
+/* ------------------------- public API ------------------------- */
+
+/*
+ * computes byte equivalence classes: bytes, that are members of exactly
+ * the same NFA classes, share one DFA transition
+ */
+static void compute_byteclasses(DfaRegex *re) {
+    const uint8_t *classes = re->fwd.classes;
+    uint32_t nclasses = re->fwd.nclasses;
+    memset(re->byteclass, 0, 256);
+    uint32_t n = 1;
+    for(uint32_t c=0;c<nclasses;c++) {
+        const uint8_t *set = classes + c*32;
+        // split every byte class into members and non-members of set
+        int16_t split_in[256];
+        int16_t split_out[256];
+        memset(split_in, -1, sizeof(split_in));
+        memset(split_out, -1, sizeof(split_out));
+        uint32_t newn = 0;
+        uint8_t newclass[256];
+        for(int b=0;b<256;b++) {
+            int16_t *map = CLASS_HAS(set, b) ? split_in : split_out;
+            uint8_t old = re->byteclass[b];
+            if(map[old] < 0) {
+                map[old] = newn++;
+            }
+            newclass[b] = map[old];
+        }
+        memcpy(re->byteclass, newclass, 256);
+        n = newn;
+    }
+    re->nbyteclasses = n;
+    for(int b=255;b>=0;b--) {
+        re->classrep[re->byteclass[b]] = b;
+    }
+}
+
+static void dfa_setup(DfaRegex *re);
+
+DfaRegex* dfa_compile(const char *pattern, size_t *nsub) {
+    return dfa_compile_flags(pattern, 0, nsub);
+}
+
+DfaRegex* dfa_compile_flags(const char *pattern, int flags, size_t *nsub) {
+    DfaRegex *re = calloc(1, sizeof(DfaRegex));
+    Parser *ps = &re->parser;
+    ps->p = pattern;
+    ps->icase = (flags & DFA_ICASE) != 0;
+    int root = parse_alt(ps);
+    if(!ps->error && *ps->p != '\0') {
+        // unbalanced ')'
+        ps->error = 1;
+    }
+    if(ps->error
+            || compile_program(ps, root, 0, &re->fwd)
+            || compile_program(ps, root, 1, &re->rev))
+    {
+        dfa_free(re);
+        return NULL;
+    }
+    free(ps->nodes);
+    ps->nodes = NULL;
+    
+    re->nsub = ps->ngroups;
+    dfa_setup(re);
+    
+    *nsub = re->nsub;
+    return re;
+}
+
+/*
+ * allocates the DFA caches and the pike vm scratch memory for the programs
+ */
+static void dfa_setup(DfaRegex *re) {
+    compute_byteclasses(re);
+    dfa_init(&re->fdfa, &re->fwd, re);
+    dfa_init(&re->rdfa, &re->rev, re);
+    
+    size_t nslots = (re->nsub + 1) * 2;
+    size_t ninsts = re->fwd.ninsts;
+    for(int i=0;i<2;i++) {
+        re->pike_pcs[i] = malloc(ninsts * sizeof(uint32_t));
+        re->pike_caps[i] = malloc(ninsts * nslots * sizeof(regoff_t));
+    }
+    re->pike_work = malloc(nslots * sizeof(regoff_t));
+    re->pike_stamp = calloc(ninsts, sizeof(uint32_t));
+    re->pike_stack = malloc((ninsts * 3 + 1) * sizeof(uint32_t));
+}
+
+/*
+ * checks, that all instructions of a loaded program reference valid
+ * instructions, classes and capture slots
+ */
+static int program_valid(const NfaProgram *prog, size_t nsub) {
+    if(!prog->insts || prog->ninsts == 0 || prog->ninsts > DFA_MAX_INSTS
+            || prog->start >= prog->ninsts || nsub >= prog->ninsts)
+    {
+        return 0;
+    }
+    for(uint32_t i=0;i<prog->ninsts;i++) {
+        const NfaInst *inst = &prog->insts[i];
+        switch(inst->op) {
+            case NFA_CLASS: {
+                if(inst->n >= prog->nclasses) return 0;
+                break;
+            }
+            case NFA_MATCH: continue;
+            case NFA_SPLIT: {
+                if(inst->y >= prog->ninsts) return 0;
+                break;
+            }
+            case NFA_SAVE: {
+                if(inst->n >= (nsub + 1) * 2) return 0;
+                break;
+            }
+            case NFA_JMP:
+            case NFA_BOL:
+            case NFA_EOL: break;
+            default: return 0;
+        }
+        if(inst->x >= prog->ninsts) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+DfaRegex* dfa_load(const NfaProgram *fwd, const NfaProgram *rev, size_t nsub) {
+    if(fwd->classes != rev->classes || fwd->nclasses != rev->nclasses
+            || !program_valid(fwd, nsub) || !program_valid(rev, nsub))
+    {
+        return NULL;
+    }
+    DfaRegex *re = calloc(1, sizeof(DfaRegex));
+    re->fwd = *fwd;
+    re->rev = *rev;
+    re->borrowed = 1;
+    re->nsub = nsub;
+    dfa_setup(re);
+    return re;
+}
+
+const NfaProgram* dfa_program(DfaRegex *re, int reverse) {
+    return reverse ? &re->rev : &re->fwd;
+}
+
+int dfa_exec(
+        DfaRegex *re,
+        const char *str,
+        size_t len,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    int notbol = (eflags & REG_NOTBOL) != 0;
+    const unsigned char *s = (const unsigned char*)str;
+    
+    // forward scan: find the end of the leftmost-longest match
+    Dfa *fd = &re->fdfa;
+    DfaState *state = dfa_start(fd, !notbol, 1);
+    ssize_t end = state->match ? 0 : -1;
+    size_t pos;
+    for(pos=0;pos<len;pos++) {
+        state = dfa_step(fd, state, s[pos]);
+        if(state->dead) {
+            break;
+        }
+        if(state->match) {
+            end = pos + 1;
+        }
+    }
+    if(pos == len && state->eol_match) {
+        end = len;
+    }
+    if(end < 0) {
+        return REG_NOMATCH;
+    }
+    
+    // reverse scan: find the lowest start position of a match, that
+    // ends at end
+    Dfa *rd = &re->rdfa;
+    state = dfa_start(rd, (size_t)end == len, 0);
+    ssize_t start = -1;
+    if(state->match) {
+        start = end;
+    }
+    if(end == 0 && !notbol && state->eol_match) {
+        start = 0;
+    }
+    for(ssize_t i=end-1;i>=0;i--) {
+        state = dfa_step(rd, state, s[i]);
+        if(state->dead) {
+            break;
+        }
+        if(state->match || (i == 0 && !notbol && state->eol_match)) {
+            start = i;
+        }
+    }
+    if(start < 0) {
+        // can't happen, the forward scan found a match
+        return REG_NOMATCH;
+    }
+    
+    if(nmatch > 0) {
+        pmatch[0].rm_so = start;
+        pmatch[0].rm_eo = end;
+    }
+    if(nmatch > 1) {
+        pike_captures(re, str, len, start, end, notbol, nmatch, pmatch);
+    }
+    return 0;
+}
+
+void dfa_free(DfaRegex *re) {
+    if(!re) {
+        return;
+    }
+    dfa_destroy(&re->fdfa);
+    dfa_destroy(&re->rdfa);
+    if(!re->borrowed) {
+        free(re->fwd.insts);
+        free(re->rev.insts);
+    }
+    free(re->parser.nodes);
+    free(re->parser.classes);
+    for(int i=0;i<2;i++) {
+        free(re->pike_pcs[i]);
+        free(re->pike_caps[i]);
+    }
+    free(re->pike_work);
+    free(re->pike_stamp);
+    free(re->pike_stack);
+    free(re);
+}
+
+int dfa_pattern_risky(const char *pattern) {
+    // for every open group: does it contain a quantifier or alternative
+    int stack[64];
+    int depth = 0;
+    for(const char *p=pattern;*p;p++) {
+        switch(*p) {
+            case '\\': {
+                if(p[1]) p++;
+                break;
+            }
+            case '[': {
+                // skip bracket expression
+                const char *b = p+1;
+                if(*b == '^') b++;
+                if(*b == ']') b++;
+                while(*b && *b != ']') {
+                    if(*b == '[' && b[1] == ':') {
+                        b = strstr(b, ":]");
+                        if(!b) return 0;
+                        b++;
+                    }
+                    b++;
+                }
+                if(*b == '\0') return 0;
+                p = b;
+                break;
+            }
+            case '(': {
+                if(depth == 64) return 1;
+                stack[depth++] = 0;
+                break;
+            }
+            case '|':
+            case '*':
+            case '+':
+            case '{': {
+                if(depth > 0) stack[depth-1] = 1;
+                break;
+            }
+            case ')': {
+                if(depth == 0) return 0;
+                int inner = stack[--depth];
+                char q = p[1];
+                if(inner && (q == '*' || q == '+' || q == '{')) {
+                    return 1;
+                }
+                if(inner && depth > 0) {
+                    stack[depth-1] = 1;
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_DFA_H
+#define RTR_DFA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <regex.h>
+
+/*
+ * Built-in regex engine for a subset of POSIX extended regular expressions
+ *
+ * Patterns are compiled to an NFA, DFA states are built lazily while
+ * matching and stored in a bounded cache. Every search is linear in the
+ * length of the string, there is no backtracking.
+ *
+ * Supported syntax:
+ * literals, ., [...] bracket expressions (including [:class:]),
+ * (...) groups, |, *, +, ?, {m}, {m,}, {m,n}, ^, $,
+ * \w \W \s \S \d \D and escaped punctuation
+ *
+ * Not supported: back-references, word boundaries
+ *
+ * . and negated bracket expressions match complete UTF-8 sequences.
+ * The overall match is leftmost-longest like POSIX regexec, capture groups
+ * use the first (greedy) alternative, that produces this match.
+ */
+
+/*
+ * max number of cached DFA states per direction
+ * if the cache is full, it is flushed
+ */
+#define DFA_MAX_STATES 256
+
+/*
+ * max number of NFA instructions per pattern
+ */
+#define DFA_MAX_INSTS 16384
+
+/*
+ * max repetition count in {m,n}
+ */
+#define DFA_MAX_REPEAT 255
+
+/*
+ * dfa_compile_flags: case-insensitive matching of ASCII letters
+ */
+#define DFA_ICASE 1
+
+typedef enum NfaOp {
+    NFA_CLASS = 0,  // consume one byte of the class cls, then goto x
+    NFA_MATCH,
+    NFA_JMP,        // goto x
+    NFA_SPLIT,      // goto x and y, x has priority
+    NFA_SAVE,       // store position in capture slot n, goto x
+    NFA_BOL,        // assert beginning of the string, goto x
+    NFA_EOL         // assert end of the string, goto x
+} NfaOp;
+
+typedef struct NfaInst {
+    uint32_t op;
+    /*
+     * NFA_CLASS: class index, NFA_SAVE: slot
+     */
+    uint32_t n;
+    uint32_t x;
+    uint32_t y;
+} NfaInst;
+
+/*
+ * NFA program
+ *
+ * All arrays are flat and don't contain pointers.
+ */
+typedef struct NfaProgram {
+    NfaInst *insts;
+    uint32_t ninsts;
+
+    /*
+     * byte sets, 32 bytes per class
+     */
+    uint8_t *classes;
+    uint32_t nclasses;
+
+    uint32_t start;
+} NfaProgram;
+
+typedef struct DfaRegex DfaRegex;
+
+/*
+ * Compiles a pattern
+ *
+ * returns NULL if the pattern is invalid or uses unsupported syntax
+ * nsub: set to the number of capture groups
+ */
+DfaRegex* dfa_compile(const char *pattern, size_t *nsub);
+
+/*
+ * Compiles a pattern with flags (DFA_ICASE)
+ */
+DfaRegex* dfa_compile_flags(const char *pattern, int flags, size_t *nsub);
+
+/*
+ * Searches the leftmost-longest match in str
+ *
+ * Same semantics as regexec: returns 0 if a match was found and REG_NOMATCH
+ * otherwise. Capture groups are only computed if nmatch > 1.
+ * Supported eflags: REG_NOTBOL
+ */
+int dfa_exec(
+        DfaRegex *re,
+        const char *str,
+        size_t len,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags);
+
+void dfa_free(DfaRegex *re);
+
+/*
+ * Creates a regex from existing NFA programs, for example from a
+ * memory-mapped rules snapshot
+ * 
+ * The programs are not copied and must stay valid, until the regex is
+ * freed. Both programs must use the same classes array.
+ * returns NULL if the programs are inconsistent
+ */
+DfaRegex* dfa_load(const NfaProgram *fwd, const NfaProgram *rev, size_t nsub);
+
+/*
+ * returns the forward or reverse NFA program of the regex
+ */
+const NfaProgram* dfa_program(DfaRegex *re, int reverse);
+
+/*
+ * returns 1 if the pattern contains nested quantifiers like (a+)* or
+ * quantified alternatives like (a|ab)+, which can be slow in
+ * regex implementations with backtracking
+ */
+int dfa_pattern_risky(const char *pattern);
+
+#endif /* RTR_DFA_H */
@@ -0,0 +1,266 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dictionary.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DICTIONARY_HASH_INIT 2166136261u
+#define DICTIONARY_HASH_PRIME 16777619u
+
+static char ascii_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+int dictionary_word_char(char c) {
+    unsigned char b = c;
+    return b >= 0x80 || b == '_' || (b >= '0' && b <= '9') || (ascii_lower(b) >= 'a' && ascii_lower(b) <= 'z');
+}
+
+static uint32_t dictionary_hash(const Dictionary *dict, const char *word, size_t len) {
+    uint32_t h = DICTIONARY_HASH_INIT;
+    for(size_t i=0;i<len;i++) {
+        char c = dict->icase ? ascii_lower(word[i]) : word[i];
+        h = (h ^ (unsigned char)c) * DICTIONARY_HASH_PRIME;
+    }
+    return h;
+}
+
+/*
+ * compares a word with the word of an entry, the words of a
+ * case-insensitive dictionary are already folded
+ */
+static int dictionary_word_equal(
+        const Dictionary *dict,
+        const DictionaryEntry *entry,
+        const char *word,
+        size_t len)
+{
+    if(entry->word_len != len) {
+        return 0;
+    }
+    const char *w = dict->data + entry->word;
+    if(!dict->icase) {
+        return !memcmp(w, word, len);
+    }
+    for(size_t i=0;i<len;i++) {
+        if(ascii_lower(word[i]) != w[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * returns the table slot of the word, which is either empty or contains
+ * the entry of the word
+ */
+static size_t dictionary_slot(
+        const Dictionary *dict,
+        const char *word,
+        size_t len,
+        uint32_t hash)
+{
+    size_t mask = dict->table_size - 1;
+    size_t slot = hash & mask;
+    while(dict->table[slot]) {
+        const DictionaryEntry *entry = &dict->entries[dict->table[slot] - 1];
+        if(entry->hash == hash && dictionary_word_equal(dict, entry, word, len)) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static char* dictionary_read_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Cannot open dictionary %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat s;
+    if(fstat(fd, &s)) {
+        fprintf(stderr, "Cannot stat dictionary %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    // entries store 32 bit offsets
+    if(s.st_size >= UINT32_MAX) {
+        fprintf(stderr, "Dictionary %s is too large\n", path);
+        close(fd);
+        return NULL;
+    }
+    
+    size_t fsize = s.st_size;
+    char *data = malloc(fsize + 1);
+    size_t pos = 0;
+    while(pos < fsize) {
+        ssize_t r = read(fd, data + pos, fsize - pos);
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            break;
+        }
+        pos += r;
+    }
+    close(fd);
+    if(pos < fsize) {
+        fprintf(stderr, "Cannot read dictionary %s\n", path);
+        free(data);
+        return NULL;
+    }
+    data[pos] = '\0';
+    *size = pos;
+    return data;
+}
+
+Dictionary* dictionary_load(const char *path, int icase) {
+    size_t size;
+    char *data = dictionary_read_file(path, &size);
+    if(!data) {
+        return NULL;
+    }
+    
+    Dictionary *dict = calloc(1, sizeof(Dictionary));
+    dict->data = data;
+    dict->size = size;
+    dict->icase = icase;
+    
+    // every line contains at most one entry, the table is at most half full
+    size_t nlines = 1;
+    for(const char *p=data;(p = memchr(p, '\n', data + size - p)) != NULL;p++) {
+        nlines++;
+    }
+    dict->entries = malloc(nlines * sizeof(DictionaryEntry));
+    dict->table_size = 16;
+    while(dict->table_size < 2 * nlines) {
+        dict->table_size *= 2;
+    }
+    dict->table = calloc(dict->table_size, sizeof(uint32_t));
+    
+    size_t lineno = 0;
+    size_t pos = 0;
+    while(pos < size) {
+        char *ln = data + pos;
+        char *nl = memchr(ln, '\n', size - pos);
+        size_t lnlen = nl ? (size_t)(nl - ln) : size - pos;
+        pos += lnlen + 1;
+        lineno++;
+        if(lnlen > 0 && ln[lnlen-1] == '\r') {
+            lnlen--;
+        }
+        if(lnlen == 0) {
+            continue;
+        }
+        
+        char *tab = memchr(ln, '\t', lnlen);
+        if(!tab || tab == ln) {
+            fprintf(stderr, "Invalid dictionary entry in %s line %zu\n", path, lineno);
+            dictionary_free(dict);
+            return NULL;
+        }
+        size_t word_len = tab - ln;
+        if(icase) {
+            for(size_t i=0;i<word_len;i++) {
+                ln[i] = ascii_lower(ln[i]);
+            }
+        }
+        
+        uint32_t hash = dictionary_hash(dict, ln, word_len);
+        size_t slot = dictionary_slot(dict, ln, word_len, hash);
+        if(dict->table[slot]) {
+            // duplicate word, the first entry is used
+            continue;
+        }
+        DictionaryEntry *entry = &dict->entries[dict->nentries];
+        entry->hash = hash;
+        entry->word = ln - data;
+        entry->word_len = word_len;
+        entry->replacement = tab + 1 - data;
+        entry->replacement_len = lnlen - word_len - 1;
+        dict->table[slot] = ++dict->nentries;
+    }
+    
+    return dict;
+}
+
+void dictionary_free(Dictionary *dict) {
+    if(!dict) {
+        return;
+    }
+    free(dict->data);
+    free(dict->entries);
+    free(dict->table);
+    free(dict);
+}
+
+const DictionaryEntry* dictionary_lookup(
+        const Dictionary *dict,
+        const char *word,
+        size_t len)
+{
+    uint32_t hash = dictionary_hash(dict, word, len);
+    size_t slot = dictionary_slot(dict, word, len, hash);
+    return dict->table[slot] ? &dict->entries[dict->table[slot] - 1] : NULL;
+}
+
+const DictionaryEntry* dictionary_find(
+        const Dictionary *dict,
+        const char *str,
+        size_t start,
+        size_t end,
+        size_t *word_start,
+        size_t *word_end)
+{
+    size_t i = start;
+    if(i > 0 && dictionary_word_char(str[i-1])) {
+        // skip the rest of the word before start
+        while(i < end && dictionary_word_char(str[i])) {
+            i++;
+        }
+    }
+    
+    while(i < end) {
+        if(!dictionary_word_char(str[i])) {
+            i++;
+            continue;
+        }
+        // the hash is computed while the end of the word is searched
+        size_t ws = i;
+        uint32_t hash = DICTIONARY_HASH_INIT;
+        while(i < end && dictionary_word_char(str[i])) {
+            char c = dict->icase ? ascii_lower(str[i]) : str[i];
+            hash = (hash ^ (unsigned char)c) * DICTIONARY_HASH_PRIME;
+            i++;
+        }
+        size_t slot = dictionary_slot(dict, str + ws, i - ws, hash);
+        if(dict->table[slot]) {
+            *word_start = ws;
+            *word_end = i;
+            return &dict->entries[dict->table[slot] - 1];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,111 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_DICTIONARY_H
+#define RTR_DICTIONARY_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * word -> replacement entry
+ * word and replacement are offsets into the data block of the dictionary
+ */
+typedef struct DictionaryEntry {
+    uint32_t hash;
+    uint32_t word;
+    uint32_t word_len;
+    uint32_t replacement;
+    uint32_t replacement_len;
+} DictionaryEntry;
+
+/*
+ * Word table, loaded from a file with one "word <TAB> replacement" entry
+ * per line
+ * 
+ * The entries are stored in an open addressing hash table with the
+ * precomputed hash of each word. The words and replacements are not
+ * copied, they point into the content of the file, which is read into a
+ * single block.
+ */
+typedef struct Dictionary {
+    char *data;
+    size_t size;
+    
+    DictionaryEntry *entries;
+    size_t nentries;
+    
+    /*
+     * entry index + 1 or 0 for empty slots
+     * the size is a power of 2
+     */
+    uint32_t *table;
+    size_t table_size;
+    
+    /*
+     * words are compared without the case of ASCII letters
+     */
+    int icase;
+} Dictionary;
+
+/*
+ * Loads a dictionary file
+ * 
+ * Empty lines are ignored. If a word is contained more than once, the
+ * first entry is used.
+ * returns NULL if the file couldn't be read or contains invalid lines
+ */
+Dictionary* dictionary_load(const char *path, int icase);
+
+void dictionary_free(Dictionary *dict);
+
+/*
+ * looks up a word
+ * returns the entry or NULL
+ */
+const DictionaryEntry* dictionary_lookup(
+        const Dictionary *dict,
+        const char *word,
+        size_t len);
+
+/*
+ * Searches the first word in the range start - end of str, that is
+ * contained in the dictionary
+ * 
+ * Words are separated by non-word characters (see dictionary_word_char).
+ * The text before start is the context of the search: a word, that begins
+ * before start, is skipped. The end of the range is a word boundary.
+ * The range is tokenized in one pass with one lookup per word.
+ * 
+ * returns the entry and sets the position of the word or returns NULL
+ */
+const DictionaryEntry* dictionary_find(
+        const Dictionary *dict,
+        const char *str,
+        size_t start,
+        size_t end,
+        size_t *word_start,
+        size_t *word_end);
+
+/*
+ * letters, digits, _ and bytes of multi-byte UTF-8 sequences are word
+ * characters
+ */
+int dictionary_word_char(char c);
+
+#endif /* RTR_DICTIONARY_H */
@@ -0,0 +1,488 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "purple.h"
+
+/* ------------------------------ signals ---------------------------------- */
+
+typedef struct Signal {
+    void *instance;
+    char *name;
+    PurpleSignalMarshalFunc marshal;
+} Signal;
+
+typedef struct SignalHandler {
+    gulong id;
+    Signal *signal;
+    void *handle;
+    PurpleCallback func;
+    void *data;
+    int priority;
+} SignalHandler;
+
+static Signal *signals;
+static size_t nsignals;
+
+/*
+ * handlers of all signals, sorted by priority
+ * handlers with the same priority are called in the order they were
+ * connected
+ */
+static SignalHandler *handlers;
+static size_t nhandlers;
+static size_t handlers_alloc;
+
+static gulong last_handler_id;
+
+static Signal* signal_find(void *instance, const char *name) {
+    for(size_t i=0;i<nsignals;i++) {
+        if(signals[i].instance == instance && !strcmp(signals[i].name, name)) {
+            return &signals[i];
+        }
+    }
+    return NULL;
+}
+
+gulong purple_signal_register(void *instance, const char *signal,
+        PurpleSignalMarshalFunc marshal)
+{
+    if(signal_find(instance, signal)) {
+        return 0;
+    }
+    signals = g_realloc(signals, (nsignals + 1) * sizeof(Signal));
+    signals[nsignals].instance = instance;
+    signals[nsignals].name = g_strdup(signal);
+    signals[nsignals].marshal = marshal;
+    nsignals++;
+    return nsignals;
+}
+
+gulong purple_signal_connect_priority(void *instance, const char *signal,
+        void *handle, PurpleCallback func, void *data, int priority)
+{
+    Signal *sig = signal_find(instance, signal);
+    if(!sig) {
+        fprintf(stderr, "purple: signal %s is not registered\n", signal);
+        return 0;
+    }
+    if(nhandlers == handlers_alloc) {
+        handlers_alloc = handlers_alloc ? handlers_alloc * 2 : 16;
+        handlers = g_realloc(handlers, handlers_alloc * sizeof(SignalHandler));
+    }
+    size_t pos = nhandlers;
+    while(pos > 0 && handlers[pos-1].priority > priority) {
+        pos--;
+    }
+    memmove(handlers + pos + 1, handlers + pos, (nhandlers - pos) * sizeof(SignalHandler));
+    SignalHandler *h = &handlers[pos];
+    h->id = ++last_handler_id;
+    h->signal = sig;
+    h->handle = handle;
+    h->func = func;
+    h->data = data;
+    h->priority = priority;
+    nhandlers++;
+    return h->id;
+}
+
+gulong purple_signal_connect(void *instance, const char *signal,
+        void *handle, PurpleCallback func, void *data)
+{
+    return purple_signal_connect_priority(instance, signal, handle, func,
+            data, PURPLE_SIGNAL_PRIORITY_DEFAULT);
+}
+
+void purple_signals_disconnect_by_handle(void *handle) {
+    size_t n = 0;
+    for(size_t i=0;i<nhandlers;i++) {
+        if(handlers[i].handle != handle) {
+            handlers[n++] = handlers[i];
+        }
+    }
+    nhandlers = n;
+}
+
+/*
+ * calls the handlers of the signal
+ * if return_1 is set, the emission stops at the first non-NULL result
+ */
+static void* signal_emit(void *instance, const char *signal, int return_1, va_list args) {
+    Signal *sig = signal_find(instance, signal);
+    if(!sig) {
+        fprintf(stderr, "purple: signal %s is not registered\n", signal);
+        return NULL;
+    }
+    for(size_t i=0;i<nhandlers;i++) {
+        SignalHandler *h = &handlers[i];
+        if(h->signal != sig) {
+            continue;
+        }
+        void *ret = NULL;
+        va_list tmp;
+        va_copy(tmp, args);
+        sig->marshal(h->func, tmp, h->data, return_1 ? &ret : NULL);
+        va_end(tmp);
+        if(ret) {
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+void purple_signal_emit(void *instance, const char *signal, ...) {
+    va_list args;
+    va_start(args, signal);
+    signal_emit(instance, signal, 0, args);
+    va_end(args);
+}
+
+void* purple_signal_emit_return_1(void *instance, const char *signal, ...) {
+    va_list args;
+    va_start(args, signal);
+    void *ret = signal_emit(instance, signal, 1, args);
+    va_end(args);
+    return ret;
+}
+
+void purple_marshal_VOID__POINTER(PurpleCallback cb, va_list args,
+        void *data, void **return_val)
+{
+    void *arg1 = va_arg(args, void*);
+    ((void(*)(void*, void*))cb)(arg1, data);
+}
+
+void purple_marshal_VOID__POINTER_POINTER_POINTER(PurpleCallback cb,
+        va_list args, void *data, void **return_val)
+{
+    void *arg1 = va_arg(args, void*);
+    void *arg2 = va_arg(args, void*);
+    void *arg3 = va_arg(args, void*);
+    ((void(*)(void*, void*, void*, void*))cb)(arg1, arg2, arg3, data);
+}
+
+void purple_marshal_VOID__POINTER_POINTER_UINT(PurpleCallback cb,
+        va_list args, void *data, void **return_val)
+{
+    void *arg1 = va_arg(args, void*);
+    void *arg2 = va_arg(args, void*);
+    guint arg3 = va_arg(args, guint);
+    ((void(*)(void*, void*, guint, void*))cb)(arg1, arg2, arg3, data);
+}
+
+void purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_UINT(
+        PurpleCallback cb, va_list args, void *data, void **return_val)
+{
+    void *arg1 = va_arg(args, void*);
+    void *arg2 = va_arg(args, void*);
+    void *arg3 = va_arg(args, void*);
+    void *arg4 = va_arg(args, void*);
+    guint arg5 = va_arg(args, guint);
+    gboolean ret = ((gboolean(*)(void*, void*, void*, void*, guint, void*))cb)(
+            arg1, arg2, arg3, arg4, arg5, data);
+    if(return_val) {
+        *return_val = GINT_TO_POINTER(ret);
+    }
+}
+
+/* ------------------------------ plugins ---------------------------------- */
+
+gboolean purple_plugin_register(PurplePlugin *plugin) {
+    PurplePluginInfo *info = plugin->info;
+    if(!info || info->magic != PURPLE_PLUGIN_MAGIC
+            || info->major_version != PURPLE_MAJOR_VERSION)
+    {
+        fprintf(stderr, "purple: incompatible plugin\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean purple_plugin_load(PurplePlugin *plugin) {
+    if(plugin->loaded) {
+        return TRUE;
+    }
+    if(plugin->info->load && !plugin->info->load(plugin)) {
+        return FALSE;
+    }
+    plugin->loaded = TRUE;
+    return TRUE;
+}
+
+gboolean purple_plugin_unload(PurplePlugin *plugin) {
+    if(!plugin->loaded) {
+        return TRUE;
+    }
+    if(plugin->info->unload && !plugin->info->unload(plugin)) {
+        return FALSE;
+    }
+    purple_signals_disconnect_by_handle(plugin);
+    plugin->loaded = FALSE;
+    return TRUE;
+}
+
+/* --------------------------- accounts, util ------------------------------ */
+
+struct _PurpleConnection {
+    PurpleAccount *account;
+};
+
+struct _PurpleAccount {
+    char *username;
+    char *protocol_id;
+    PurpleConnection gc;
+};
+
+PurpleAccount* purple_account_new(const char *username, const char *protocol_id) {
+    PurpleAccount *account = g_malloc0(sizeof(PurpleAccount));
+    account->username = g_strdup(username);
+    account->protocol_id = g_strdup(protocol_id);
+    account->gc.account = account;
+    return account;
+}
+
+void purple_account_destroy(PurpleAccount *account) {
+    g_free(account->username);
+    g_free(account->protocol_id);
+    g_free(account);
+}
+
+PurpleConnection* purple_account_get_connection(const PurpleAccount *account) {
+    return (PurpleConnection*)&account->gc;
+}
+
+static char *user_dir;
+
+const char* purple_user_dir(void) {
+    return user_dir ? user_dir : ".";
+}
+
+void purple_util_set_user_dir(const char *dir) {
+    g_free(user_dir);
+    user_dir = g_strdup(dir);
+}
+
+/* ---------------------------- conversations ------------------------------ */
+
+struct _PurpleConversation {
+    PurpleConversationType type;
+    PurpleAccount *account;
+    char *name;
+    int chat_id;
+    char *last_sent;
+    char *last_written;
+};
+
+static PurpleConversation **conversations;
+static size_t nconversations;
+
+static int last_chat_id;
+
+/*
+ * the address is used as instance of the conversation signals
+ */
+static int conversations_handle;
+
+void* purple_conversations_get_handle(void) {
+    return &conversations_handle;
+}
+
+void purple_conversations_init(void) {
+    void *handle = purple_conversations_get_handle();
+    purple_signal_register(handle, "writing-im-msg",
+            purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_UINT);
+    purple_signal_register(handle, "sending-im-msg",
+            purple_marshal_VOID__POINTER_POINTER_POINTER);
+    purple_signal_register(handle, "writing-chat-msg",
+            purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_UINT);
+    purple_signal_register(handle, "sending-chat-msg",
+            purple_marshal_VOID__POINTER_POINTER_UINT);
+    purple_signal_register(handle, "deleting-conversation",
+            purple_marshal_VOID__POINTER);
+}
+
+void purple_conversations_uninit(void) {
+    while(nconversations > 0) {
+        purple_conversation_destroy(conversations[nconversations-1]);
+    }
+    g_free(conversations);
+    conversations = NULL;
+    
+    for(size_t i=0;i<nsignals;i++) {
+        g_free(signals[i].name);
+    }
+    g_free(signals);
+    signals = NULL;
+    nsignals = 0;
+    g_free(handlers);
+    handlers = NULL;
+    nhandlers = 0;
+    handlers_alloc = 0;
+}
+
+PurpleConversation* purple_conversation_new(PurpleConversationType type,
+        PurpleAccount *account, const char *name)
+{
+    PurpleConversation *conv = purple_find_conversation_with_account(type, name, account);
+    if(conv) {
+        return conv;
+    }
+    conv = g_malloc0(sizeof(PurpleConversation));
+    conv->type = type;
+    conv->account = account;
+    conv->name = g_strdup(name);
+    if(type == PURPLE_CONV_TYPE_CHAT) {
+        conv->chat_id = ++last_chat_id;
+    }
+    conversations = g_realloc(conversations, (nconversations + 1) * sizeof(PurpleConversation*));
+    conversations[nconversations++] = conv;
+    return conv;
+}
+
+void purple_conversation_destroy(PurpleConversation *conv) {
+    purple_signal_emit(purple_conversations_get_handle(), "deleting-conversation", conv);
+    for(size_t i=0;i<nconversations;i++) {
+        if(conversations[i] == conv) {
+            memmove(conversations + i, conversations + i + 1, (nconversations - i - 1) * sizeof(PurpleConversation*));
+            nconversations--;
+            break;
+        }
+    }
+    g_free(conv->name);
+    g_free(conv->last_sent);
+    g_free(conv->last_written);
+    g_free(conv);
+}
+
+int purple_conv_chat_get_id(const PurpleConversation *conv) {
+    return conv->chat_id;
+}
+
+PurpleConversation* purple_find_conversation_with_account(
+        PurpleConversationType type, const char *name,
+        const PurpleAccount *account)
+{
+    for(size_t i=0;i<nconversations;i++) {
+        PurpleConversation *conv = conversations[i];
+        if((type == PURPLE_CONV_TYPE_ANY || conv->type == type)
+                && conv->account == account && !strcmp(conv->name, name))
+        {
+            return conv;
+        }
+    }
+    return NULL;
+}
+
+PurpleConversation* purple_find_chat(const PurpleConnection *gc, int id) {
+    for(size_t i=0;i<nconversations;i++) {
+        PurpleConversation *conv = conversations[i];
+        if(conv->type == PURPLE_CONV_TYPE_CHAT && &conv->account->gc == gc
+                && conv->chat_id == id)
+        {
+            return conv;
+        }
+    }
+    return NULL;
+}
+
+void purple_conversation_write(PurpleConversation *conv, const char *who,
+        const char *message, PurpleMessageFlags flags)
+{
+    const char *signal = conv->type == PURPLE_CONV_TYPE_CHAT ? "writing-chat-msg" : "writing-im-msg";
+    char *displayed = g_strdup(message);
+    if(purple_signal_emit_return_1(purple_conversations_get_handle(), signal,
+            conv->account, who, &displayed, conv, flags))
+    {
+        // a plugin cancelled the message
+        g_free(displayed);
+        return;
+    }
+    g_free(conv->last_written);
+    conv->last_written = displayed;
+}
+
+/*
+ * libpurple common_send: the displayed copy is taken before the sending
+ * signal, which can modify or cancel the sent message. An im is written
+ * with the displayed copy and PURPLE_MESSAGE_SEND, a chat message is only
+ * written, when the server echoes the sent message back.
+ */
+static void conv_send(PurpleConversation *conv, const char *message) {
+    char *displayed = g_strdup(message);
+    char *sent = g_strdup(message);
+    if(conv->type == PURPLE_CONV_TYPE_CHAT) {
+        purple_signal_emit(purple_conversations_get_handle(), "sending-chat-msg",
+                conv->account, &sent, conv->chat_id);
+    } else {
+        purple_signal_emit(purple_conversations_get_handle(), "sending-im-msg",
+                conv->account, conv->name, &sent);
+    }
+    if(!sent || *sent == '\0') {
+        g_free(sent);
+        g_free(displayed);
+        return;
+    }
+    // there is no server, the message is only stored
+    g_free(conv->last_sent);
+    conv->last_sent = sent;
+    if(conv->type == PURPLE_CONV_TYPE_CHAT) {
+        // simulated server echo of the sent message
+        purple_conversation_write(conv, conv->account->username, sent, PURPLE_MESSAGE_SEND);
+    } else {
+        purple_conversation_write(conv, conv->account->username, displayed, PURPLE_MESSAGE_SEND);
+    }
+    g_free(displayed);
+}
+
+void purple_conv_im_send(PurpleConversation *conv, const char *message) {
+    conv_send(conv, message);
+}
+
+void purple_conv_chat_send(PurpleConversation *conv, const char *message) {
+    conv_send(conv, message);
+}
+
+const char* purple_conversation_get_last_sent(PurpleConversation *conv) {
+    return conv->last_sent;
+}
+
+const char* purple_conversation_get_last_written(PurpleConversation *conv) {
+    return conv->last_written;
+}
+
+/* ------------------------------- pidgin ---------------------------------- */
+
+/*
+ * the config UI of the plugin (ui.c) needs GTK and is replaced with
+ * these functions
+ */
+
+GtkWidget *get_config_frame(PurplePlugin *plugin) {
+    return NULL;
+}
+
+void ui_rules_status_changed(void) {
+    
+}
+
+void ui_rules_reloaded(void) {
+    
+}
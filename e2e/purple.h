@@ -0,0 +1,232 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal stand-in for the libpurple and pidgin APIs, that are used by
+ * the plugin
+ * 
+ * Only the signal and conversation functions are implemented. The plugin
+ * is compiled against these headers with -Ie2e instead of the pidgin
+ * headers and runs without pidgin, a UI or network connection.
+ */
+
+#ifndef RTR_E2E_PURPLE_H
+#define RTR_E2E_PURPLE_H
+
+#include <stdarg.h>
+#include <glib.h>
+
+/* version.h */
+#define PURPLE_MAJOR_VERSION 2
+#define PURPLE_MINOR_VERSION 14
+
+/* signals.h */
+typedef void (*PurpleCallback)(void);
+typedef void (*PurpleSignalMarshalFunc)(PurpleCallback cb, va_list args,
+        void *data, void **return_val);
+
+#define PURPLE_CALLBACK(func) ((PurpleCallback)(func))
+
+#define PURPLE_SIGNAL_PRIORITY_DEFAULT 0
+#define PURPLE_SIGNAL_PRIORITY_HIGHEST 9999
+#define PURPLE_SIGNAL_PRIORITY_LOWEST -9999
+
+/*
+ * registers a signal
+ * the marshal function calls the callbacks with the arguments of
+ * purple_signal_emit
+ */
+gulong purple_signal_register(void *instance, const char *signal,
+        PurpleSignalMarshalFunc marshal);
+
+gulong purple_signal_connect(void *instance, const char *signal,
+        void *handle, PurpleCallback func, void *data);
+gulong purple_signal_connect_priority(void *instance, const char *signal,
+        void *handle, PurpleCallback func, void *data, int priority);
+void purple_signals_disconnect_by_handle(void *handle);
+
+void purple_signal_emit(void *instance, const char *signal, ...);
+
+/*
+ * emits the signal until a callback returns non-NULL
+ */
+void* purple_signal_emit_return_1(void *instance, const char *signal, ...);
+
+void purple_marshal_VOID__POINTER(PurpleCallback cb, va_list args,
+        void *data, void **return_val);
+void purple_marshal_VOID__POINTER_POINTER_POINTER(PurpleCallback cb,
+        va_list args, void *data, void **return_val);
+void purple_marshal_VOID__POINTER_POINTER_UINT(PurpleCallback cb,
+        va_list args, void *data, void **return_val);
+void purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_UINT(
+        PurpleCallback cb, va_list args, void *data, void **return_val);
+
+/* plugin.h */
+#define PURPLE_PLUGIN_MAGIC 5
+#define PURPLE_PRIORITY_HIGHEST 9999
+
+typedef enum {
+    PURPLE_PLUGIN_UNKNOWN = -1,
+    PURPLE_PLUGIN_STANDARD = 0,
+    PURPLE_PLUGIN_LOADER,
+    PURPLE_PLUGIN_PROTOCOL
+} PurplePluginType;
+
+typedef struct _PurplePlugin PurplePlugin;
+
+typedef struct _PurplePluginInfo {
+    unsigned int magic;
+    unsigned int major_version;
+    unsigned int minor_version;
+    PurplePluginType type;
+    char *ui_requirement;
+    unsigned long flags;
+    GList *dependencies;
+    int priority;
+    
+    const char *id;
+    const char *name;
+    const char *version;
+    const char *summary;
+    const char *description;
+    const char *author;
+    const char *homepage;
+    
+    gboolean (*load)(PurplePlugin *plugin);
+    gboolean (*unload)(PurplePlugin *plugin);
+    void (*destroy)(PurplePlugin *plugin);
+    
+    void *ui_info;
+    void *extra_info;
+    void *prefs_info;
+    GList *(*actions)(PurplePlugin *plugin, gpointer context);
+    
+    void (*_purple_reserved1)(void);
+    void (*_purple_reserved2)(void);
+    void (*_purple_reserved3)(void);
+    void (*_purple_reserved4)(void);
+} PurplePluginInfo;
+
+struct _PurplePlugin {
+    PurplePluginInfo *info;
+    gboolean loaded;
+};
+
+/*
+ * the plugin is linked into the program, therefore the init function
+ * always has the same name
+ */
+#define PURPLE_INIT_PLUGIN(pluginname, initfunc, plugininfo) \
+    gboolean purple_init_plugin(PurplePlugin *plugin); \
+    gboolean purple_init_plugin(PurplePlugin *plugin) { \
+        plugin->info = &(plugininfo); \
+        initfunc((plugin)); \
+        return purple_plugin_register(plugin); \
+    }
+
+gboolean purple_init_plugin(PurplePlugin *plugin);
+gboolean purple_plugin_register(PurplePlugin *plugin);
+gboolean purple_plugin_load(PurplePlugin *plugin);
+gboolean purple_plugin_unload(PurplePlugin *plugin);
+
+/* account.h, connection.h */
+typedef struct _PurpleConnection PurpleConnection;
+typedef struct _PurpleAccount PurpleAccount;
+
+PurpleAccount* purple_account_new(const char *username, const char *protocol_id);
+void purple_account_destroy(PurpleAccount *account);
+PurpleConnection* purple_account_get_connection(const PurpleAccount *account);
+
+/* conversation.h */
+typedef enum {
+    PURPLE_CONV_TYPE_UNKNOWN = 0,
+    PURPLE_CONV_TYPE_IM,
+    PURPLE_CONV_TYPE_CHAT,
+    PURPLE_CONV_TYPE_MISC,
+    PURPLE_CONV_TYPE_ANY
+} PurpleConversationType;
+
+typedef enum {
+    PURPLE_MESSAGE_SEND = 0x0001,
+    PURPLE_MESSAGE_RECV = 0x0002,
+    PURPLE_MESSAGE_SYSTEM = 0x0004
+} PurpleMessageFlags;
+
+typedef struct _PurpleConversation PurpleConversation;
+
+void purple_conversations_init(void);
+void purple_conversations_uninit(void);
+void* purple_conversations_get_handle(void);
+
+/*
+ * creates a conversation or returns the existing conversation
+ * chats are identified by name and have the next free chat id
+ */
+PurpleConversation* purple_conversation_new(PurpleConversationType type,
+        PurpleAccount *account, const char *name);
+void purple_conversation_destroy(PurpleConversation *conv);
+
+int purple_conv_chat_get_id(const PurpleConversation *conv);
+
+PurpleConversation* purple_find_conversation_with_account(
+        PurpleConversationType type, const char *name,
+        const PurpleAccount *account);
+PurpleConversation* purple_find_chat(const PurpleConnection *gc, int id);
+
+/*
+ * sends a message like the libpurple send functions:
+ * sending-im-msg/sending-chat-msg is emitted with a copy of the message,
+ * then the sent message is written to the conversation
+ */
+void purple_conv_im_send(PurpleConversation *conv, const char *message);
+void purple_conv_chat_send(PurpleConversation *conv, const char *message);
+
+/*
+ * writes a message to the conversation window
+ * writing-im-msg/writing-chat-msg is emitted with a copy of the message
+ */
+void purple_conversation_write(PurpleConversation *conv, const char *who,
+        const char *message, PurpleMessageFlags flags);
+
+/*
+ * last message, that was sent to the server or written to the
+ * conversation window
+ */
+const char* purple_conversation_get_last_sent(PurpleConversation *conv);
+const char* purple_conversation_get_last_written(PurpleConversation *conv);
+
+/* util.h */
+const char* purple_user_dir(void);
+void purple_util_set_user_dir(const char *dir);
+
+/* gtkplugin.h */
+typedef struct _GtkWidget GtkWidget;
+
+typedef struct _PidginPluginUiInfo {
+    GtkWidget *(*get_config_frame)(PurplePlugin *plugin);
+    int page_num;
+    
+    void (*_pidgin_reserved1)(void);
+    void (*_pidgin_reserved2)(void);
+    void (*_pidgin_reserved3)(void);
+    void (*_pidgin_reserved4)(void);
+} PidginPluginUiInfo;
+
+#define PIDGIN_PLUGIN_TYPE "gtk-gaim"
+
+#endif /* RTR_E2E_PURPLE_H */
@@ -0,0 +1,423 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * rtr-e2e: end-to-end benchmark of the plugin
+ * 
+ * The plugin is linked against the libpurple stand-in (purple.c) and loaded
+ * with purple_plugin_load. The messages of a script are sent through the
+ * same signals as in pidgin: sending-im-msg/sending-chat-msg, followed by
+ * writing-im-msg with the text from before the sending signal or
+ * writing-chat-msg with the server echo of the sent text. The latency of each message includes
+ * both signal emissions and all plugin handlers.
+ * 
+ * Script format, one message per line:
+ * 
+ *     im <TAB> buddy <TAB> message     outgoing im
+ *     chat <TAB> room <TAB> message    outgoing chat message
+ *     recv <TAB> buddy <TAB> message   incoming im, must not be rewritten
+ * 
+ * Empty lines and lines starting with # are ignored.
+ * 
+ * The results are written to stdout as JSON.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "purple.h"
+#include "../regex-text-replacement.h"
+#include "../compile-worker.h"
+#include "../alloc-count.h"
+
+#define E2E_DEFAULT_ITERATIONS 100
+
+typedef enum ScriptMessageType {
+    SCRIPT_IM = 0,
+    SCRIPT_CHAT,
+    SCRIPT_RECV
+} ScriptMessageType;
+
+static const char *script_type_names[] = { "im", "chat", "recv" };
+
+typedef struct ScriptMessage {
+    ScriptMessageType type;
+    int line;
+    char *text;
+    PurpleConversation *conv;
+    
+    /*
+     * latency of each iteration in ns
+     */
+    uint64_t *samples;
+    
+    /*
+     * allocations of all iterations
+     */
+    unsigned long allocs;
+    
+    /*
+     * the plugin changed the message
+     */
+    int changed;
+} ScriptMessage;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sample_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(uint64_t *sorted, size_t n, int p) {
+    return sorted[(n - 1) * p / 100];
+}
+
+static void usage(FILE *out) {
+    fprintf(out, "Usage: rtr-e2e [-n iterations] rules-file script-file\n\n");
+    fprintf(out, "Loads the plugin with the rules, sends the messages of the script through\n");
+    fprintf(out, "the libpurple signals and writes the latency of each message as JSON.\n\n");
+    fprintf(out, "  -n iterations   number of times the script is replayed (default: %d)\n", E2E_DEFAULT_ITERATIONS);
+}
+
+static void json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for(const unsigned char *s=(const unsigned char*)str;*s;s++) {
+        if(*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if(*s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/*
+ * parses the script and creates the conversations of the messages
+ * returns the number of messages or -1 on error
+ */
+static int load_script(const char *path, PurpleAccount *account, ScriptMessage **messages) {
+    FILE *in = fopen(path, "r");
+    if(!in) {
+        perror(path);
+        return -1;
+    }
+    
+    ScriptMessage *msgs = NULL;
+    size_t nmsgs = 0;
+    int err = 0;
+    
+    char *line = NULL;
+    size_t linealloc = 0;
+    ssize_t linelen;
+    int lineno = 0;
+    while((linelen = getline(&line, &linealloc, in)) >= 0) {
+        lineno++;
+        if(linelen > 0 && line[linelen-1] == '\n') {
+            line[--linelen] = '\0';
+        }
+        if(linelen == 0 || line[0] == '#') {
+            continue;
+        }
+        char *name = strchr(line, '\t');
+        char *text = name ? strchr(name + 1, '\t') : NULL;
+        if(!text) {
+            fprintf(stderr, "%s:%d: invalid message\n", path, lineno);
+            err = 1;
+            break;
+        }
+        *name++ = '\0';
+        *text++ = '\0';
+        
+        ScriptMessage msg;
+        memset(&msg, 0, sizeof(ScriptMessage));
+        if(!strcmp(line, "im")) {
+            msg.type = SCRIPT_IM;
+        } else if(!strcmp(line, "chat")) {
+            msg.type = SCRIPT_CHAT;
+        } else if(!strcmp(line, "recv")) {
+            msg.type = SCRIPT_RECV;
+        } else {
+            fprintf(stderr, "%s:%d: unknown message type: %s\n", path, lineno, line);
+            err = 1;
+            break;
+        }
+        msg.line = lineno;
+        msg.text = strdup(text);
+        msg.conv = purple_conversation_new(
+                msg.type == SCRIPT_CHAT ? PURPLE_CONV_TYPE_CHAT : PURPLE_CONV_TYPE_IM,
+                account, name);
+        
+        msgs = realloc(msgs, (nmsgs + 1) * sizeof(ScriptMessage));
+        msgs[nmsgs++] = msg;
+    }
+    free(line);
+    fclose(in);
+    
+    if(err) {
+        for(size_t i=0;i<nmsgs;i++) {
+            free(msgs[i].text);
+        }
+        free(msgs);
+        return -1;
+    }
+    *messages = msgs;
+    return nmsgs;
+}
+
+/*
+ * sends or receives one message
+ * returns 0, if the written message is the expected result
+ */
+static int send_message(ScriptMessage *msg) {
+    switch(msg->type) {
+        case SCRIPT_IM: {
+            purple_conv_im_send(msg->conv, msg->text);
+            break;
+        }
+        case SCRIPT_CHAT: {
+            purple_conv_chat_send(msg->conv, msg->text);
+            break;
+        }
+        case SCRIPT_RECV: {
+            purple_conversation_write(msg->conv, "remote", msg->text, PURPLE_MESSAGE_RECV);
+            break;
+        }
+    }
+    
+    const char *written = purple_conversation_get_last_written(msg->conv);
+    if(msg->type == SCRIPT_RECV) {
+        return strcmp(written, msg->text) != 0;
+    }
+    // an im is written with the text from before the sending signal, the
+    // conversation only shows the sent text, if the writing-im-msg handler
+    // of the plugin found the result in its cache
+    const char *sent = purple_conversation_get_last_sent(msg->conv);
+    if(!sent || !written || strcmp(sent, written)) {
+        return 1;
+    }
+    msg->changed = strcmp(sent, msg->text) != 0;
+    return 0;
+}
+
+static int copy_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "r");
+    if(!in) {
+        perror(src);
+        return 1;
+    }
+    FILE *out = fopen(dst, "w");
+    if(!out) {
+        perror(dst);
+        fclose(in);
+        return 1;
+    }
+    char buf[16384];
+    size_t r;
+    while((r = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, r, out);
+    }
+    fclose(in);
+    return fclose(out) != 0;
+}
+
+/*
+ * removes the temporary user dir and the files, that the plugin created
+ */
+static void remove_user_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if(d) {
+        struct dirent *ent;
+        while((ent = readdir(d)) != NULL) {
+            if(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+                continue;
+            }
+            char *path = g_build_filename(dir, ent->d_name, NULL);
+            unlink(path);
+            g_free(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char **argv) {
+    int iterations = E2E_DEFAULT_ITERATIONS;
+    const char *rules_file = NULL;
+    const char *script_file = NULL;
+    for(int i=1;i<argc;i++) {
+        if(!strcmp(argv[i], "-n") && i+1 < argc) {
+            iterations = atoi(argv[++i]);
+            if(iterations <= 0) {
+                fprintf(stderr, "invalid number of iterations: %s\n", argv[i]);
+                return 2;
+            }
+        } else if(!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(stdout);
+            return 0;
+        } else if(!rules_file) {
+            rules_file = argv[i];
+        } else if(!script_file) {
+            script_file = argv[i];
+        } else {
+            usage(stderr);
+            return 2;
+        }
+    }
+    if(!script_file) {
+        usage(stderr);
+        return 2;
+    }
+    
+    // the plugin loads the rules file from the user dir
+    const char *tmp = getenv("TMPDIR");
+    char *user_dir = g_build_filename(tmp ? tmp : "/tmp", "rtr-e2e-XXXXXX", NULL);
+    if(!mkdtemp(user_dir)) {
+        perror("mkdtemp");
+        g_free(user_dir);
+        return 1;
+    }
+    purple_util_set_user_dir(user_dir);
+    char *rules_path = rules_file_path();
+    int err = copy_file(rules_file, rules_path);
+    free(rules_path);
+    if(err) {
+        remove_user_dir(user_dir);
+        g_free(user_dir);
+        return 1;
+    }
+    
+    purple_conversations_init();
+    PurpleAccount *account = purple_account_new("e2e@localhost", "prpl-e2e");
+    
+    ScriptMessage *messages = NULL;
+    int nmessages = load_script(script_file, account, &messages);
+    
+    PurplePlugin plugin;
+    memset(&plugin, 0, sizeof(PurplePlugin));
+    if(nmessages < 0 || !purple_init_plugin(&plugin) || !purple_plugin_load(&plugin)) {
+        purple_conversations_uninit();
+        purple_account_destroy(account);
+        remove_user_dir(user_dir);
+        g_free(user_dir);
+        return 1;
+    }
+    // measure the messages with all rules compiled
+    compile_worker_wait();
+    size_t nrules;
+    get_rules(&nrules);
+    
+    uint64_t *all_samples = malloc((size_t)nmessages * iterations * sizeof(uint64_t));
+    size_t nsamples = 0;
+    for(int i=0;i<nmessages;i++) {
+        messages[i].samples = malloc(iterations * sizeof(uint64_t));
+    }
+    
+    // the first iteration includes the warm-up of the plugin (scratch
+    // buffers, DFA states), the same as the first messages in pidgin
+    int failed = 0;
+    unsigned long total_allocs = 0;
+    uint64_t total_start = now_ns();
+    for(int n=0;n<iterations;n++) {
+        for(int i=0;i<nmessages;i++) {
+            ScriptMessage *msg = &messages[i];
+            alloc_count_start();
+            uint64_t start = now_ns();
+            int mismatch = send_message(msg);
+            uint64_t t = now_ns() - start;
+            unsigned long allocs = alloc_count_stop();
+            
+            msg->samples[n] = t;
+            msg->allocs += allocs;
+            total_allocs += allocs;
+            all_samples[nsamples++] = t;
+            if(mismatch) {
+                if(n == 0) {
+                    fprintf(stderr, "%s:%d: conversation doesn't show the sent message\n", script_file, msg->line);
+                }
+                failed = 1;
+            }
+        }
+    }
+    uint64_t total_ns = now_ns() - total_start;
+    
+    printf("{\"rules\": %zu, \"iterations\": %d, \"messages\": [", nrules, iterations);
+    for(int i=0;i<nmessages;i++) {
+        ScriptMessage *msg = &messages[i];
+        uint64_t first = msg->samples[0];
+        qsort(msg->samples, iterations, sizeof(uint64_t), sample_cmp);
+        printf("%s\n  {\"line\": %d, \"type\": \"%s\", \"text\": ", i > 0 ? "," : "", msg->line, script_type_names[msg->type]);
+        json_string(stdout, msg->text);
+        printf(", \"bytes\": %zu, \"changed\": %s, \"first_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"allocs_per_msg\": %.2f}",
+                strlen(msg->text),
+                msg->changed ? "true" : "false",
+                (unsigned long long)first,
+                (unsigned long long)percentile(msg->samples, iterations, 50),
+                (unsigned long long)percentile(msg->samples, iterations, 99),
+                (double)msg->allocs / iterations);
+    }
+    printf("\n], \"total\": {\"messages\": %zu, \"ns\": %llu", nsamples, (unsigned long long)total_ns);
+    if(nsamples > 0) {
+        qsort(all_samples, nsamples, sizeof(uint64_t), sample_cmp);
+        printf(", \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu",
+                (unsigned long long)percentile(all_samples, nsamples, 50),
+                (unsigned long long)percentile(all_samples, nsamples, 99),
+                (unsigned long long)all_samples[nsamples-1]);
+    }
+    ResultCache *cache = get_sent_results();
+    printf(", \"allocs\": %lu, \"allocs_per_msg\": %.2f, \"result_cache_hits\": %lu, \"result_cache_misses\": %lu}}\n",
+            total_allocs,
+            nsamples > 0 ? (double)total_allocs / nsamples : 0.0,
+            cache->hits,
+            cache->misses);
+    
+    // conversations are closed before the plugin is unloaded, like
+    // pidgin does on exit
+    purple_conversations_uninit();
+    purple_plugin_unload(&plugin);
+    purple_account_destroy(account);
+    
+    for(int i=0;i<nmessages;i++) {
+        free(messages[i].text);
+        free(messages[i].samples);
+    }
+    free(messages);
+    free(all_samples);
+    remove_user_dir(user_dir);
+    g_free(user_dir);
+    purple_util_set_user_dir(NULL);
+    
+    if(failed) {
+        fprintf(stderr, "rtr-e2e: messages were not written as sent\n");
+    }
+    return failed;
+}
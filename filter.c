@@ -0,0 +1,170 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filter.h"
+#include "regex-text-replacement.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * applies the rules to a message and writes the result
+ */
+static int filter_message(
+        ApplyState *state,
+        const FilterOptions *options,
+        const char *str,
+        size_t len,
+        FILE *out,
+        FilterStats *stats)
+{
+    const char *result = str;
+    size_t outlen = len;
+    if(apply_rules(state, options->rules, options->nrules, &options->rules_options, str, len)) {
+        result = piece_table_text(&state->pieces);
+        outlen = state->pieces.len;
+        stats->changed++;
+    }
+    stats->messages++;
+    if(fwrite(result, 1, outlen, out) != outlen) {
+        return 1;
+    }
+    stats->bytes_out += outlen;
+    return 0;
+}
+
+/*
+ * prints an error and returns 1, if the message is longer than max_message
+ */
+static int message_too_long(const FilterStats *s, size_t len, size_t max_message) {
+    if(len <= max_message) {
+        return 0;
+    }
+    fprintf(stderr, "rtr-filter: message %zu is longer than %zu bytes\n", s->messages + 1, max_message);
+    return 1;
+}
+
+int filter_stream(int in, FILE *out, const FilterOptions *options, FilterStats *stats) {
+    FilterStats s;
+    memset(&s, 0, sizeof(FilterStats));
+    gint64 start = g_get_monotonic_time();
+    
+    char delim = options->delim;
+    size_t chunk_size = options->chunk_size > 0 ? options->chunk_size : FILTER_CHUNK_SIZE;
+    size_t max_message = options->max_message > 0 ? options->max_message : FILTER_MAX_MESSAGE;
+    // one more byte for terminating the last message
+    size_t alloc = chunk_size + 1;
+    char *buf = malloc(alloc);
+    size_t len = 0;
+    ApplyState state;
+    apply_state_init(&state);
+    
+    int err = 0;
+    int eof = 0;
+    while(!eof && !err) {
+        // the incomplete message would be kept in memory until the next
+        // delimiter
+        if(message_too_long(&s, len, max_message)) {
+            err = 1;
+            break;
+        }
+        if(alloc - len < chunk_size + 1) {
+            // the incomplete message is longer than a chunk
+            alloc = len + chunk_size + 1;
+            buf = realloc(buf, alloc);
+        }
+        ssize_t r = read(in, buf + len, chunk_size);
+        if(r < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "rtr-filter: read failed: %s\n", strerror(errno));
+            err = 1;
+            break;
+        }
+        if(r == 0) {
+            eof = 1;
+        }
+        s.bytes_in += r;
+        
+        // search delimiters only in the new data, the remaining bytes
+        // before it are an incomplete message
+        size_t msg_start = 0;
+        size_t pos = len;
+        len += r;
+        const char *d;
+        while(!err && (d = memchr(buf + pos, delim, len - pos)) != NULL) {
+            size_t end = d - buf;
+            if(message_too_long(&s, end - msg_start, max_message)) {
+                err = 1;
+                break;
+            }
+            // the message is terminated like in the plugin, the delimiter
+            // is written separately
+            buf[end] = '\0';
+            err = filter_message(&state, options, buf + msg_start, end - msg_start, out, &s);
+            if(!err) {
+                if(fputc(delim, out) == EOF) {
+                    err = 1;
+                } else {
+                    s.bytes_out++;
+                }
+            }
+            msg_start = pos = end + 1;
+        }
+        if(eof && !err && msg_start < len) {
+            // last message without delimiter
+            if(message_too_long(&s, len - msg_start, max_message)) {
+                err = 1;
+                break;
+            }
+            buf[len] = '\0';
+            err = filter_message(&state, options, buf + msg_start, len - msg_start, out, &s);
+            msg_start = len;
+        }
+        
+        memmove(buf, buf + msg_start, len - msg_start);
+        len -= msg_start;
+    }
+    if(fflush(out) || ferror(out)) {
+        fprintf(stderr, "rtr-filter: write failed: %s\n", strerror(errno));
+        err = 1;
+    }
+    
+    free(buf);
+    apply_state_free(&state);
+    s.usec = g_get_monotonic_time() - start;
+    if(stats) {
+        *stats = s;
+    }
+    return err;
+}
+
+void filter_stats_print(FILE *out, const FilterStats *stats) {
+    double sec = stats->usec / 1e6;
+    if(sec <= 0) {
+        sec = 1e-6;
+    }
+    fprintf(out, "messages: %zu (%zu changed)\n", stats->messages, stats->changed);
+    fprintf(out, "input: %zu bytes, output: %zu bytes\n", stats->bytes_in, stats->bytes_out);
+    fprintf(out, "time: %.3f s\n", sec);
+    fprintf(out, "throughput: %.2f MB/s, %.0f msgs/s\n",
+            stats->bytes_in / sec / 1e6,
+            stats->messages / sec);
+}
@@ -0,0 +1,102 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_FILTER_H
+#define RTR_FILTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "regex-text-replacement.h"
+
+/*
+ * default size of the chunks, that are read from the input
+ */
+#define FILTER_CHUNK_SIZE 65536
+
+/*
+ * default max length of a single message
+ */
+#define FILTER_MAX_MESSAGE (16 * 1024 * 1024)
+
+typedef struct FilterOptions {
+    /*
+     * rules, that are applied to every message
+     * rules_options contains the limits for apply_rules, the filter uses 0
+     * for all limits
+     */
+    TextReplacementRule *rules;
+    size_t nrules;
+    RulesFileOptions rules_options;
+    
+    /*
+     * message delimiter
+     */
+    char delim;
+    
+    /*
+     * size of the chunks, that are read from the input
+     * 0: FILTER_CHUNK_SIZE
+     */
+    size_t chunk_size;
+    
+    /*
+     * max length of a message without the delimiter
+     * 0: FILTER_MAX_MESSAGE
+     */
+    size_t max_message;
+} FilterOptions;
+
+typedef struct FilterStats {
+    size_t bytes_in;
+    size_t bytes_out;
+    size_t messages;
+    /*
+     * messages, that were changed by the rules
+     */
+    size_t changed;
+    /*
+     * time in microseconds
+     */
+    long long usec;
+} FilterStats;
+
+/*
+ * Reads messages from the file descriptor in, applies the rules of the
+ * options (apply_rules) to each message and writes the result to out
+ * 
+ * Messages are separated by delim, the delimiters are copied to the
+ * output. The input is read in chunks of chunk_size bytes. A message,
+ * that continues in the next chunk, is kept until it is complete,
+ * therefore the rules always see whole messages. The buffer only grows,
+ * if a single message is longer than chunk_size. A message longer than
+ * max_message fails the stream, the previous messages are already
+ * written.
+ * 
+ * stats: if not NULL, the counters are stored in this struct
+ * returns 0 on success, 1 on read or write errors or if a message is too
+ * long
+ */
+int filter_stream(int in, FILE *out, const FilterOptions *options, FilterStats *stats);
+
+/*
+ * writes the stats in human readable form
+ */
+void filter_stats_print(FILE *out, const FilterStats *stats);
+
+#endif /* RTR_FILTER_H */
@@ -0,0 +1,671 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "log-rewrite.h"
+#include "rules-snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+/*
+ * first line of the checkpoint file, followed by the rules hash
+ */
+#define LOG_REWRITE_CHECKPOINT_HEADER "rtr-checkpoint"
+
+/*
+ * progress output interval in microseconds
+ */
+#define LOG_REWRITE_PROGRESS_INTERVAL 500000
+
+/*
+ * start of a sent message in a html log
+ */
+#define LOG_HTML_SEND_PREFIX "<font color=\"#16569E\">"
+
+typedef struct LogFileList {
+    char **paths;
+    size_t n;
+    size_t alloc;
+} LogFileList;
+
+typedef struct LogRewrite LogRewrite;
+
+typedef struct LogWorker {
+    LogRewrite *job;
+    GThread *thread;
+    
+    /*
+     * remaining files of this worker: next - end-1
+     * other workers take files from the end of the range
+     */
+    GMutex lock;
+    size_t next;
+    size_t end;
+    
+    /*
+     * compiled rules of this worker, the compiled regex and DFA caches
+     * are not shared between threads
+     */
+    TextReplacementRule *rules;
+    size_t nrules;
+    RulesFileOptions rules_options;
+    
+    /*
+     * current line, same engine state as in apply_all_rules
+     */
+    ApplyState state;
+    
+    /*
+     * new content of the current file
+     */
+    char *out;
+    size_t outlen;
+    size_t out_alloc;
+} LogWorker;
+
+struct LogRewrite {
+    /*
+     * files, that are rewritten
+     */
+    LogFileList files;
+    
+    LogWorker *workers;
+    size_t nworkers;
+    
+    /*
+     * protects stats and checkpoint
+     */
+    GMutex lock;
+    LogRewriteStats stats;
+    FILE *checkpoint;
+};
+
+static void file_list_add(LogFileList *list, char *path) {
+    if(list->n == list->alloc) {
+        list->alloc = list->alloc ? list->alloc * 2 : 256;
+        list->paths = realloc(list->paths, list->alloc * sizeof(char*));
+    }
+    list->paths[list->n++] = path;
+}
+
+static void file_list_free(LogFileList *list) {
+    for(size_t i=0;i<list->n;i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    memset(list, 0, sizeof(LogFileList));
+}
+
+static int path_cmp(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int log_file_name(const char *name) {
+    size_t len = strlen(name);
+    static const char *ext[] = { ".txt", ".html", ".htm" };
+    for(int i=0;i<3;i++) {
+        size_t extlen = strlen(ext[i]);
+        if(len > extlen && !strcmp(name + len - extlen, ext[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * adds all log files in the directory and its subdirectories to the list
+ * symlinks are not followed
+ */
+static int log_files_collect(const char *dir, LogFileList *list) {
+    DIR *d = opendir(dir);
+    if(!d) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot open directory %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    int err = 0;
+    struct dirent *ent;
+    while((ent = readdir(d)) != NULL) {
+        if(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        size_t dirlen = strlen(dir);
+        size_t namelen = strlen(ent->d_name);
+        char *path = malloc(dirlen + namelen + 2);
+        memcpy(path, dir, dirlen);
+        path[dirlen] = '/';
+        memcpy(path + dirlen + 1, ent->d_name, namelen + 1);
+        
+        struct stat s;
+        if(lstat(path, &s)) {
+            free(path);
+            continue;
+        }
+        if(S_ISDIR(s.st_mode)) {
+            err |= log_files_collect(path, list);
+            free(path);
+        } else if(S_ISREG(s.st_mode) && log_file_name(ent->d_name) && !strchr(path, '\n')) {
+            file_list_add(list, path);
+        } else {
+            free(path);
+        }
+    }
+    closedir(d);
+    return err;
+}
+
+/*
+ * loads the completed files from the checkpoint and opens the checkpoint
+ * for appending
+ * 
+ * If the checkpoint was written for other rules, it is started again.
+ */
+static int checkpoint_open(LogRewrite *job, const char *path, uint64_t hash, LogFileList *done) {
+    int resume = 0;
+    FILE *in = fopen(path, "r");
+    if(in) {
+        char *line = NULL;
+        size_t alloc = 0;
+        ssize_t len;
+        uint64_t checkpoint_hash;
+        if(getline(&line, &alloc, in) > 0
+                && sscanf(line, LOG_REWRITE_CHECKPOINT_HEADER " %" SCNx64, &checkpoint_hash) == 1
+                && checkpoint_hash == hash)
+        {
+            resume = 1;
+            while((len = getline(&line, &alloc, in)) > 0) {
+                if(line[len-1] != '\n') {
+                    // incomplete line, written when the previous run
+                    // was interrupted
+                    break;
+                }
+                file_list_add(done, strndup(line, len-1));
+            }
+        } else {
+            fprintf(stderr, "rtr-rewrite-logs: checkpoint %s was written for other rules, starting over\n", path);
+        }
+        free(line);
+        fclose(in);
+    }
+    
+    job->checkpoint = fopen(path, resume ? "a" : "w");
+    if(!job->checkpoint) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot open checkpoint %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if(!resume) {
+        fprintf(job->checkpoint, "%s %016" PRIx64 "\n", LOG_REWRITE_CHECKPOINT_HEADER, hash);
+        fflush(job->checkpoint);
+    }
+    if(done->n > 0) {
+        qsort(done->paths, done->n, sizeof(char*), path_cmp);
+    }
+    return 0;
+}
+
+static char* log_out_reserve(LogWorker *w, size_t len) {
+    if(w->outlen + len > w->out_alloc) {
+        w->out_alloc = (w->outlen + len) * 2;
+        w->out = realloc(w->out, w->out_alloc);
+    }
+    char *p = w->out + w->outlen;
+    w->outlen += len;
+    return p;
+}
+
+static void log_out_append(LogWorker *w, const char *data, size_t len) {
+    if(len == 0) {
+        return;
+    }
+    memcpy(log_out_reserve(w, len), data, len);
+}
+
+/*
+ * appends the rewritten line (the pieces of the worker state)
+ */
+static void log_out_append_pieces(LogWorker *w) {
+    PieceTable *pieces = &w->state.pieces;
+    if(pieces->len == 0) {
+        return;
+    }
+    piece_table_copy(pieces, 0, pieces->len, log_out_reserve(w, pieces->len));
+}
+
+static int has_suffix(const char *str, size_t len, const char *suffix) {
+    size_t slen = strlen(suffix);
+    return len >= slen && !memcmp(str + len - slen, suffix, slen);
+}
+
+/*
+ * finds the message text of a line of a txt log
+ * 
+ * Messages are written as "(time) sender: message", the following lines
+ * without a timestamp belong to the same message. System messages like
+ * "(time) sender has signed off." have no ':' behind the sender.
+ * in_message: 1 if the previous line is part of a message, updated
+ * returns 1 if the line contains message text in start - end
+ */
+static int log_txt_message(const char *ln, size_t len, int *in_message, size_t *start, size_t *end) {
+    if(len == 0 || ln[0] != '(') {
+        *start = 0;
+        *end = len;
+        return *in_message;
+    }
+    *in_message = 0;
+    const char *time_end = memchr(ln, ')', len);
+    if(!time_end) {
+        return 0;
+    }
+    const char *sep = memmem(time_end, len - (time_end - ln), ": ", 2);
+    if(!sep) {
+        return 0;
+    }
+    *in_message = 1;
+    *start = sep - ln + 2;
+    *end = len;
+    return 1;
+}
+
+/*
+ * finds the message text of a line of a html log
+ * 
+ * Only sent messages are rewritten, like in the plugin. Pidgin writes
+ * them in one line:
+ * <font color="#16569E"><font size="2">(time)</font> <b>sender:</b></font> message<br/>
+ * returns 1 if the line contains message text in start - end
+ */
+static int log_html_message(const char *ln, size_t len, size_t *start, size_t *end) {
+    size_t prefix_len = sizeof(LOG_HTML_SEND_PREFIX) - 1;
+    if(len < prefix_len || memcmp(ln, LOG_HTML_SEND_PREFIX, prefix_len)) {
+        return 0;
+    }
+    static const char sender_end[] = ":</b></font> ";
+    const char *sep = memmem(ln, len, sender_end, sizeof(sender_end) - 1);
+    if(!sep) {
+        return 0;
+    }
+    *start = sep - ln + sizeof(sender_end) - 1;
+    *end = has_suffix(ln, len, "<br/>") ? len - 5 : len;
+    return *start <= *end;
+}
+
+/*
+ * applies the rules to the message text of a line and appends the line
+ * to the output, if the file is rewritten
+ * 
+ * In html logs, the rules are applied to each text between two tags, the
+ * markup is not changed. The output is started with the unchanged part
+ * of the file before the line, when the first line is changed.
+ */
+static void log_rewrite_line(
+        LogWorker *w,
+        const char *map,
+        size_t linepos,
+        size_t len,
+        int html,
+        int *in_message,
+        int *rewritten)
+{
+    const char *ln = map + linepos;
+    size_t start, end;
+    int message = html ?
+            log_html_message(ln, len, &start, &end) :
+            log_txt_message(ln, len, in_message, &start, &end);
+    
+    // ln - ln+copied is already in the output
+    size_t copied = 0;
+    size_t pos = start;
+    while(message && pos < end) {
+        size_t text_end = end;
+        if(html) {
+            if(ln[pos] == '<') {
+                const char *tag_end = memchr(ln + pos, '>', end - pos);
+                pos = tag_end ? (size_t)(tag_end - ln) + 1 : end;
+                continue;
+            }
+            const char *tag = memchr(ln + pos, '<', end - pos);
+            if(tag) {
+                text_end = tag - ln;
+            }
+        }
+        // same rule loop as apply_all_rules, the result is only valid
+        // until the next call
+        if(apply_rules(&w->state, w->rules, w->nrules, &w->rules_options, ln + pos, text_end - pos)) {
+            if(!*rewritten) {
+                log_out_append(w, map, linepos);
+                *rewritten = 1;
+            }
+            log_out_append(w, ln + copied, pos - copied);
+            log_out_append_pieces(w);
+            copied = text_end;
+        }
+        pos = text_end;
+    }
+    if(*rewritten) {
+        log_out_append(w, ln + copied, len - copied);
+    }
+}
+
+/*
+ * writes data to a temporary file and replaces the file at path with it
+ */
+static int log_write_atomic(const char *path, const char *data, size_t len, mode_t mode) {
+    size_t pathlen = strlen(path);
+    char *tmp = malloc(pathlen + sizeof(LOG_REWRITE_TMP_SUFFIX));
+    memcpy(tmp, path, pathlen);
+    memcpy(tmp + pathlen, LOG_REWRITE_TMP_SUFFIX, sizeof(LOG_REWRITE_TMP_SUFFIX));
+    
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, mode);
+    if(fd < 0) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot create %s: %s\n", tmp, strerror(errno));
+        free(tmp);
+        return 1;
+    }
+    // open applies the umask, the new file gets the mode of the old file
+    int err = fchmod(fd, mode);
+    size_t pos = 0;
+    while(!err && pos < len) {
+        ssize_t w = write(fd, data + pos, len - pos);
+        if(w < 0 && errno == EINTR) {
+            continue;
+        }
+        if(w <= 0) {
+            err = 1;
+            break;
+        }
+        pos += w;
+    }
+    // the data must be on disk, before the rename replaces the old file
+    if(!err && fsync(fd)) {
+        err = 1;
+    }
+    if(close(fd)) {
+        err = 1;
+    }
+    if(!err && rename(tmp, path)) {
+        err = 1;
+    }
+    if(err) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return err;
+}
+
+/*
+ * applies the rules to every line of the file and replaces the file, if
+ * any line was changed
+ */
+static int log_rewrite_file(
+        LogWorker *w,
+        const char *path,
+        int *changed,
+        size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    struct stat s;
+    if(fstat(fd, &s)) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot stat %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    *size = s.st_size;
+    if(s.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    
+    // the output is only built after the first changed line
+    w->outlen = 0;
+    int rewritten = 0;
+    int html = !has_suffix(path, strlen(path), ".txt");
+    int in_message = 0;
+    size_t pos = 0;
+    while(pos < *size) {
+        const char *ln = map + pos;
+        const char *nl = memchr(ln, '\n', *size - pos);
+        size_t lnlen = nl ? (size_t)(nl - ln) : *size - pos;
+        // the first line is the title of the conversation
+        if(pos > 0) {
+            log_rewrite_line(w, map, pos, lnlen, html, &in_message, &rewritten);
+        }
+        if(rewritten && nl) {
+            log_out_append(w, "\n", 1);
+        }
+        pos += lnlen + (nl ? 1 : 0);
+    }
+    munmap((void*)map, *size);
+    
+    if(!rewritten) {
+        return 0;
+    }
+    *changed = 1;
+    return log_write_atomic(path, w->out, w->outlen, s.st_mode & 07777);
+}
+
+/*
+ * returns the index of the next file of the worker
+ * 
+ * If the worker has no remaining files, it takes the second half of the
+ * remaining files of another worker.
+ * returns 0 if there are no remaining files
+ */
+static int log_worker_next(LogWorker *w, size_t *index) {
+    g_mutex_lock(&w->lock);
+    if(w->next < w->end) {
+        *index = w->next++;
+        g_mutex_unlock(&w->lock);
+        return 1;
+    }
+    g_mutex_unlock(&w->lock);
+    
+    LogRewrite *job = w->job;
+    size_t self = w - job->workers;
+    for(size_t k=1;k<job->nworkers;k++) {
+        LogWorker *victim = &job->workers[(self + k) % job->nworkers];
+        g_mutex_lock(&victim->lock);
+        size_t take = (victim->end - victim->next + 1) / 2;
+        size_t start = victim->end - take;
+        victim->end = start;
+        g_mutex_unlock(&victim->lock);
+        if(take > 0) {
+            g_mutex_lock(&w->lock);
+            w->next = start + 1;
+            w->end = start + take;
+            g_mutex_unlock(&w->lock);
+            *index = start;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static gpointer log_worker_thread(gpointer data) {
+    LogWorker *w = data;
+    LogRewrite *job = w->job;
+    size_t index;
+    while(log_worker_next(w, &index)) {
+        const char *path = job->files.paths[index];
+        int changed = 0;
+        size_t size = 0;
+        int err = log_rewrite_file(w, path, &changed, &size);
+        
+        g_mutex_lock(&job->lock);
+        if(err) {
+            job->stats.failed++;
+        } else {
+            job->stats.processed++;
+            job->stats.changed += changed;
+            job->stats.bytes += size;
+            if(job->checkpoint) {
+                fprintf(job->checkpoint, "%s\n", path);
+                fflush(job->checkpoint);
+            }
+        }
+        g_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+static void log_worker_free(LogWorker *w) {
+    free_rules(w->rules, w->nrules);
+    apply_state_free(&w->state);
+    free(w->out);
+}
+
+static void log_rewrite_progress(LogRewrite *job, size_t total, int final) {
+    g_mutex_lock(&job->lock);
+    LogRewriteStats s = job->stats;
+    g_mutex_unlock(&job->lock);
+    fprintf(stderr, "\rrewriting logs: %zu/%zu files, %zu changed, %zu failed%s",
+            s.processed + s.failed,
+            total,
+            s.changed,
+            s.failed,
+            final ? "\n" : "");
+}
+
+int log_rewrite(const LogRewriteOptions *options, LogRewriteStats *stats) {
+    LogRewrite job;
+    memset(&job, 0, sizeof(LogRewrite));
+    g_mutex_init(&job.lock);
+    int err = 0;
+    
+    job.nworkers = options->nthreads > 0 ? options->nthreads : g_get_num_processors();
+    job.workers = calloc(job.nworkers, sizeof(LogWorker));
+    for(size_t i=0;i<job.nworkers && !err;i++) {
+        LogWorker *w = &job.workers[i];
+        w->job = &job;
+        g_mutex_init(&w->lock);
+        apply_state_init(&w->state);
+        err = load_rules(options->rules_file, &w->rules, &w->nrules, &w->rules_options);
+        // the limits are meant for interactive sending, a skipped rule
+        // would leave a half-rewritten line in the file
+        w->rules_options.time_limit = 0;
+        w->rules_options.step_limit = 0;
+        w->rules_options.message_limit = 0;
+    }
+    if(!err) {
+        // skipping an invalid rule would change the result of the
+        // following rules
+        LogWorker *w = &job.workers[0];
+        for(size_t i=0;i<w->nrules;i++) {
+            TextReplacementRule *rule = &w->rules[i];
+            if(strlen(rule->pattern) > 0 && !rule->regex && !(rule->flags & RULE_FLAG_DISABLED)) {
+                fprintf(stderr, "rtr-rewrite-logs: invalid pattern %s\n", rule->pattern);
+                err = 1;
+            }
+        }
+    }
+    
+    LogFileList all;
+    LogFileList done;
+    memset(&all, 0, sizeof(LogFileList));
+    memset(&done, 0, sizeof(LogFileList));
+    if(!err) {
+        err = log_files_collect(options->root, &all);
+    }
+    if(!err && options->checkpoint) {
+        uint64_t hash = rules_snapshot_hash(job.workers[0].rules, job.workers[0].nrules);
+        err = checkpoint_open(&job, options->checkpoint, hash, &done);
+    }
+    
+    if(!err) {
+        // sorted paths: the work is distributed by directory
+        if(all.n > 0) {
+            qsort(all.paths, all.n, sizeof(char*), path_cmp);
+        }
+        job.stats.files = all.n;
+        for(size_t i=0;i<all.n;i++) {
+            if(done.n > 0 && bsearch(&all.paths[i], done.paths, done.n, sizeof(char*), path_cmp)) {
+                job.stats.skipped++;
+                continue;
+            }
+            file_list_add(&job.files, all.paths[i]);
+            all.paths[i] = NULL;
+        }
+        
+        size_t n = job.files.n;
+        for(size_t i=0;i<job.nworkers;i++) {
+            LogWorker *w = &job.workers[i];
+            w->next = i * n / job.nworkers;
+            w->end = (i + 1) * n / job.nworkers;
+        }
+        for(size_t i=0;i<job.nworkers;i++) {
+            job.workers[i].thread = g_thread_new("rtr-rewrite", log_worker_thread, &job.workers[i]);
+        }
+        
+        if(options->progress) {
+            for(;;) {
+                g_mutex_lock(&job.lock);
+                size_t completed = job.stats.processed + job.stats.failed;
+                g_mutex_unlock(&job.lock);
+                if(completed >= n) {
+                    break;
+                }
+                log_rewrite_progress(&job, n, 0);
+                g_usleep(LOG_REWRITE_PROGRESS_INTERVAL);
+            }
+        }
+        for(size_t i=0;i<job.nworkers;i++) {
+            g_thread_join(job.workers[i].thread);
+        }
+        if(options->progress) {
+            log_rewrite_progress(&job, n, 1);
+        }
+        err = job.stats.failed > 0;
+    }
+    
+    if(job.checkpoint) {
+        fclose(job.checkpoint);
+    }
+    for(size_t i=0;i<job.nworkers;i++) {
+        log_worker_free(&job.workers[i]);
+        g_mutex_clear(&job.workers[i].lock);
+    }
+    free(job.workers);
+    g_mutex_clear(&job.lock);
+    file_list_free(&job.files);
+    file_list_free(&all);
+    file_list_free(&done);
+    if(stats) {
+        *stats = job.stats;
+    }
+    return err;
+}
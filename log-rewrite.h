@@ -0,0 +1,110 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_LOG_REWRITE_H
+#define RTR_LOG_REWRITE_H
+
+#include "regex-text-replacement.h"
+
+/*
+ * default checkpoint file name in the logs directory
+ */
+#define LOG_REWRITE_CHECKPOINT ".rtr-rewrite-checkpoint"
+
+/*
+ * suffix of the temporary file, that replaces a log file
+ */
+#define LOG_REWRITE_TMP_SUFFIX ".rtr-tmp"
+
+typedef struct LogRewriteOptions {
+    /*
+     * rules file, every worker loads its own copy of the rules
+     */
+    const char *rules_file;
+    
+    /*
+     * logs directory, all .txt and .html files in this directory and
+     * its subdirectories are rewritten
+     */
+    const char *root;
+    
+    /*
+     * checkpoint file or NULL
+     */
+    const char *checkpoint;
+    
+    /*
+     * number of worker threads, 0: number of processors
+     */
+    size_t nthreads;
+    
+    /*
+     * print the progress to stderr
+     */
+    int progress;
+} LogRewriteOptions;
+
+typedef struct LogRewriteStats {
+    /*
+     * number of log files in the directory
+     */
+    size_t files;
+    
+    /*
+     * files, that were already completed according to the checkpoint
+     */
+    size_t skipped;
+    
+    size_t processed;
+    size_t changed;
+    size_t failed;
+    
+    /*
+     * size of the processed files
+     */
+    size_t bytes;
+} LogRewriteStats;
+
+/*
+ * Applies the rules to all log files in the directory
+ * 
+ * The rules are applied to the message text of each line with
+ * apply_rules, every worker has its own ApplyState. The first line (title)
+ * of a file is not changed. In .txt logs the text after "(time) name: "
+ * and continuation lines are rewritten, lines without a sender (system
+ * messages) are not changed. In .html logs only sent messages are
+ * rewritten, the rules are applied to each text between tags and the
+ * markup is not changed, therefore ^ matches at the start of every text
+ * between tags.
+ * 
+ * The time_limit, step_limit and message_limit of the rules file are not
+ * used, every rule is applied to every message. The files are
+ * distributed to a pool of worker threads, workers without remaining
+ * files take half of the remaining files of another worker. Changed files are written to a temporary file, which
+ * then replaces the original file.
+ * 
+ * The checkpoint file contains the hash of the rules and the path of
+ * every completed file. Files in the checkpoint are skipped, unless the
+ * checkpoint was written for other rules.
+ * 
+ * returns 0 on success, 1 if the rules, the directory or the checkpoint
+ * couldn't be loaded or any file couldn't be rewritten
+ */
+int log_rewrite(const LogRewriteOptions *options, LogRewriteStats *stats);
+
+#endif /* RTR_LOG_REWRITE_H */
@@ -0,0 +1,260 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "piece-table.h"
+
+#include <string.h>
+
+void piece_table_init(PieceTable *pt) {
+    memset(pt, 0, sizeof(PieceTable));
+}
+
+void piece_table_free(PieceTable *pt) {
+    free(pt->pieces);
+    free(pt->offsets);
+    free(pt->tmp);
+    free(pt->text);
+    memset(pt, 0, sizeof(PieceTable));
+}
+
+static void piece_table_reserve(PieceTable *pt, size_t n) {
+    if(n <= pt->alloc) {
+        return;
+    }
+    size_t alloc = pt->alloc ? pt->alloc : 16;
+    while(alloc < n) {
+        alloc *= 2;
+    }
+    pt->pieces = realloc(pt->pieces, alloc * sizeof(Piece));
+    pt->offsets = realloc(pt->offsets, alloc * sizeof(size_t));
+    pt->tmp = realloc(pt->tmp, alloc * sizeof(Piece));
+    pt->alloc = alloc;
+    pt->heap_allocs += 3;
+}
+
+void piece_table_reset(PieceTable *pt, const char *str, size_t len) {
+    piece_table_reserve(pt, 1);
+    pt->npieces = 0;
+    if(len > 0) {
+        pt->pieces[0].data = str;
+        pt->pieces[0].len = len;
+        pt->offsets[0] = 0;
+        pt->npieces = 1;
+    }
+    pt->len = len;
+    pt->text_valid = 0;
+}
+
+const char* piece_table_text(PieceTable *pt) {
+    if(pt->npieces == 0) {
+        return "";
+    }
+    if(pt->npieces == 1) {
+        return pt->pieces[0].data;
+    }
+    if(!pt->text_valid) {
+        if(pt->len >= pt->text_alloc) {
+            pt->text_alloc = pt->len + 1;
+            pt->text = realloc(pt->text, pt->text_alloc);
+            pt->heap_allocs++;
+        }
+        piece_table_copy(pt, 0, pt->len, pt->text);
+        pt->text[pt->len] = 0;
+        pt->text_valid = 1;
+    }
+    return pt->text;
+}
+
+/*
+ * returns the index of the piece, that contains the position pos
+ * or npieces, if pos is the end of the text
+ */
+static size_t piece_at(PieceTable *pt, size_t pos) {
+    if(pos >= pt->len) {
+        return pt->npieces;
+    }
+    size_t lo = 0;
+    size_t hi = pt->npieces;
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(pt->offsets[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void piece_table_copy(PieceTable *pt, size_t start, size_t end, char *out) {
+    size_t k = piece_at(pt, start);
+    while(start < end && k < pt->npieces) {
+        const Piece *p = &pt->pieces[k];
+        size_t off = start - pt->offsets[k];
+        size_t n = p->len - off;
+        if(n > end - start) {
+            n = end - start;
+        }
+        memcpy(out, p->data + off, n);
+        out += n;
+        start += n;
+        k++;
+    }
+}
+
+/*
+ * compares str with the text at the position off of the piece k
+ * the text must contain at least len bytes after this position
+ */
+static int piece_table_equals(
+        PieceTable *pt,
+        size_t k,
+        size_t off,
+        const char *str,
+        size_t len)
+{
+    while(len > 0) {
+        const Piece *p = &pt->pieces[k];
+        size_t n = p->len - off;
+        if(n > len) {
+            n = len;
+        }
+        if(memcmp(p->data + off, str, n)) {
+            return 0;
+        }
+        str += n;
+        len -= n;
+        off = 0;
+        k++;
+    }
+    return 1;
+}
+
+int piece_table_find(
+        PieceTable *pt,
+        const char *str,
+        size_t len,
+        size_t from,
+        size_t *pos)
+{
+    if(len == 0) {
+        *pos = from;
+        return from <= pt->len;
+    }
+    if(from >= pt->len || len > pt->len - from) {
+        return 0;
+    }
+    
+    for(size_t k=piece_at(pt, from);k<pt->npieces;k++) {
+        const Piece *p = &pt->pieces[k];
+        size_t start = pt->offsets[k];
+        size_t off = from > start ? from - start : 0;
+        
+        // matches inside of the piece
+        if(p->len - off >= len) {
+            const char *m = len == 1 ?
+                    memchr(p->data + off, str[0], p->len - off) :
+                    memmem(p->data + off, p->len - off, str, len);
+            if(m) {
+                *pos = start + (m - p->data);
+                return 1;
+            }
+            off = p->len - len + 1;
+        }
+        
+        // matches, that start in this piece and continue in the next pieces
+        for(size_t i=off;i<p->len;i++) {
+            if(start + i + len > pt->len) {
+                return 0;
+            }
+            if(p->data[i] == str[0] && piece_table_equals(pt, k, i, str, len)) {
+                *pos = start + i;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * appends a slice to the tmp list and merges it with the previous slice,
+ * if both are contiguous in memory
+ */
+static void tmp_append(PieceTable *pt, size_t *n, const char *data, size_t len) {
+    if(len == 0) {
+        return;
+    }
+    if(*n > 0) {
+        Piece *prev = &pt->tmp[*n - 1];
+        if(prev->data + prev->len == data) {
+            prev->len += len;
+            return;
+        }
+    }
+    pt->tmp[*n].data = data;
+    pt->tmp[*n].len = len;
+    (*n)++;
+}
+
+/*
+ * appends the range start - end of the current text to the tmp list
+ */
+static void tmp_append_range(PieceTable *pt, size_t *n, size_t start, size_t end) {
+    size_t k = piece_at(pt, start);
+    while(start < end && k < pt->npieces) {
+        const Piece *p = &pt->pieces[k];
+        size_t off = start - pt->offsets[k];
+        size_t len = p->len - off;
+        if(len > end - start) {
+            len = end - start;
+        }
+        tmp_append(pt, n, p->data + off, len);
+        start += len;
+        k++;
+    }
+}
+
+void piece_table_splice(PieceTable *pt, const PieceEdit *edits, size_t nedits) {
+    // every edit can split one piece and add one replacement piece
+    piece_table_reserve(pt, pt->npieces + 2 * nedits + 1);
+    
+    size_t n = 0;
+    size_t pos = 0;
+    for(size_t i=0;i<nedits;i++) {
+        const PieceEdit *e = &edits[i];
+        tmp_append_range(pt, &n, pos, e->start);
+        tmp_append(pt, &n, e->data, e->len);
+        pos = e->end;
+    }
+    tmp_append_range(pt, &n, pos, pt->len);
+    
+    Piece *pieces = pt->pieces;
+    pt->pieces = pt->tmp;
+    pt->tmp = pieces;
+    pt->npieces = n;
+    
+    size_t len = 0;
+    for(size_t k=0;k<n;k++) {
+        pt->offsets[k] = len;
+        len += pt->pieces[k].len;
+    }
+    pt->len = len;
+    pt->text_valid = 0;
+}
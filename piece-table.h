@@ -0,0 +1,127 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_PIECE_TABLE_H
+#define RTR_PIECE_TABLE_H
+
+#include <stdlib.h>
+
+/*
+ * slice of a string, that is part of the text
+ */
+typedef struct Piece {
+    const char *data;
+    size_t len;
+} Piece;
+
+/*
+ * replacement of the range start - end of the text
+ */
+typedef struct PieceEdit {
+    size_t start;
+    size_t end;
+    const char *data;
+    size_t len;
+} PieceEdit;
+
+/*
+ * Text, that is composed of slices of other strings
+ * 
+ * Replacing parts of the text only changes the piece list, the unchanged
+ * parts of the text are not copied. The pieces don't own the memory they
+ * point to.
+ * 
+ * All arrays are kept across piece_table_reset calls.
+ */
+typedef struct PieceTable {
+    Piece *pieces;
+    size_t npieces;
+    size_t alloc;
+    
+    /*
+     * logical start position of each piece
+     */
+    size_t *offsets;
+    
+    /*
+     * buffer for building the new piece list in piece_table_splice
+     * pieces, offsets and tmp have the same capacity alloc
+     */
+    Piece *tmp;
+    
+    /*
+     * logical length of the text
+     */
+    size_t len;
+    
+    /*
+     * contiguous copy of the text, only valid if text_valid is set
+     */
+    char *text;
+    size_t text_alloc;
+    int text_valid;
+    
+    /*
+     * statistics: number of heap allocations
+     */
+    unsigned long heap_allocs;
+} PieceTable;
+
+void piece_table_init(PieceTable *pt);
+
+void piece_table_free(PieceTable *pt);
+
+/*
+ * sets the text to a single piece
+ */
+void piece_table_reset(PieceTable *pt, const char *str, size_t len);
+
+/*
+ * returns the text as contiguous string
+ * 
+ * If the text consists of more than one piece, it is copied to an internal
+ * buffer, that is valid until the next splice or reset. The returned string
+ * is not always terminated.
+ */
+const char* piece_table_text(PieceTable *pt);
+
+/*
+ * copies the range start - end of the text to out
+ */
+void piece_table_copy(PieceTable *pt, size_t start, size_t end, char *out);
+
+/*
+ * searches str in the text, starting at the position from
+ * returns 1 if str was found and stores the position in pos
+ */
+int piece_table_find(
+        PieceTable *pt,
+        const char *str,
+        size_t len,
+        size_t from,
+        size_t *pos);
+
+/*
+ * Replaces ranges of the text
+ * 
+ * The edits must be sorted by position and must not overlap. The
+ * replacement data must stay valid as long as it is part of the text.
+ */
+void piece_table_splice(PieceTable *pt, const PieceEdit *edits, size_t nedits);
+
+#endif /* RTR_PIECE_TABLE_H */
@@ -0,0 +1,536 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "regex-engine.h"
+#include "dfa.h"
+#include "dictionary.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef RTR_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+typedef struct Pcre2Regex {
+    pcre2_code *code;
+    /*
+     * match data block, reused for every match of this pattern
+     */
+    pcre2_match_data *match_data;
+} Pcre2Regex;
+#endif
+
+/* ------------------------- POSIX ------------------------- */
+
+static int posix_compile(CompiledRegex *re, const char *pattern) {
+    regex_t *regex = malloc(sizeof(regex_t));
+    int cflags = REG_EXTENDED;
+    if(re->flags & REGEX_ICASE) {
+        cflags |= REG_ICASE;
+    }
+    if(regcomp(regex, pattern, cflags) != 0) {
+        free(regex);
+        return 1;
+    }
+    re->data = regex;
+    re->nsub = regex->re_nsub;
+    return 0;
+}
+
+static int posix_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    return regexec(re->data, str, nmatch, pmatch, eflags & (REG_NOTBOL|REG_STARTEND));
+}
+
+static void posix_free(CompiledRegex *re) {
+    regfree(re->data);
+    free(re->data);
+}
+
+/* ------------------------- DFA ------------------------- */
+
+static int dfa_engine_compile(CompiledRegex *re, const char *pattern) {
+    int flags = re->flags & REGEX_ICASE ? DFA_ICASE : 0;
+    re->data = dfa_compile_flags(pattern, flags, &re->nsub);
+    return re->data ? 0 : 1;
+}
+
+static int dfa_engine_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    if(!(eflags & REG_STARTEND)) {
+        return dfa_exec(re->data, str, strlen(str), nmatch, pmatch, eflags & REG_NOTBOL);
+    }
+    
+    // search the range pmatch[0] and return offsets relative to str
+    regoff_t so = pmatch[0].rm_so;
+    regoff_t eo = pmatch[0].rm_eo;
+    int notbol = so > 0 ? REG_NOTBOL : eflags & REG_NOTBOL;
+    int ret = dfa_exec(re->data, str + so, eo - so, nmatch, pmatch, notbol);
+    if(ret == 0) {
+        for(size_t i=0;i<nmatch;i++) {
+            if(pmatch[i].rm_so >= 0) {
+                pmatch[i].rm_so += so;
+                pmatch[i].rm_eo += so;
+            }
+        }
+    }
+    return ret;
+}
+
+CompiledRegex* regex_dfa_load(
+        const NfaProgram *fwd,
+        const NfaProgram *rev,
+        size_t nsub,
+        int flags)
+{
+    DfaRegex *dfa = dfa_load(fwd, rev, nsub);
+    if(!dfa) {
+        return NULL;
+    }
+    CompiledRegex *re = calloc(1, sizeof(CompiledRegex));
+    re->type = REGEX_ENGINE_DFA;
+    re->flags = flags;
+    re->nsub = nsub;
+    re->data = dfa;
+    return re;
+}
+
+/* ------------------------- literal ------------------------- */
+
+typedef struct LiteralRegex {
+    /*
+     * folded to lower case, if the regex is case-insensitive
+     */
+    char *str;
+    size_t len;
+} LiteralRegex;
+
+static char ascii_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+void regex_literal_fold(char *str, size_t len) {
+    for(size_t i=0;i<len;i++) {
+        str[i] = ascii_lower(str[i]);
+    }
+}
+
+const char* regex_literal_find(
+        const char *str,
+        size_t len,
+        const char *literal,
+        size_t literal_len,
+        int icase)
+{
+    if(!icase) {
+        return literal_len == 1 ?
+                memchr(str, literal[0], len) :
+                memmem(str, len, literal, literal_len);
+    }
+    if(literal_len > len) {
+        return NULL;
+    }
+    // only the message needs to be folded, the literal is already folded
+    for(size_t i=0;i<=len-literal_len;i++) {
+        size_t j = 0;
+        while(j < literal_len && ascii_lower(str[i+j]) == literal[j]) {
+            j++;
+        }
+        if(j == literal_len) {
+            return str + i;
+        }
+    }
+    return NULL;
+}
+
+static int literal_compile(CompiledRegex *re, const char *pattern) {
+    LiteralRegex *lit = malloc(sizeof(LiteralRegex));
+    lit->str = strdup(pattern);
+    lit->len = strlen(pattern);
+    if(re->flags & REGEX_ICASE) {
+        regex_literal_fold(lit->str, lit->len);
+    }
+    re->data = lit;
+    re->nsub = 0;
+    return 0;
+}
+
+static int literal_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    LiteralRegex *lit = re->data;
+    regoff_t so = 0;
+    regoff_t eo;
+    if(eflags & REG_STARTEND) {
+        so = pmatch[0].rm_so;
+        eo = pmatch[0].rm_eo;
+    } else {
+        eo = strlen(str);
+    }
+    const char *m = regex_literal_find(str + so, eo - so, lit->str, lit->len, re->flags & REGEX_ICASE);
+    if(!m) {
+        return REG_NOMATCH;
+    }
+    if(nmatch > 0) {
+        pmatch[0].rm_so = m - str;
+        pmatch[0].rm_eo = m - str + lit->len;
+    }
+    for(size_t i=1;i<nmatch;i++) {
+        pmatch[i].rm_so = -1;
+        pmatch[i].rm_eo = -1;
+    }
+    return 0;
+}
+
+static void literal_free(CompiledRegex *re) {
+    LiteralRegex *lit = re->data;
+    free(lit->str);
+    free(lit);
+}
+
+/* ------------------------- dictionary ------------------------- */
+
+static int dictionary_compile(CompiledRegex *re, const char *pattern) {
+    Dictionary *dict = dictionary_load(pattern, re->flags & REGEX_ICASE);
+    if(!dict) {
+        return 1;
+    }
+    re->data = dict;
+    re->nsub = 0;
+    return 0;
+}
+
+static int dictionary_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    size_t so = 0;
+    size_t eo;
+    if(eflags & REG_STARTEND) {
+        so = pmatch[0].rm_so;
+        eo = pmatch[0].rm_eo;
+    } else {
+        eo = strlen(str);
+    }
+    size_t ms, me;
+    if(!dictionary_find(re->data, str, so, eo, &ms, &me)) {
+        return REG_NOMATCH;
+    }
+    if(nmatch > 0) {
+        pmatch[0].rm_so = ms;
+        pmatch[0].rm_eo = me;
+    }
+    for(size_t i=1;i<nmatch;i++) {
+        pmatch[i].rm_so = -1;
+        pmatch[i].rm_eo = -1;
+    }
+    return 0;
+}
+
+const char* regex_dictionary_replacement(
+        CompiledRegex *re,
+        const char *word,
+        size_t len,
+        size_t *replacement_len)
+{
+    Dictionary *dict = re->data;
+    const DictionaryEntry *entry = dictionary_lookup(dict, word, len);
+    if(!entry) {
+        return NULL;
+    }
+    *replacement_len = entry->replacement_len;
+    return dict->data + entry->replacement;
+}
+
+/* ------------------------- PCRE2 ------------------------- */
+
+#ifdef RTR_PCRE2
+static int pcre2_engine_compile(CompiledRegex *re, const char *pattern) {
+    int errcode;
+    PCRE2_SIZE erroffset;
+    pcre2_code *code = pcre2_compile(
+            (PCRE2_SPTR)pattern,
+            PCRE2_ZERO_TERMINATED,
+            re->flags & REGEX_ICASE ? PCRE2_CASELESS : 0,
+            &errcode,
+            &erroffset,
+            NULL);
+    if(!code) {
+        PCRE2_UCHAR errmsg[256];
+        pcre2_get_error_message(errcode, errmsg, sizeof(errmsg));
+        fprintf(stderr, "pcre2: %s at offset %d\n", (char*)errmsg, (int)erroffset);
+        return 1;
+    }
+    
+    // if JIT is not supported on this platform, pcre2_match falls back
+    // to the interpreter
+    pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+    
+    uint32_t capture_count = 0;
+    pcre2_pattern_info(code, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+    
+    Pcre2Regex *regex = malloc(sizeof(Pcre2Regex));
+    regex->code = code;
+    regex->match_data = pcre2_match_data_create_from_pattern(code, NULL);
+    re->data = regex;
+    re->nsub = capture_count;
+    return 0;
+}
+
+static int pcre2_engine_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    Pcre2Regex *regex = re->data;
+    PCRE2_SIZE length = PCRE2_ZERO_TERMINATED;
+    PCRE2_SIZE start = 0;
+    if(eflags & REG_STARTEND) {
+        length = pmatch[0].rm_eo;
+        start = pmatch[0].rm_so;
+    }
+    int rc = pcre2_match(
+            regex->code,
+            (PCRE2_SPTR)str,
+            length,
+            start,
+            eflags & REG_NOTBOL ? PCRE2_NOTBOL : 0,
+            regex->match_data,
+            NULL);
+    if(rc == PCRE2_ERROR_MATCHLIMIT || rc == PCRE2_ERROR_DEPTHLIMIT
+            || rc == PCRE2_ERROR_HEAPLIMIT || rc == PCRE2_ERROR_JIT_STACKLIMIT)
+    {
+        // runaway backtracking, not a result
+        return REGEX_ELIMIT;
+    }
+    if(rc < 0) {
+        return REG_NOMATCH;
+    }
+    
+    PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(regex->match_data);
+    for(size_t i=0;i<nmatch;i++) {
+        if(i < rc && ovector[2*i] != PCRE2_UNSET) {
+            pmatch[i].rm_so = ovector[2*i];
+            pmatch[i].rm_eo = ovector[2*i+1];
+        } else {
+            pmatch[i].rm_so = -1;
+            pmatch[i].rm_eo = -1;
+        }
+    }
+    return 0;
+}
+
+static void pcre2_engine_free(CompiledRegex *re) {
+    Pcre2Regex *regex = re->data;
+    pcre2_match_data_free(regex->match_data);
+    pcre2_code_free(regex->code);
+    free(regex);
+}
+#endif
+
+/* ------------------------- engine API ------------------------- */
+
+CompiledRegex* regex_compile(RegexEngineType type, const char *pattern) {
+    return regex_compile_flags(type, pattern, 0);
+}
+
+CompiledRegex* regex_compile_flags(RegexEngineType type, const char *pattern, int flags) {
+    CompiledRegex *re = calloc(1, sizeof(CompiledRegex));
+    re->type = type;
+    re->flags = flags;
+    int err = 1;
+    switch(type) {
+        case REGEX_ENGINE_POSIX: err = posix_compile(re, pattern); break;
+        case REGEX_ENGINE_DFA: err = dfa_engine_compile(re, pattern); break;
+        case REGEX_ENGINE_LITERAL: err = literal_compile(re, pattern); break;
+        case REGEX_ENGINE_DICTIONARY: err = dictionary_compile(re, pattern); break;
+#ifdef RTR_PCRE2
+        case REGEX_ENGINE_PCRE2: err = pcre2_engine_compile(re, pattern); break;
+#endif
+        default: {
+            fprintf(stderr, "regex engine %s not available\n", regex_engine_name(type));
+            break;
+        }
+    }
+    if(err) {
+        free(re);
+        return NULL;
+    }
+    return re;
+}
+
+static int engine_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    switch(re->type) {
+        case REGEX_ENGINE_POSIX: return posix_exec(re, str, nmatch, pmatch, eflags);
+        case REGEX_ENGINE_DFA: return dfa_engine_exec(re, str, nmatch, pmatch, eflags);
+        case REGEX_ENGINE_LITERAL: return literal_exec(re, str, nmatch, pmatch, eflags);
+        case REGEX_ENGINE_DICTIONARY: return dictionary_exec(re, str, nmatch, pmatch, eflags);
+#ifdef RTR_PCRE2
+        case REGEX_ENGINE_PCRE2: return pcre2_engine_exec(re, str, nmatch, pmatch, eflags);
+#endif
+        default: break;
+    }
+    return REG_NOMATCH;
+}
+
+/*
+ * bytes of multi-byte UTF-8 sequences are word characters
+ */
+static int word_char(char c) {
+    unsigned char b = c;
+    return b >= 0x80 || b == '_' || (b >= '0' && b <= '9') || (ascii_lower(b) >= 'a' && ascii_lower(b) <= 'z');
+}
+
+/*
+ * searches the first match, that is neither preceded nor followed by a
+ * word character
+ */
+static int word_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    regoff_t so = 0;
+    regoff_t eo;
+    if(eflags & REG_STARTEND) {
+        so = pmatch[0].rm_so;
+        eo = pmatch[0].rm_eo;
+    } else {
+        eo = strlen(str);
+    }
+    regmatch_t m[nmatch > 0 ? nmatch : 1];
+    while(so <= eo) {
+        m[0].rm_so = so;
+        m[0].rm_eo = eo;
+        int ret = engine_exec(re, str, nmatch > 0 ? nmatch : 1, m, eflags | REG_STARTEND);
+        if(ret) {
+            return ret;
+        }
+        // the text before the range is the context of the search, the
+        // text behind the range is unknown
+        regoff_t ms = m[0].rm_so;
+        regoff_t me = m[0].rm_eo;
+        if((ms == 0 || !word_char(str[ms-1])) && (me >= eo || !word_char(str[me]))) {
+            if(nmatch > 0) {
+                memcpy(pmatch, m, nmatch * sizeof(regmatch_t));
+            }
+            return 0;
+        }
+        // continue the search behind the start of the rejected match
+        so = ms + 1;
+    }
+    return REG_NOMATCH;
+}
+
+int regex_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags)
+{
+    if(re->flags & REGEX_WORD) {
+        return word_exec(re, str, nmatch, pmatch, eflags);
+    }
+    return engine_exec(re, str, nmatch, pmatch, eflags);
+}
+
+void regex_free(CompiledRegex *re) {
+    if(!re) {
+        return;
+    }
+    switch(re->type) {
+        case REGEX_ENGINE_POSIX: posix_free(re); break;
+        case REGEX_ENGINE_DFA: dfa_free(re->data); break;
+        case REGEX_ENGINE_LITERAL: literal_free(re); break;
+        case REGEX_ENGINE_DICTIONARY: dictionary_free(re->data); break;
+#ifdef RTR_PCRE2
+        case REGEX_ENGINE_PCRE2: pcre2_engine_free(re); break;
+#endif
+        default: break;
+    }
+    free(re);
+}
+
+const char* regex_engine_name(RegexEngineType type) {
+    switch(type) {
+        case REGEX_ENGINE_POSIX: return "posix";
+        case REGEX_ENGINE_PCRE2: return "pcre2";
+        case REGEX_ENGINE_DFA: return "dfa";
+        case REGEX_ENGINE_LITERAL: return "literal";
+        case REGEX_ENGINE_DICTIONARY: return "dictionary";
+    }
+    return "unknown";
+}
+
+int regex_engine_from_name(const char *name, RegexEngineType *type) {
+    if(!strcmp(name, "posix")) {
+        *type = REGEX_ENGINE_POSIX;
+    } else if(!strcmp(name, "pcre2")) {
+        *type = REGEX_ENGINE_PCRE2;
+    } else if(!strcmp(name, "dfa")) {
+        *type = REGEX_ENGINE_DFA;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+int regex_engine_available(RegexEngineType type) {
+    switch(type) {
+        case REGEX_ENGINE_POSIX: return 1;
+        case REGEX_ENGINE_DFA: return 1;
+        case REGEX_ENGINE_LITERAL: return 1;
+        case REGEX_ENGINE_DICTIONARY: return 1;
+#ifdef RTR_PCRE2
+        case REGEX_ENGINE_PCRE2: return 1;
+#endif
+        default: break;
+    }
+    return 0;
+}
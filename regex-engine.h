@@ -0,0 +1,193 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_REGEX_ENGINE_H
+#define RTR_REGEX_ENGINE_H
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <regex.h>
+
+#include "dfa.h"
+
+typedef enum RegexEngineType {
+    /*
+     * POSIX extended regex (regcomp/regexec), default engine
+     */
+    REGEX_ENGINE_POSIX = 0,
+    /*
+     * PCRE2 with JIT compilation
+     * only available if compiled with RTR_PCRE2
+     */
+    REGEX_ENGINE_PCRE2,
+    /*
+     * built-in lazy DFA (dfa.h), linear time matching
+     * supports a subset of POSIX extended regex
+     */
+    REGEX_ENGINE_DFA,
+    /*
+     * plain string without regex syntax, searched with memmem
+     * only used for rules with the literal flag, not for the engine
+     * header option
+     */
+    REGEX_ENGINE_LITERAL,
+    /*
+     * word table (dictionary.h), the pattern is the path of the
+     * dictionary file
+     * only used for rules with the dictionary flag
+     */
+    REGEX_ENGINE_DICTIONARY
+} RegexEngineType;
+
+/*
+ * regex_compile_flags: case-insensitive matching
+ * The literal and the dfa engine only fold ASCII letters.
+ */
+#define REGEX_ICASE 1
+
+/*
+ * regex_compile_flags: only matches, that are not preceded or followed by
+ * a word character (letter, digit, _ or non-ASCII character)
+ * 
+ * Other matches are skipped and the search continues at the next byte
+ * behind the start of the skipped match.
+ */
+#define REGEX_WORD 2
+
+/*
+ * regex_exec result: the engine stopped the search, because it reached an
+ * internal limit (PCRE2 match, depth or JIT stack limit)
+ * The result is unknown, the search is not a match and not an error of the
+ * pattern.
+ */
+#define REGEX_ELIMIT (-1)
+
+/*
+ * compiled pattern of any engine
+ */
+typedef struct CompiledRegex {
+    RegexEngineType type;
+    
+    /*
+     * REGEX_ICASE, REGEX_WORD
+     */
+    int flags;
+    
+    /*
+     * number of capture groups
+     */
+    size_t nsub;
+    
+    /*
+     * engine specific data
+     */
+    void *data;
+} CompiledRegex;
+
+/*
+ * Compiles a pattern with the specified engine
+ * 
+ * returns NULL if the pattern couldn't be compiled or the engine
+ * is not available
+ */
+CompiledRegex* regex_compile(RegexEngineType type, const char *pattern);
+
+/*
+ * Compiles a pattern with flags (REGEX_ICASE, REGEX_WORD)
+ */
+CompiledRegex* regex_compile_flags(RegexEngineType type, const char *pattern, int flags);
+
+/*
+ * Searches the first match in str
+ * 
+ * Same semantics as regexec: returns 0 if a match was found, REGEX_ELIMIT
+ * if the engine stopped the search and REG_NOMATCH otherwise. Unused
+ * capture groups have rm_so/rm_eo set to -1.
+ * 
+ * Supported eflags: REG_NOTBOL, REG_STARTEND
+ * With REG_STARTEND, only the range pmatch[0].rm_so - pmatch[0].rm_eo is
+ * searched, str doesn't need to be terminated and all offsets are relative
+ * to str. ^ doesn't match at rm_so, if rm_so > 0.
+ */
+int regex_exec(
+        CompiledRegex *re,
+        const char *str,
+        size_t nmatch,
+        regmatch_t *pmatch,
+        int eflags);
+
+void regex_free(CompiledRegex *re);
+
+/*
+ * Creates a DFA engine regex from existing NFA programs (see dfa_load)
+ * 
+ * returns NULL if the programs are inconsistent
+ */
+CompiledRegex* regex_dfa_load(
+        const NfaProgram *fwd,
+        const NfaProgram *rev,
+        size_t nsub,
+        int flags);
+
+/*
+ * folds ASCII letters to lower case
+ */
+void regex_literal_fold(char *str, size_t len);
+
+/*
+ * Searches a literal string
+ * 
+ * If icase is set, the literal must already be folded with
+ * regex_literal_fold.
+ * returns a pointer to the first occurrence or NULL
+ */
+const char* regex_literal_find(
+        const char *str,
+        size_t len,
+        const char *literal,
+        size_t literal_len,
+        int icase);
+
+/*
+ * returns the replacement of a match of a dictionary engine regex
+ * or NULL, if the word is not contained in the dictionary
+ */
+const char* regex_dictionary_replacement(
+        CompiledRegex *re,
+        const char *word,
+        size_t len,
+        size_t *replacement_len);
+
+/*
+ * returns the engine name, used in the rules file header
+ */
+const char* regex_engine_name(RegexEngineType type);
+
+/*
+ * looks up an engine by name
+ * returns 0 on success, 1 if the name is unknown
+ */
+int regex_engine_from_name(const char *name, RegexEngineType *type);
+
+/*
+ * returns 1 if the engine was compiled into the plugin
+ */
+int regex_engine_available(RegexEngineType type);
+
+#endif /* RTR_REGEX_ENGINE_H */
@@ -16,14 +16,29 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #define PURPLE_PLUGINS
 
 #include "regex-text-replacement.h"
+#include "trigram-index.h"
+#include "dfa.h"
+#include "piece-table.h"
+#include "arena.h"
+#include "result-cache.h"
+#include "rules-watch.h"
+#include "compile-worker.h"
+#include "rules-snapshot.h"
 #include "ui.h"
 
 #include <util.h> /* pidgin/util.h */
 
 #include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 static gboolean writing_chat_msg(PurpleAccount *account, const char *who,
@@ -35,20 +50,129 @@ static gboolean writing_im_msg(PurpleAccount *account, const char *who,
 static void sending_im_msg(PurpleAccount *account, const char *receiver,
                            char **message);
 static void sending_chat_msg(PurpleAccount *account, char **message, int id);
+static void deleting_conversation(PurpleConversation *conv);
 
 
 static TextReplacementRule *rules;
 static size_t nrules;
 
+static RulesFileOptions rules_options;
+
+static RuleUnion rules_union;
+
+/*
+ * trigram index of all rules
+ * kept up to date by the rule_* functions
+ */
+static TrigramIndex rules_index;
+
+/*
+ * incremented, whenever the rules are changed
+ */
+static unsigned int rules_generation;
+
+/*
+ * last assigned rule id
+ */
+static unsigned int rule_last_id;
+
+/*
+ * results of the sending-*-msg handlers, that are reused in the
+ * writing-*-msg handlers
+ */
+static ResultCache sent_results;
+
+/*
+ * current message, edits and scratch buffers of apply_all_rules
+ */
+static ApplyState message_state;
+
+/*
+ * number of heap allocations in apply_all_rules
+ * counted per thread, because rule_match_spans is also used by the
+ * workers of the log rewriter
+ */
+static __thread unsigned long heap_allocs;
+
+/*
+ * literal rule groups, built for the rules generation
+ * literal_groups_generation
+ */
+static LiteralGroup *literal_groups;
+static size_t nliteral_groups;
+static unsigned int literal_groups_generation;
+static int literal_groups_valid;
+
+/*
+ * group index of each rule or -1
+ */
+static int32_t *literal_group_of;
+
+/*
+ * literals of the current group, that were found in the message
+ */
+static char *literal_hits;
+
+/*
+ * inotify watch of the rules file
+ */
+static RulesWatch *rules_watch;
+
+/*
+ * stat of the rules file after it was loaded or saved by the plugin
+ */
+static struct stat rules_file_stat;
+
+/*
+ * mapped snapshot, that is used by compiled rules, or NULL
+ */
+static RulesSnapshot *rules_snapshot;
+
+/*
+ * snapshot path of the current rules file
+ */
+static char *rules_snapshot_file;
+
+/*
+ * the snapshot doesn't match the current rules file and is written, when
+ * all rules are compiled
+ */
+static int rules_snapshot_stale;
+
+/*
+ * directory of the rules file, relative dictionary paths are resolved
+ * against this directory
+ */
+static char *rules_dir;
+
+static void rules_changed(void);
+static void rules_index_build(TrigramIndex *idx, TextReplacementRule *rules, size_t nrules);
+static void rules_file_remember(const char *path);
+static void rules_file_changed(void *userdata);
+static void rule_prefilter_init(TextReplacementRule *rule);
+static gboolean rules_warmup(gpointer data);
+static void rules_warmup_stop(void);
+static void rules_snapshot_update(void);
+static void literal_groups_free(void);
+static char* apply_all_rules_result(const char *msg, size_t msglen, size_t *outlen);
+
 
 static gboolean plugin_load(PurplePlugin *plugin) {
+    // compile the rules in the background, messages are rewritten with
+    // the rules, that are already compiled
+    compile_worker_start();
+    
     char *file_path = rules_file_path();
-    int err = load_rules(file_path, &rules, &nrules);
-    free(file_path);
+    int err = rules_init(file_path);
     if(err) {
         fprintf(stderr, "regex-text-replacement: load_rules failed\n");
+        free(file_path);
         return TRUE;
     }
+    rules_file_remember(file_path);
+    // reload the rules, when the file is changed by other programs
+    rules_watch = rules_watch_new(file_path, rules_file_changed, NULL);
+    free(file_path);
     
     void *conversation = purple_conversations_get_handle();
     // callbacks for handling writing to the conversation window locally
@@ -63,13 +187,16 @@ static gboolean plugin_load(PurplePlugin *plugin) {
     purple_signal_connect_priority(conversation, "sending-chat-msg",
             plugin, PURPLE_CALLBACK(sending_chat_msg), NULL,
             PURPLE_SIGNAL_PRIORITY_DEFAULT);
+    purple_signal_connect(conversation, "deleting-conversation",
+            plugin, PURPLE_CALLBACK(deleting_conversation), NULL);
     return TRUE;
 }
 
 static gboolean plugin_unload(PurplePlugin *plugin) {
-    free_rules(rules, nrules);
-    rules = NULL;
-    nrules = 0;
+    rules_watch_free(rules_watch);
+    rules_watch = NULL;
+    compile_worker_stop();
+    rules_cleanup();
     return TRUE;
 }
 
@@ -77,7 +204,7 @@ static PidginPluginUiInfo ui_info =
 {
     get_config_frame,
     0,
-
+    
     /* padding */
     NULL,
     NULL,
@@ -94,11 +221,11 @@ static PurplePluginInfo info = {
     0,
     NULL,
     PURPLE_PRIORITY_HIGHEST,
-
+    
     "regex-text-replacement",
     "Regex Text Replacement",
     "1.0",
-
+    
     "Replace text with regex rules",          
     "Replace text in outgoing messages with regex rules",          
     "Olaf Wintermann <olaf.wintermann@gmail.com>",                          
@@ -107,7 +234,7 @@ static PurplePluginInfo info = {
     plugin_load,                   
     plugin_unload,                          
     NULL,                          
-                                   
+    
     &ui_info,                          
     NULL,                          
     NULL,                        
@@ -127,19 +254,11 @@ static void init_plugin(PurplePlugin *plugin)
 PURPLE_INIT_PLUGIN(regex_text_replace, init_plugin, info)
         
 
-static void writing_msg(char **message, PurpleMessageFlags flags) {
-    // apply rules only on send
-    if((flags & PURPLE_MESSAGE_SEND) == 0) {
-        return;
-    }
-    apply_all_rules(message);
-}
-
 static gboolean writing_chat_msg(PurpleAccount *account, const char *who,
                                  char **message, PurpleConversation *conv,
                                  PurpleMessageFlags flags)
 {
-    writing_msg(message, flags);
+    handle_writing_msg(conv, message, flags);
     return FALSE;
 }
 
@@ -148,34 +267,671 @@ static gboolean writing_im_msg(PurpleAccount *account, const char *who,
                                char **message, PurpleConversation *conv,
                                PurpleMessageFlags flags)
 {
-    writing_msg(message, flags);
+    handle_writing_msg(conv, message, flags);
     return FALSE;
 }
 
 static void sending_im_msg(PurpleAccount *account, const char *receiver,
                            char **message)
 {
-    apply_all_rules(message);
+    PurpleConversation *conv = purple_find_conversation_with_account(
+            PURPLE_CONV_TYPE_IM, receiver, account);
+    handle_sending_msg(conv, message);
 }
 
 static void sending_chat_msg(PurpleAccount *account, char **message, int id) {
-    apply_all_rules(message);
+    PurpleConnection *gc = purple_account_get_connection(account);
+    PurpleConversation *conv = gc ? purple_find_chat(gc, id) : NULL;
+    handle_sending_msg(conv, message);
+}
+
+static void deleting_conversation(PurpleConversation *conv) {
+    result_cache_remove(&sent_results, conv);
+}
+
+void handle_sending_msg(const void *conv, char **message) {
+    // the original message is the key of the result, because the
+    // writing-im-msg handler receives the original message
+    size_t len = strlen(*message);
+    size_t outlen = 0;
+    char *result = apply_all_rules_result(*message, len, &outlen);
+    result_cache_store(&sent_results, conv, rules_generation, *message, len, result, outlen);
+    if(result) {
+        g_free(*message);
+        *message = result;
+    }
+}
+
+void handle_writing_msg(const void *conv, char **message, PurpleMessageFlags flags) {
+    // apply rules only on send
+    if((flags & PURPLE_MESSAGE_SEND) == 0) {
+        return;
+    }
+    // messages, that were already rewritten in the sending handler, are
+    // replaced with the result of the sending handler
+    size_t len = strlen(*message);
+    char *result;
+    size_t result_len;
+    if(result_cache_take(&sent_results, conv, rules_generation, *message, len, &result, &result_len)) {
+        if(result) {
+            g_free(*message);
+            *message = g_strndup(result, result_len);
+            free(result);
+        }
+        return;
+    }
+    apply_all_rules_n(message, &len);
+}
+
+ResultCache* get_sent_results(void) {
+    return &sent_results;
 }
 
 /* ------------------------------------------------------------------------- */
 
+/*
+ * set while rules_init submits the rules to the compile worker
+ */
+static int rules_loading;
+
+/*
+ * number of rules, that are not compiled yet in lazy mode
+ */
+static size_t rules_lazy;
+
+/*
+ * idle callback source of the lazy rules warm-up
+ */
+static guint rules_warmup_source;
+
+/*
+ * returns the rule with the id or NULL, if the rule doesn't exist anymore
+ * hint: probable index of the rule
+ */
+static TextReplacementRule* rule_find(unsigned int id, size_t hint) {
+    if(hint < nrules && rules[hint].id == id) {
+        return &rules[hint];
+    }
+    for(size_t i=0;i<nrules;i++) {
+        if(rules[i].id == id) {
+            return &rules[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * compile job callback: moves the compiled rules to the current rules
+ */
+static void rules_compiled(CompileJob *job) {
+    size_t hint = (size_t)job->userdata;
+    int changed = 0;
+    for(size_t i=0;i<job->nrules;i++) {
+        TextReplacementRule *src = &job->rules[i];
+        // the rule could be removed or changed in the meantime
+        TextReplacementRule *rule = rule_find(src->id, hint + i);
+        if(!rule) {
+            continue;
+        }
+        rule_move_compiled(rule, src);
+        rule->compile_pending = 0;
+        if(!rule->regex) {
+            if(!(rule->flags & RULE_FLAG_DISABLED)) {
+                fprintf(stderr, "Cannot compile pattern: %s\n", rule->pattern);
+            }
+        } else if(strcmp(rule->replacement ? rule->replacement : "", src->replacement ? src->replacement : "")) {
+            template_free(&rule->template);
+            template_compile(&rule->template, rule->replacement ? rule->replacement : "", rule->regex->nsub);
+        }
+        trigram_index_set(&rules_index, rule - rules, rule->literal, rule->literal_len, rule->regex != NULL);
+        changed = 1;
+    }
+    compile_job_free(job);
+    
+    if(changed && !rules_loading) {
+        // the union is only built once, after all pending rules are compiled
+        if(compile_worker_pending() == 0) {
+            rules_changed();
+            rules_snapshot_update();
+        } else {
+            rules_generation++;
+        }
+        ui_rules_status_changed();
+    }
+}
+
+/*
+ * loads the compiled rules from the snapshot of the rules file
+ * if the snapshot doesn't match the rules, it is marked as stale
+ */
+static void rules_snapshot_load(void) {
+    rules_snapshot = rules_snapshot_open(rules_snapshot_file, rules_snapshot_hash(rules, nrules), nrules);
+    if(!rules_snapshot) {
+        rules_snapshot_stale = 1;
+        return;
+    }
+    size_t loaded = 0;
+    for(size_t i=0;i<nrules;i++) {
+        if(rules_snapshot_load_rule(rules_snapshot, i, &rules[i])) {
+            rule_prefilter_init(&rules[i]);
+            loaded++;
+        }
+    }
+    if(loaded == 0) {
+        rules_snapshot_close(rules_snapshot);
+        rules_snapshot = NULL;
+    }
+}
+
+/*
+ * writes the snapshot, if it is stale and all rules are compiled
+ */
+static void rules_snapshot_update(void) {
+    if(!rules_snapshot_stale || !rules_snapshot_file
+            || rules_lazy > 0 || compile_worker_pending() > 0)
+    {
+        return;
+    }
+    rules_snapshot_stale = 0;
+    rules_snapshot_save(rules_snapshot_file, rules, nrules);
+}
+
+/*
+ * returns 1, if the rule is neither compiled nor disabled
+ */
+static int rule_needs_compile(TextReplacementRule *rule) {
+    return !rule->regex && !(rule->flags & RULE_FLAG_DISABLED);
+}
+
+/*
+ * submits the rules start - start+n to the compile worker
+ */
+static void rules_compile_async(size_t start, size_t n) {
+    TextReplacementRule *copies = calloc(n, sizeof(TextReplacementRule));
+    for(size_t i=0;i<n;i++) {
+        TextReplacementRule *rule = &rules[start+i];
+        copies[i].pattern = strdup(rule->pattern);
+        copies[i].replacement = rule->replacement ? strdup(rule->replacement) : NULL;
+        copies[i].engine = rule->engine;
+        copies[i].flags = rule->flags;
+        copies[i].id = rule->id;
+        rule->compile_pending = 1;
+    }
+    compile_worker_submit(compile_job_new(copies, n, rules_dir, rules_compiled, (void*)start));
+}
+
+int rules_init(const char *file) {
+    int err = parse_rules_file(file, &rules, &nrules, &rules_options);
+    if(err) {
+        return err;
+    }
+    free(rules_snapshot_file);
+    rules_snapshot_file = rules_snapshot_path(file);
+    rules_snapshot_stale = 0;
+    rules_snapshot_load();
+    g_free(rules_dir);
+    rules_dir = g_path_get_dirname(file);
+    
+    if(rules_options.lazy) {
+        // only the prefilter literal is needed, before a rule is used
+        rules_lazy = 0;
+        for(size_t i=0;i<nrules;i++) {
+            if(!rules[i].regex && !(rules[i].flags & RULE_FLAG_DISABLED)) {
+                rule_prefilter_init(&rules[i]);
+                rules[i].compile_lazy = 1;
+                rules_lazy++;
+            }
+        }
+        rules_index_build(&rules_index, rules, nrules);
+        if(rules_options.warmup && rules_lazy > 0) {
+            rules_warmup_source = g_idle_add(rules_warmup, NULL);
+        }
+        rules_changed();
+        return 0;
+    }
+    
+    rules_index_build(&rules_index, rules, nrules);
+    rules_loading = 1;
+    for(size_t i=0;i<nrules;) {
+        // rules from the snapshot are already compiled and disabled
+        // rules are not compiled at all
+        if(!rule_needs_compile(&rules[i])) {
+            i++;
+            continue;
+        }
+        size_t n = 1;
+        while(n < RULES_COMPILE_BATCH && i + n < nrules && rule_needs_compile(&rules[i+n])) {
+            n++;
+        }
+        rules_compile_async(i, n);
+        i += n;
+    }
+    rules_loading = 0;
+    rules_changed();
+    rules_snapshot_update();
+    return 0;
+}
+
+/*
+ * compiles a lazy rule
+ */
+static void rule_compile_deferred(size_t index) {
+    TextReplacementRule *rule = &rules[index];
+    rule_free_compiled(rule);
+    rule->compile_lazy = 0;
+    if(!rule_compile(rule)) {
+        fprintf(stderr, "Cannot compile pattern: %s\n", rule->pattern);
+    }
+    trigram_index_set(&rules_index, index, rule->literal, rule->literal_len, rule->regex != NULL);
+    rules_lazy--;
+    if(rules_lazy == 0) {
+        // all patterns are available for the union
+        rules_changed();
+        rules_snapshot_update();
+    } else {
+        rules_generation++;
+    }
+}
+
+size_t rules_compile_lazy(size_t n) {
+    for(size_t i=0;i<nrules && n > 0 && rules_lazy > 0;i++) {
+        if(rules[i].compile_lazy) {
+            rule_compile_deferred(i);
+            n--;
+        }
+    }
+    return rules_lazy;
+}
+
+static gboolean rules_warmup(gpointer data) {
+    if(rules_compile_lazy(RULES_WARMUP_BATCH) > 0) {
+        return TRUE;
+    }
+    rules_warmup_source = 0;
+    ui_rules_status_changed();
+    return FALSE;
+}
+
+static void rules_warmup_stop(void) {
+    if(rules_warmup_source) {
+        g_source_remove(rules_warmup_source);
+        rules_warmup_source = 0;
+    }
+    rules_lazy = 0;
+}
+
+/*
+ * parses the rules file for a reload
+ */
+static int rules_reload_parse(
+        const char *file,
+        TextReplacementRule **new_rules,
+        size_t *new_nrules,
+        RulesFileOptions *new_options)
+{
+    // parse_rules_file would create a missing file, but a deleted file
+    // doesn't remove the current rules
+    struct stat s;
+    if(stat(file, &s)) {
+        fprintf(stderr, "regex-text-replacement: cannot reload %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+    int err = parse_rules_file(file, new_rules, new_nrules, new_options);
+    if(err) {
+        fprintf(stderr, "regex-text-replacement: cannot reload %s\n", file);
+    }
+    return err;
+}
+
+/*
+ * replaces the current rules with compiled rules
+ * if any pattern couldn't be compiled, new_rules are freed and the current
+ * rules stay active
+ */
+static int rules_activate(
+        const char *file,
+        TextReplacementRule *new_rules,
+        size_t new_nrules,
+        RulesFileOptions *new_options)
+{
+    for(size_t i=0;i<new_nrules;i++) {
+        TextReplacementRule *rule = &new_rules[i];
+        if(rule->pattern && strlen(rule->pattern) > 0 && !rule->regex
+                && !(rule->flags & RULE_FLAG_DISABLED))
+        {
+            fprintf(stderr, "regex-text-replacement: cannot reload %s: invalid pattern %s\n", file, rule->pattern);
+            free_rules(new_rules, new_nrules);
+            return 1;
+        }
+    }
+    
+    // the new rules are prepared completely, before they replace the
+    // current rules
+    RuleUnion new_union;
+    rule_union_build(&new_union, new_rules, new_nrules);
+    TrigramIndex new_index;
+    memset(&new_index, 0, sizeof(TrigramIndex));
+    rules_index_build(&new_index, new_rules, new_nrules);
+    
+    TextReplacementRule *old_rules = rules;
+    size_t old_nrules = nrules;
+    RuleUnion old_union = rules_union;
+    TrigramIndex old_index = rules_index;
+    
+    rules_warmup_stop();
+    rules = new_rules;
+    nrules = new_nrules;
+    rules_options = *new_options;
+    rules_union = new_union;
+    rules_index = new_index;
+    rules_generation++;
+    
+    free_rules(old_rules, old_nrules);
+    rule_union_free(&old_union);
+    trigram_index_free(&old_index);
+    
+    // the old rules were the last users of the snapshot
+    rules_snapshot_close(rules_snapshot);
+    rules_snapshot = NULL;
+    free(rules_snapshot_file);
+    rules_snapshot_file = rules_snapshot_path(file);
+    rules_snapshot_stale = 1;
+    rules_snapshot_update();
+    g_free(rules_dir);
+    rules_dir = g_path_get_dirname(file);
+    return 0;
+}
+
+int rules_reload(const char *file) {
+    TextReplacementRule *new_rules;
+    size_t new_nrules;
+    RulesFileOptions new_options;
+    if(rules_reload_parse(file, &new_rules, &new_nrules, &new_options)) {
+        return 1;
+    }
+    char *dir = g_path_get_dirname(file);
+    for(size_t i=0;i<new_nrules;i++) {
+        rule_compile_dir(&new_rules[i], dir);
+    }
+    g_free(dir);
+    return rules_activate(file, new_rules, new_nrules, &new_options);
+}
+
+/*
+ * compile job callback of a reloaded rules file
+ */
+static void rules_reload_compiled(CompileJob *job) {
+    char *path = rules_file_path();
+    int err = rules_activate(path, job->rules, job->nrules, &job->options);
+    // the rules are owned by rules_activate
+    job->rules = NULL;
+    job->nrules = 0;
+    compile_job_free(job);
+    if(!err) {
+        rules_file_remember(path);
+        ui_rules_reloaded();
+    }
+    free(path);
+}
+
+static void rules_file_remember(const char *path) {
+    if(stat(path, &rules_file_stat)) {
+        memset(&rules_file_stat, 0, sizeof(struct stat));
+    }
+}
+
+static void rules_file_changed(void *userdata) {
+    char *path = rules_file_path();
+    struct stat s;
+    if(stat(path, &s)
+            || (s.st_ino == rules_file_stat.st_ino
+            && s.st_size == rules_file_stat.st_size
+            && s.st_mtim.tv_sec == rules_file_stat.st_mtim.tv_sec
+            && s.st_mtim.tv_nsec == rules_file_stat.st_mtim.tv_nsec))
+    {
+        // deleted or written by save_rules
+        free(path);
+        return;
+    }
+    
+    // the new rules are compiled in the background and replace the
+    // current rules, when they are ready
+    TextReplacementRule *new_rules;
+    size_t new_nrules;
+    RulesFileOptions new_options;
+    if(!rules_reload_parse(path, &new_rules, &new_nrules, &new_options)) {
+        char *dir = g_path_get_dirname(path);
+        CompileJob *job = compile_job_new(new_rules, new_nrules, dir, rules_reload_compiled, NULL);
+        g_free(dir);
+        job->options = new_options;
+        compile_worker_submit(job);
+    }
+    free(path);
+}
+
+void rules_cleanup(void) {
+    rules_warmup_stop();
+    free_rules(rules, nrules);
+    rules = NULL;
+    nrules = 0;
+    rules_snapshot_close(rules_snapshot);
+    rules_snapshot = NULL;
+    free(rules_snapshot_file);
+    rules_snapshot_file = NULL;
+    rules_snapshot_stale = 0;
+    g_free(rules_dir);
+    rules_dir = NULL;
+    rule_union_free(&rules_union);
+    trigram_index_free(&rules_index);
+    literal_groups_free();
+    apply_state_free(&message_state);
+    result_cache_free(&sent_results);
+}
+
 char *rules_file_path(void) {
     // get path to ~/.purple directory
     const char *user_dir = purple_user_dir();
     return g_build_filename(user_dir, REGEX_TEXT_REPLACEMENT_RULES_FILE, NULL);
 }
 
-int load_rules(const char *file, TextReplacementRule **rules, size_t *len) {
+void rules_options_default(RulesFileOptions *options) {
+    memset(options, 0, sizeof(RulesFileOptions));
+    options->version = 1;
+    options->time_limit = RULES_DEFAULT_TIME_LIMIT;
+    options->step_limit = RULES_DEFAULT_STEP_LIMIT;
+    options->message_limit = RULES_DEFAULT_MESSAGE_LIMIT;
+}
+
+/*
+ * parses a non-negative decimal number
+ * returns 0 on success
+ */
+static int parse_size(const char *str, size_t *value) {
+    if(!isdigit((unsigned char)*str)) {
+        return 1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(str, &end, 10);
+    if(errno || *end != '\0') {
+        return 1;
+    }
+    *value = v;
+    return 0;
+}
+
+int parse_rules_header(const char *line, RulesFileOptions *options) {
+    rules_options_default(options);
+    
+    if(strncmp(line, "?v", 2) || (line[2] != '1' && line[2] != '2')
+            || (line[3] != '\0' && line[3] != ' '))
+    {
+        fprintf(stderr, "Unknown file format version: %s\n", line);
+        return 1;
+    }
+    options->version = line[2] - '0';
+    
+    // parse options: key=value, separated by spaces
+    const char *opt = line + 3;
+    while(*opt) {
+        while(*opt == ' ') opt++;
+        if(*opt == '\0') {
+            break;
+        }
+        size_t optlen = strcspn(opt, " ");
+        char *option = strndup(opt, optlen);
+        opt += optlen;
+        
+        char *value = strchr(option, '=');
+        int err = 1;
+        if(value) {
+            *value = '\0';
+            value++;
+            size_t n;
+            if(!strcmp(option, "engine")) {
+                err = regex_engine_from_name(value, &options->engine);
+                if(!err && !regex_engine_available(options->engine)) {
+                    // every rule would fail to compile
+                    fprintf(stderr, "Regex engine %s is not available in this build\n", value);
+                    err = 2;
+                }
+            } else if(!strcmp(option, "time_limit")) {
+                err = parse_size(value, &n) || n > UINT_MAX;
+                options->time_limit = n;
+            } else if(!strcmp(option, "step_limit")) {
+                err = parse_size(value, &n);
+                options->step_limit = n;
+            } else if(!strcmp(option, "message_limit")) {
+                err = parse_size(value, &n) || n > UINT_MAX;
+                options->message_limit = n;
+            } else if(!strcmp(option, "strict")) {
+                err = parse_size(value, &n) || n > 1;
+                options->strict = n;
+            } else if(!strcmp(option, "lazy")) {
+                err = parse_size(value, &n) || n > 1;
+                options->lazy = n;
+            } else if(!strcmp(option, "warmup")) {
+                err = parse_size(value, &n) || n > 1;
+                options->warmup = n;
+            }
+        }
+        if(err == 1) {
+            fprintf(stderr, "Unknown rules file option: %s\n", option);
+        }
+        free(option);
+        if(err) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+int load_rules(
+        const char *file,
+        TextReplacementRule **rules,
+        size_t *len,
+        RulesFileOptions *options)
+{
+    int err = parse_rules_file(file, rules, len, options);
+    if(err) {
+        return err;
+    }
+    // load_rules is also used by other threads, therefore the directory
+    // of the current rules is not used
+    char *dir = g_path_get_dirname(file);
+    for(size_t i=0;i<*len;i++) {
+        TextReplacementRule *rule = &(*rules)[i];
+        if(!rule_compile_dir(rule, dir)) {
+            fprintf(stderr, "Cannot compile pattern: %s\n", rule->pattern);
+        }
+    }
+    g_free(dir);
+    return 0;
+}
+
+/*
+ * returns 1, if str is stored in the string block of the rule
+ */
+static int rule_string_in_block(TextReplacementRule *rule, const char *str) {
+    RuleStrings *block = rule->strings;
+    return block && str >= block->data && str < block->data + block->size;
+}
+
+/*
+ * frees a pattern or replacement string of the rule, unless it is stored
+ * in the string block
+ */
+static void rule_string_free(TextReplacementRule *rule, char *str) {
+    if(!rule_string_in_block(rule, str)) {
+        free(str);
+    }
+}
+
+/*
+ * releases the reference of the rule to the string block
+ */
+static void rule_strings_release(TextReplacementRule *rule) {
+    if(rule->strings && --rule->strings->refs == 0) {
+        free(rule->strings);
+    }
+    rule->strings = NULL;
+}
+
+/*
+ * parses the flags column of a ?v2 rule
+ * returns 0 on success, 1 if the column contains unknown flags
+ */
+static int rule_flags_parse(const char *str, size_t len, unsigned int *flags) {
+    *flags = 0;
+    if(len == 1 && str[0] == '-') {
+        return 0;
+    }
+    for(size_t i=0;i<len;i++) {
+        switch(str[i]) {
+            case 'l': *flags |= RULE_FLAG_LITERAL; break;
+            case 'i': *flags |= RULE_FLAG_ICASE; break;
+            case 'w': *flags |= RULE_FLAG_WORD; break;
+            case 'd': *flags |= RULE_FLAG_DISABLED; break;
+            case 't': *flags |= RULE_FLAG_DICTIONARY; break;
+            default: return 1;
+        }
+    }
+    return len == 0;
+}
+
+/*
+ * writes the flags column of a ?v2 rule
+ * buf: at least 6 bytes
+ */
+static void rule_flags_format(unsigned int flags, char *buf) {
+    char *p = buf;
+    if(flags & RULE_FLAG_LITERAL) *p++ = 'l';
+    if(flags & RULE_FLAG_ICASE) *p++ = 'i';
+    if(flags & RULE_FLAG_WORD) *p++ = 'w';
+    if(flags & RULE_FLAG_DISABLED) *p++ = 'd';
+    if(flags & RULE_FLAG_DICTIONARY) *p++ = 't';
+    if(p == buf) *p++ = '-';
+    *p = '\0';
+}
+
+int parse_rules_file(
+        const char *file,
+        TextReplacementRule **rules,
+        size_t *len,
+        RulesFileOptions *options)
+{
     *rules = NULL;
     *len = 0;
     
-    FILE *in = fopen(file, "r");
-    if(!in) {
+    RulesFileOptions opts;
+    rules_options_default(&opts);
+    if(options) {
+        *options = opts;
+    }
+    
+    int fd = open(file, O_RDONLY);
+    if(fd < 0) {
         if(errno == ENOENT) {
             FILE *out = fopen(file, "w");
             fputs("?v1\n", out);
@@ -184,85 +940,106 @@ int load_rules(const char *file, TextReplacementRule **rules, size_t *len) {
         }
         return 1;
     }
-    
-    size_t rules_alloc = 16;
-    size_t rules_size = 0;
-    TextReplacementRule *r = calloc(rules_alloc, sizeof(TextReplacementRule));
-      
-    char *line = NULL;
-    size_t linelen = 0;
-    
-    // read format version
-    size_t vlen = getline(&line, &linelen, in);
-    if(vlen == 0) {
-        free(line);
-        fclose(in);
+    struct stat s;
+    if(fstat(fd, &s)) {
+        close(fd);
+        return 1;
+    }
+    size_t size = s.st_size;
+    if(size == 0) {
+        close(fd);
         return 0;
     }
-    
-    if(line[vlen-1] == '\n') {
-        line[vlen-1] = 0;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return 1;
     }
-    if(strcmp(line, "?v1")) {
-        fprintf(stderr, "Unknown file format version: %s\n", line);
-        free(line);
-        fclose(in);
+    const char *end = map + size;
+    
+    // read format version
+    const char *ln = map;
+    const char *nl = memchr(ln, '\n', size);
+    char *header = strndup(ln, nl ? nl - ln : end - ln);
+    int err = parse_rules_header(header, &opts);
+    free(header);
+    if(err) {
+        munmap(map, size);
         return 1;
     }
+    if(options) {
+        *options = opts;
+    }
     
-    // read rules
-    while(getline(&line, &linelen, in) >= 0) {
-        char *ln = line;
-        size_t lnlen = strlen(ln);    
-        
-        // remove trailing newline
-        if(lnlen > 0 && ln[lnlen-1] == '\n') {
-            ln[lnlen-1] = '\0';
-            lnlen--;
+    // each line needs at most one additional byte for the terminators
+    // of pattern and replacement, therefore all strings fit in a block
+    // of the file size
+    size_t nlines = 0;
+    for(const char *p=map;p && p<end;nlines++) {
+        p = memchr(p, '\n', end - p);
+        if(p) {
+            p++;
         }
-        
+    }
+    RuleStrings *block = malloc(sizeof(RuleStrings) + size + 1);
+    block->refs = 0;
+    block->size = size + 1;
+    char *str = block->data;
+    TextReplacementRule *r = calloc(nlines > 0 ? nlines : 1, sizeof(TextReplacementRule));
+    size_t rules_size = 0;
+    
+    // read rules
+    // memchr is vectorized and finds the line and tab boundaries without
+    // checking every byte in a loop
+    while(nl && nl + 1 < end) {
+        ln = nl + 1;
+        nl = memchr(ln, '\n', end - ln);
+        size_t lnlen = (nl ? nl : end) - ln;
         if(lnlen == 0) {
             continue;
         }
         
-        // find first \t separator
-        int separator = 0;
-        for(int i=0;i<lnlen;i++) {
-            if(ln[i] == '\t') {
-                separator = i;
-                break;
+        // v2: flags column
+        unsigned int flags = 0;
+        const char *tab = ln;
+        if(opts.version >= 2) {
+            tab = memchr(ln, '\t', lnlen);
+            if(!tab || rule_flags_parse(ln, tab - ln, &flags)) {
+                fprintf(stderr, "Invalid text replacement rule: %.*s\n", (int)lnlen, ln);
+                continue;
             }
+            lnlen -= tab + 1 - ln;
+            ln = tab + 1;
         }
         
+        // find first \t separator
+        tab = memchr(ln, '\t', lnlen);
+        
         // if a separator was found, we can add the rule
-        if(separator > 0) {
-            ln[separator] = '\0';
-            
-            char *pattern = strdup(ln);
-            char *replacement = strdup(ln+separator+1);
-            
-            if(rules_size == rules_alloc) {
-                rules_alloc *= 2;
-                r = reallocarray(r, rules_alloc, sizeof(TextReplacementRule));
-            }
-            r[rules_size].pattern = pattern;
-            r[rules_size].replacement = replacement;
-            
-            // compile the rule
-            if(regcomp(&r[rules_size].regex, ln, REG_EXTENDED) == 0) {
-                r[rules_size].compiled = TRUE;
-            } else {
-                fprintf(stderr, "Cannot compile pattern: %s\n", ln);
-            }
-            
-            rules_size++;
+        if(tab && tab > ln) {
+            size_t patternlen = tab - ln;
+            size_t replacementlen = lnlen - patternlen - 1;
+            TextReplacementRule *rule = &r[rules_size++];
+            rule->pattern = str;
+            memcpy(str, ln, patternlen);
+            str[patternlen] = '\0';
+            str += patternlen + 1;
+            rule->replacement = str;
+            memcpy(str, tab + 1, replacementlen);
+            str[replacementlen] = '\0';
+            str += replacementlen + 1;
+            rule->engine = opts.engine;
+            rule->flags = flags;
+            rule->id = ++rule_last_id;
+            rule->strings = block;
+            block->refs++;
         } else {
-            fprintf(stderr, "Invalid text replacement rule: %s\n", ln);
+            fprintf(stderr, "Invalid text replacement rule: %.*s\n", (int)lnlen, ln);
         }
     }
-    fclose(in);
-    if(line) {
-        free(line);
+    munmap(map, size);
+    if(block->refs == 0) {
+        free(block);
     }
     
     *rules = r;
@@ -271,29 +1048,495 @@ int load_rules(const char *file, TextReplacementRule **rules, size_t *len) {
     return 0;
 }
 
+/*
+ * extracts the required literal of the pattern
+ */
+static void rule_prefilter_init(TextReplacementRule *rule) {
+    if(rule->flags & RULE_FLAG_DICTIONARY) {
+        // the pattern is a file name, any word can match
+    } else if(rule->flags & RULE_FLAG_LITERAL) {
+        // the whole pattern is the literal
+        rule->literal = strdup(rule->pattern);
+        rule->literal_len = strlen(rule->pattern);
+        rule->literal_prefix = 1;
+    } else if(rule->engine == REGEX_ENGINE_POSIX || !strstr(rule->pattern, "(?")) {
+        // inline options like (?i) change the meaning of literals in PCRE2
+        // patterns, in this case the prefilter is not used
+        rule->literal = pattern_required_literal(
+                rule->pattern,
+                &rule->literal_len,
+                &rule->literal_prefix);
+    }
+    if(rule->literal && (rule->flags & RULE_FLAG_ICASE)) {
+        // the engines fold non-ASCII characters differently, in this case
+        // the prefilter is not used
+        for(size_t i=0;i<rule->literal_len;i++) {
+            if((unsigned char)rule->literal[i] >= 0x80) {
+                free(rule->literal);
+                rule->literal = NULL;
+                rule->literal_len = 0;
+                rule->literal_prefix = 0;
+                break;
+            }
+        }
+    }
+    if(rule->literal && (rule->flags & RULE_FLAG_ICASE)) {
+        // the case-folded literal is computed once and compared with the
+        // folded message text
+        regex_literal_fold(rule->literal, rule->literal_len);
+        rule->literal_icase = 1;
+    }
+    // case-insensitive and whole word matches of literal rules are
+    // searched with regex_exec of the literal engine
+    rule->literal_only = rule->literal
+            && !(rule->flags & (RULE_FLAG_ICASE|RULE_FLAG_WORD))
+            && ((rule->flags & RULE_FLAG_LITERAL) || !strpbrk(rule->pattern, ".[]()*+?{}|^$\\"));
+    rule->prefilter_hits = 0;
+    rule->prefilter_skips = 0;
+}
+
+/*
+ * loads the dictionary of a rule with the dictionary flag
+ */
+static int rule_compile_dictionary(TextReplacementRule *rule, int flags, const char *dir) {
+    char *path = NULL;
+    if(!g_path_is_absolute(rule->pattern) && dir) {
+        path = g_build_filename(dir, rule->pattern, NULL);
+    }
+    rule->regex = regex_compile_flags(REGEX_ENGINE_DICTIONARY, path ? path : rule->pattern, flags);
+    g_free(path);
+    if(!rule->regex) {
+        return 0;
+    }
+    // the replacements are taken from the dictionary
+    template_compile(&rule->template, "", 0);
+    rule_prefilter_init(rule);
+    return 1;
+}
+
+int rule_compile(TextReplacementRule *rule) {
+    return rule_compile_dir(rule, rules_dir);
+}
+
+int rule_compile_dir(TextReplacementRule *rule, const char *dir) {
+    rule->regex = NULL;
+    rule->overruns = 0;
+    rule->disabled = 0;
+    rule->literal_only = 0;
+    rule->literal_icase = 0;
+    if(!rule->pattern || strlen(rule->pattern) == 0) {
+        return 0;
+    }
+    if(rule->flags & RULE_FLAG_DISABLED) {
+        // disabled rules are not compiled, but they are valid
+        return 1;
+    }
+    int flags = 0;
+    if(rule->flags & RULE_FLAG_ICASE) {
+        flags |= REGEX_ICASE;
+    }
+    if(rule->flags & RULE_FLAG_WORD) {
+        flags |= REGEX_WORD;
+    }
+    if(rule->flags & RULE_FLAG_DICTIONARY) {
+        return rule_compile_dictionary(rule, flags & REGEX_ICASE, dir);
+    }
+    RegexEngineType engine = rule->flags & RULE_FLAG_LITERAL ? REGEX_ENGINE_LITERAL : rule->engine;
+    if(engine == REGEX_ENGINE_POSIX && dfa_pattern_risky(rule->pattern)) {
+        // nested quantifiers can take exponential time with regexec,
+        // use the linear time engine if it supports the pattern
+        rule->regex = regex_compile_flags(REGEX_ENGINE_DFA, rule->pattern, flags);
+    }
+    if(!rule->regex) {
+        rule->regex = regex_compile_flags(engine, rule->pattern, flags);
+    }
+    if(!rule->regex) {
+        return 0;
+    }
+    template_compile(
+            &rule->template,
+            rule->replacement ? rule->replacement : "",
+            rule->regex->nsub);
+    rule_prefilter_init(rule);
+    return 1;
+}
+
+void rule_free_compiled(TextReplacementRule *rule) {
+    if(rule->regex) {
+        regex_free(rule->regex);
+        template_free(&rule->template);
+    }
+    free(rule->literal);
+    rule->regex = NULL;
+    rule->literal = NULL;
+    rule->literal_len = 0;
+    rule->literal_prefix = 0;
+    rule->literal_only = 0;
+    rule->literal_icase = 0;
+}
+
+void rule_move_compiled(TextReplacementRule *dst, TextReplacementRule *src) {
+    dst->regex = src->regex;
+    dst->template = src->template;
+    dst->literal = src->literal;
+    dst->literal_len = src->literal_len;
+    dst->literal_prefix = src->literal_prefix;
+    dst->literal_only = src->literal_only;
+    dst->literal_icase = src->literal_icase;
+    dst->overruns = 0;
+    dst->disabled = 0;
+    
+    src->regex = NULL;
+    src->literal = NULL;
+    src->literal_len = 0;
+    src->literal_prefix = 0;
+    src->literal_only = 0;
+    src->literal_icase = 0;
+    memset(&src->template, 0, sizeof(ReplacementTemplate));
+}
+
+/*
+ * returns the length of a quantifier at p or 0, if p is not a quantifier
+ * optional: set to 1, if the quantifier allows zero repetitions
+ */
+static size_t quantifier_len(const char *p, int *optional) {
+    switch(*p) {
+        case '*':
+        case '?': *optional = 1; return 1;
+        case '+': *optional = 0; return 1;
+        case '{': {
+            const char *q = p+1;
+            *optional = *q == ',' || (*q == '0' && !isdigit((unsigned char)q[1]));
+            while(*q && *q != '}') q++;
+            return *q ? q - p + 1 : 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * returns the length of the bracket expression at p
+ */
+static size_t bracket_len(const char *p) {
+    const char *b = p+1;
+    if(*b == '^') b++;
+    if(*b == ']') b++;
+    while(*b && *b != ']') {
+        if(*b == '[' && (b[1] == ':' || b[1] == '.' || b[1] == '=')) {
+            char delim = b[1];
+            b += 2;
+            while(*b && !(*b == delim && b[1] == ']')) b++;
+            if(*b == '\0') break;
+            b++;
+        }
+        b++;
+    }
+    return *b ? b - p + 1 : b - p;
+}
+
+char* pattern_required_literal(const char *pattern, size_t *len, int *prefix) {
+    *len = 0;
+    *prefix = 0;
+    
+    size_t patlen = strlen(pattern);
+    char *run = malloc(patlen + 1);
+    size_t runlen = 0;
+    size_t run_start_atom = 0;
+    
+    char *best = malloc(patlen + 1);
+    size_t bestlen = 0;
+    int best_prefix = 0;
+    
+    size_t atom = 0;
+    const char *p = pattern;
+    while(*p) {
+        // parse next atom
+        int literal = 0;
+        char c = *p;
+        const char *next = p+1;
+        switch(c) {
+            case '|': {
+                // top level alternatives have no common required literal
+                free(run);
+                free(best);
+                return NULL;
+            }
+            case '\\': {
+                if(p[1] == '\0') {
+                    next = p+1;
+                } else {
+                    // escaped alphanumeric characters can be special
+                    // sequences like \w or back-references
+                    c = p[1];
+                    literal = !isalnum((unsigned char)c);
+                    next = p+2;
+                }
+                break;
+            }
+            case '[': {
+                next = p + bracket_len(p);
+                break;
+            }
+            case '(': {
+                int depth = 1;
+                const char *g = p+1;
+                while(*g && depth > 0) {
+                    if(*g == '\\' && g[1]) {
+                        g++;
+                    } else if(*g == '[') {
+                        g += bracket_len(g) - 1;
+                    } else if(*g == '(') {
+                        depth++;
+                    } else if(*g == ')') {
+                        depth--;
+                    }
+                    g++;
+                }
+                next = g;
+                break;
+            }
+            case '.':
+            case '^':
+            case '$':
+            case ')': break;
+            default: literal = 1;
+        }
+        
+        // a quantifier can be followed by further quantifiers
+        // (or lazy/possessive modifiers in PCRE2 patterns)
+        int optional = 0;
+        size_t qlen = 0;
+        size_t ql;
+        int opt;
+        while((ql = quantifier_len(next + qlen, &opt)) > 0) {
+            optional |= opt;
+            qlen += ql;
+        }
+        
+        if(literal && !optional) {
+            if(runlen == 0) {
+                run_start_atom = atom;
+            }
+            run[runlen++] = c;
+        }
+        if(!literal || qlen > 0) {
+            // end of the current literal run
+            if(runlen > bestlen) {
+                memcpy(best, run, runlen);
+                bestlen = runlen;
+                best_prefix = run_start_atom == 0;
+            }
+            runlen = 0;
+        }
+        
+        p = next + qlen;
+        atom++;
+    }
+    if(runlen > bestlen) {
+        memcpy(best, run, runlen);
+        bestlen = runlen;
+        best_prefix = run_start_atom == 0;
+    }
+    free(run);
+    
+    if(bestlen == 0) {
+        free(best);
+        return NULL;
+    }
+    best[bestlen] = '\0';
+    *len = bestlen;
+    *prefix = best_prefix;
+    return best;
+}
+
+/*
+ * checks if a pattern can be embedded in the union pattern
+ * 
+ * The pattern must not contain back-references, because the group numbers
+ * are different in the union, and all parentheses must be balanced.
+ */
+static int pattern_union_safe(const char *pattern) {
+    int depth = 0;
+    for(const char *p=pattern;*p;p++) {
+        switch(*p) {
+            case '\\': {
+                p++;
+                if(*p == '\0' || isdigit((unsigned char)*p)) {
+                    return 0;
+                }
+                break;
+            }
+            case '[': {
+                // skip bracket expression
+                p++;
+                if(*p == '^') p++;
+                if(*p == ']') p++;
+                while(*p && *p != ']') {
+                    if(*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+                        // character class [:alpha:]
+                        char delim = p[1];
+                        p += 2;
+                        while(*p && !(*p == delim && p[1] == ']')) p++;
+                        if(*p == '\0') return 0;
+                        p++;
+                    }
+                    p++;
+                }
+                if(*p == '\0') {
+                    return 0;
+                }
+                break;
+            }
+            case '(': depth++; break;
+            case ')': {
+                if(--depth < 0) {
+                    return 0;
+                }
+                break;
+            }
+        }
+    }
+    return depth == 0;
+}
+
+int rule_union_build(RuleUnion *u, TextReplacementRule *rules, size_t nrules) {
+    u->compiled = 0;
+    
+    size_t alloc = 1024;
+    size_t pos = 0;
+    char *pattern = malloc(alloc);
+    int nmembers = 0;
+    for(size_t i=0;i<nrules;i++) {
+        TextReplacementRule *rule = &rules[i];
+        rule->union_member = 0;
+        // the union is case-sensitive, case-insensitive rules are always
+        // applied
+        if(!rule->regex || rule->regex->type != REGEX_ENGINE_POSIX
+                || (rule->flags & RULE_FLAG_ICASE)
+                || !pattern_union_safe(rule->pattern))
+        {
+            continue;
+        }
+        
+        size_t len = strlen(rule->pattern);
+        if(pos + len + 4 >= alloc) {
+            alloc += len + 1024;
+            pattern = realloc(pattern, alloc);
+        }
+        if(nmembers > 0) {
+            pattern[pos++] = '|';
+        }
+        pattern[pos++] = '(';
+        memcpy(pattern+pos, rule->pattern, len);
+        pos += len;
+        pattern[pos++] = ')';
+        
+        rule->union_member = 1;
+        nmembers++;
+    }
+    pattern[pos] = '\0';
+    
+    if(nmembers > 0 && pos <= RULE_UNION_MAX_PATTERN) {
+        // only the information if anything matches is needed
+        u->compiled = regcomp(&u->regex, pattern, REG_EXTENDED|REG_NOSUB) == 0;
+    }
+    free(pattern);
+    
+    if(!u->compiled) {
+        for(size_t i=0;i<nrules;i++) {
+            rules[i].union_member = 0;
+        }
+    }
+    
+    return u->compiled;
+}
+
+int rule_union_match(RuleUnion *u, const char *str, size_t len) {
+    if(!u->compiled) {
+        return 1;
+    }
+    // REG_STARTEND: the length is already known
+    regmatch_t range;
+    range.rm_so = 0;
+    range.rm_eo = len;
+    return regexec(&u->regex, str, 1, &range, REG_STARTEND) == 0;
+}
+
+void rule_union_free(RuleUnion *u) {
+    if(u->compiled) {
+        regfree(&u->regex);
+    }
+    u->compiled = 0;
+}
+
+/*
+ * must be called after the rules array or a rule pattern was modified
+ */
+static void rules_changed(void) {
+    rules_generation++;
+    rule_union_free(&rules_union);
+    rule_union_build(&rules_union, rules, nrules);
+}
+
+static void rules_index_build(TrigramIndex *idx, TextReplacementRule *rules, size_t nrules) {
+    trigram_index_free(idx);
+    for(size_t i=0;i<nrules;i++) {
+        trigram_index_append(
+                idx,
+                rules[i].literal,
+                rules[i].literal_len,
+                rules[i].regex != NULL || rules[i].compile_lazy);
+    }
+}
+
 TextReplacementRule* get_rules(size_t *numelm) {
     *numelm = nrules;
     return rules;
 }
 
+/*
+ * compiles a rule again, after the pattern or the flags were changed
+ */
+static int rule_recompile(size_t index) {
+    TextReplacementRule *rule = &rules[index];
+    rule_free_compiled(rule);
+    if(rule->compile_lazy) {
+        rule->compile_lazy = 0;
+        rules_lazy--;
+    }
+    
+    rule->id = ++rule_last_id;
+    rule->compile_pending = 0;
+    trigram_index_set(&rules_index, index, NULL, 0, 0);
+    if(strlen(rule->pattern) == 0 || (rule->flags & RULE_FLAG_DISABLED)) {
+        rules_changed();
+        return 0;
+    }
+    
+    // the union still contains the old pattern, but the rule is applied
+    // without checking the union, until the union is built again
+    rule->union_member = 0;
+    rules_generation++;
+    rules_compile_async(index, 1);
+    return rule->regex != NULL || rule->compile_pending;
+}
+
 int rule_update_pattern(size_t index, char *new_pattern) {
     if(index >= nrules) {
         return 0;
     }
     TextReplacementRule *rule = &rules[index];
-    free(rule->pattern);
-    if(rule->compiled) {
-        regfree(&rule->regex);
-    }
-    
+    rule_string_free(rule, rule->pattern);
     rule->pattern = strdup(new_pattern);
-    if(strlen(new_pattern) > 0) {
-        rule->compiled = regcomp(&rule->regex, new_pattern, REG_EXTENDED) == 0;
-    } else {
-        rule->compiled = 0;
+    return rule_recompile(index);
+}
+
+int rule_update_flags(size_t index, unsigned int flags) {
+    if(index >= nrules) {
+        return 0;
     }
-    
-    return rule->compiled;
+    rules[index].flags = flags;
+    return rule_recompile(index);
 }
 
 void rule_update_replacement(size_t index, char *new_replacement) {
@@ -301,8 +1544,16 @@ void rule_update_replacement(size_t index, char *new_replacement) {
         return;
     }
     TextReplacementRule *rule = &rules[index];
-    free(rule->replacement);
+    rule_string_free(rule, rule->replacement);
     rule->replacement = strdup(new_replacement);
+    
+    // the number of capture groups is known from the compiled pattern,
+    // therefore the template can only be parsed for compiled rules
+    if(rule->regex) {
+        template_free(&rule->template);
+        template_compile(&rule->template, rule->replacement, rule->regex->nsub);
+    }
+    rules_generation++;
 }
 
 void rule_remove(size_t index) {
@@ -311,16 +1562,20 @@ void rule_remove(size_t index) {
         return;
     }
     TextReplacementRule *r = &rules[index];
-    free(r->pattern);
-    free(r->replacement);
-    if(r->compiled) {
-        regfree(&r->regex);
+    rule_string_free(r, r->pattern);
+    rule_string_free(r, r->replacement);
+    rule_strings_release(r);
+    rule_free_compiled(r);
+    if(r->compile_lazy) {
+        rules_lazy--;
     }
     
     if(index+1 < nrules) {
         memmove(rules+index, rules+index+1, (nrules-index-1)*sizeof(TextReplacementRule));
     }
     nrules--;
+    trigram_index_remove(&rules_index, index);
+    rules_changed();
 }
 
 void rule_move_up(size_t index) {
@@ -330,6 +1585,8 @@ void rule_move_up(size_t index) {
     TextReplacementRule tmp = rules[index-1];
     rules[index-1] = rules[index];
     rules[index] = tmp;
+    trigram_index_swap(&rules_index, index-1, index);
+    rules_changed();
 }
 
 void rule_move_down(size_t index) {
@@ -339,25 +1596,65 @@ void rule_move_down(size_t index) {
     TextReplacementRule tmp = rules[index+1];
     rules[index+1] = rules[index];
     rules[index] = tmp;
+    trigram_index_swap(&rules_index, index, index+1);
+    rules_changed();
 }
 
 int save_rules(void) {
     char *path = rules_file_path();
     FILE *out = fopen(path, "w");
-    free(path);
     if(!out) {
+        free(path);
         return 1;
     }
     
-    fputs("?v1\n", out);
+    // older versions can still read the file, if no flags are used
+    int version = 1;
+    for(size_t i=0;i<nrules;i++) {
+        if(rules[i].flags) {
+            version = 2;
+        }
+    }
+    
+    fprintf(out, "?v%d", version);
+    if(rules_options.engine != REGEX_ENGINE_POSIX) {
+        fprintf(out, " engine=%s", regex_engine_name(rules_options.engine));
+    }
+    if(rules_options.time_limit != RULES_DEFAULT_TIME_LIMIT) {
+        fprintf(out, " time_limit=%u", rules_options.time_limit);
+    }
+    if(rules_options.step_limit != RULES_DEFAULT_STEP_LIMIT) {
+        fprintf(out, " step_limit=%zu", rules_options.step_limit);
+    }
+    if(rules_options.message_limit != RULES_DEFAULT_MESSAGE_LIMIT) {
+        fprintf(out, " message_limit=%u", rules_options.message_limit);
+    }
+    if(rules_options.strict) {
+        fputs(" strict=1", out);
+    }
+    if(rules_options.lazy) {
+        fputs(" lazy=1", out);
+    }
+    if(rules_options.warmup) {
+        fputs(" warmup=1", out);
+    }
+    fputs("\n", out);
     for(int i=0;i<nrules;i++) {
         TextReplacementRule *rule = &rules[i];
         if(rule->pattern && strlen(rule->pattern) > 0) {
+            if(version >= 2) {
+                char flags[8];
+                rule_flags_format(rule->flags, flags);
+                fprintf(out, "%s\t", flags);
+            }
             fprintf(out, "%s\t%s\n", rule->pattern, rule->replacement);
         }
     }
     
     fclose(out);
+    // the watch must not reload the rules, that were just saved
+    rules_file_remember(path);
+    free(path);
     return 0;
 }
 
@@ -365,16 +1662,19 @@ size_t add_empty_rule(void) {
     nrules++;
     rules = realloc(rules, nrules * sizeof(TextReplacementRule));
     memset(&rules[nrules-1], 0, sizeof(TextReplacementRule));
+    rules[nrules-1].engine = rules_options.engine;
+    rules[nrules-1].id = ++rule_last_id;
+    trigram_index_append(&rules_index, NULL, 0, 0);
+    rules_changed();
     return nrules;
 }
 
 void free_rules(TextReplacementRule *rules, size_t nelm) {
     for(size_t i=0;i<nelm;i++) {
-        free(rules[i].pattern);
-        free(rules[i].replacement);
-        if(rules[i].compiled) {
-            regfree(&rules[i].regex);
-        }
+        rule_string_free(&rules[i], rules[i].pattern);
+        rule_string_free(&rules[i], rules[i].replacement);
+        rule_strings_release(&rules[i]);
+        rule_free_compiled(&rules[i]);
     }
     free(rules);
 }
@@ -444,91 +1744,852 @@ char* str_unescape_and_replace(
     return newstr;
 }
 
+void template_compile(
+        ReplacementTemplate *t,
+        const char *replacement,
+        size_t nsub)
+{
+    size_t len = strlen(replacement);
+    // the unescaped text is never longer than the replacement and there are
+    // at most len/2 group references, separating len/2+1 literals
+    t->text = malloc(len + 1);
+    t->segments = calloc(len + 1, sizeof(ReplacementSegment));
+    t->nsegments = 0;
+    t->max_group = -1;
+    t->mapped = 0;
+    
+    size_t pos = 0;
+    size_t literal_start = 0;
+    for(size_t i=0;i<len;i++) {
+        char c = replacement[i];
+        if(c == '\\' && i+1 < len) {
+            c = replacement[++i];
+            switch(c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+            }
+        } else if(c == '$' && i+1 < len && isdigit((unsigned char)replacement[i+1])) {
+            int group = replacement[i+1] - '0';
+            if(group <= nsub && group <= RULE_MAX_GROUPS) {
+                // end the current literal segment and add a group reference
+                if(pos > literal_start) {
+                    ReplacementSegment *seg = &t->segments[t->nsegments++];
+                    seg->group = -1;
+                    seg->offset = literal_start;
+                    seg->length = pos - literal_start;
+                }
+                ReplacementSegment *seg = &t->segments[t->nsegments++];
+                seg->group = group;
+                seg->offset = 0;
+                seg->length = 0;
+                if(group > t->max_group) {
+                    t->max_group = group;
+                }
+                literal_start = pos;
+                i++;
+                continue;
+            }
+        }
+        t->text[pos++] = c;
+    }
+    t->text[pos] = '\0';
+    
+    if(pos > literal_start) {
+        ReplacementSegment *seg = &t->segments[t->nsegments++];
+        seg->group = -1;
+        seg->offset = literal_start;
+        seg->length = pos - literal_start;
+    }
+}
+
+void template_free(ReplacementTemplate *t) {
+    if(!t->mapped) {
+        free(t->text);
+        free(t->segments);
+    }
+    t->text = NULL;
+    t->segments = NULL;
+    t->nsegments = 0;
+    t->max_group = -1;
+    t->mapped = 0;
+}
+
+size_t template_length(
+        const ReplacementTemplate *t,
+        const regmatch_t *matches)
+{
+    size_t len = 0;
+    for(size_t i=0;i<t->nsegments;i++) {
+        const ReplacementSegment *seg = &t->segments[i];
+        if(seg->group < 0) {
+            len += seg->length;
+        } else if(matches[seg->group].rm_so >= 0) {
+            len += matches[seg->group].rm_eo - matches[seg->group].rm_so;
+        }
+    }
+    return len;
+}
+
+size_t template_expand(
+        const ReplacementTemplate *t,
+        const char *str,
+        const regmatch_t *matches,
+        char *out)
+{
+    size_t pos = 0;
+    for(size_t i=0;i<t->nsegments;i++) {
+        const ReplacementSegment *seg = &t->segments[i];
+        if(seg->group < 0) {
+            memcpy(out + pos, t->text + seg->offset, seg->length);
+            pos += seg->length;
+        } else if(matches[seg->group].rm_so >= 0) {
+            // unmatched optional groups are replaced with an empty string
+            const regmatch_t *m = &matches[seg->group];
+            size_t cg_len = m->rm_eo - m->rm_so;
+            memcpy(out + pos, str + m->rm_so, cg_len);
+            pos += cg_len;
+        }
+    }
+    return pos;
+}
+
+void apply_budget_init(
+        ApplyBudget *budget,
+        unsigned int time_limit,
+        size_t step_limit)
+{
+    budget->deadline = time_limit > 0 ? g_get_monotonic_time() + (gint64)time_limit * 1000 : 0;
+    budget->steps = step_limit;
+    budget->has_step_limit = step_limit > 0;
+    budget->exceeded = 0;
+}
+
+void apply_budget_init_rule(
+        ApplyBudget *budget,
+        unsigned int time_limit,
+        size_t step_limit,
+        size_t len)
+{
+    budget->deadline = 0;
+    if(time_limit > 0) {
+        gint64 usec = (gint64)time_limit * 1000 + (gint64)len * RULE_BUDGET_NS_PER_BYTE / 1000;
+        budget->deadline = g_get_monotonic_time() + usec;
+    }
+    budget->steps = step_limit > 0 ? step_limit + len * RULE_BUDGET_STEPS_PER_BYTE : 0;
+    budget->has_step_limit = step_limit > 0;
+    budget->exceeded = 0;
+}
+
+int apply_budget_step(ApplyBudget *budget) {
+    if(budget->exceeded) {
+        return 1;
+    }
+    if(budget->has_step_limit) {
+        if(budget->steps == 0) {
+            budget->exceeded = 1;
+            return 1;
+        }
+        budget->steps--;
+    }
+    if(budget->deadline > 0 && g_get_monotonic_time() > budget->deadline) {
+        budget->exceeded = 1;
+    }
+    return budget->exceeded;
+}
+
 char* apply_rule(char *msg_in, TextReplacementRule *rule) {
-    size_t len = strlen(msg_in);
-    char *in = msg_in;
-    char *end = in+len;
+    size_t outlen;
+    return apply_rule_n(msg_in, strlen(msg_in), rule, NULL, &outlen);
+}
+
+void match_spans_init(MatchSpanList *list) {
+    memset(list, 0, sizeof(MatchSpanList));
+}
+
+void match_spans_free(MatchSpanList *list) {
+    free(list->spans);
+    free(list->groups);
+    memset(list, 0, sizeof(MatchSpanList));
+}
+
+static void match_spans_add(
+        MatchSpanList *list,
+        const regmatch_t *matches,
+        size_t length)
+{
+    if(list->nspans == list->alloc) {
+        list->alloc = list->alloc ? list->alloc * 2 : 16;
+        list->spans = realloc(list->spans, list->alloc * sizeof(MatchSpan));
+        heap_allocs++;
+    }
+    if(list->nspans * list->nmatch + list->nmatch > list->groups_alloc) {
+        list->groups_alloc = list->alloc * list->nmatch;
+        list->groups = realloc(list->groups, list->groups_alloc * sizeof(regmatch_t));
+        heap_allocs++;
+    }
+    MatchSpan *span = &list->spans[list->nspans];
+    span->start = matches[0].rm_so;
+    span->end = matches[0].rm_eo;
+    span->length = length;
+    memcpy(list->groups + list->nspans * list->nmatch, matches, list->nmatch * sizeof(regmatch_t));
+    list->nspans++;
+    list->outlen = list->outlen - (span->end - span->start) + length;
+}
+
+/*
+ * returns the length of the replacement of a match
+ * the replacements of dictionary rules are taken from the dictionary,
+ * the replacements of all other rules are expanded from the template
+ */
+static size_t rule_replacement_length(
+        TextReplacementRule *rule,
+        const char *str,
+        const regmatch_t *matches)
+{
+    if(rule->regex->type == REGEX_ENGINE_DICTIONARY) {
+        size_t len = 0;
+        regex_dictionary_replacement(
+                rule->regex,
+                str + matches[0].rm_so,
+                matches[0].rm_eo - matches[0].rm_so,
+                &len);
+        return len;
+    }
+    return template_length(&rule->template, matches);
+}
+
+/*
+ * writes the replacement of a match to out
+ * returns the number of written bytes
+ */
+static size_t rule_replacement_expand(
+        TextReplacementRule *rule,
+        const char *str,
+        const regmatch_t *matches,
+        char *out)
+{
+    if(rule->regex->type == REGEX_ENGINE_DICTIONARY) {
+        size_t len = 0;
+        const char *replacement = regex_dictionary_replacement(
+                rule->regex,
+                str + matches[0].rm_so,
+                matches[0].rm_eo - matches[0].rm_so,
+                &len);
+        memcpy(out, replacement, len);
+        return len;
+    }
+    return template_expand(&rule->template, str, matches, out);
+}
+
+int rule_match_spans(
+        TextReplacementRule *rule,
+        const char *str,
+        size_t len,
+        ApplyBudget *budget,
+        MatchSpanList *list)
+{
+    const char *in = str;
+    const char *end = in+len;
+    
+    // only request the capture groups, that are used by the template
+    // nmatch = 1 is the cheapest regexec path, that still returns the
+    // position of the match
+    list->nmatch = rule->template.max_group > 0 ? rule->template.max_group + 1 : 1;
+    list->nspans = 0;
+    list->outlen = len;
     
     // find all occurences of the pattern
-    size_t alloc = 0;
-    size_t pos = 0;
-    char *newstr = NULL;
-    while(in < end) {
-        regmatch_t matches[2];
-        int ret = regexec(&rule->regex, in, 2, matches, 0);
+    const char *prev_end = NULL;
+    while(in <= end) {
+        // prefilter: search the required literal before running the regex
+        size_t skip = 0;
+        if(rule->literal) {
+            const char *lit = regex_literal_find(
+                    in,
+                    end - in,
+                    rule->literal,
+                    rule->literal_len,
+                    rule->literal_icase);
+            if(!lit) {
+                rule->prefilter_skips++;
+                break;
+            }
+            rule->prefilter_hits++;
+            if(rule->literal_prefix) {
+                // no match can start before the literal
+                skip = lit - in;
+            }
+        }
+        
+        if(budget && apply_budget_step(budget)) {
+            // abandon the rule for this message
+            list->nspans = 0;
+            list->outlen = len;
+            return 0;
+        }
+        
+        // search the remaining message in the original buffer, the
+        // preceding text is the context for ^, therefore ^ only matches at
+        // the beginning of the message
+        regmatch_t matches[RULE_MAX_GROUPS+1];
+        matches[0].rm_so = in + skip - str;
+        matches[0].rm_eo = len;
+        int ret = regex_exec(rule->regex, str, list->nmatch, matches, REG_STARTEND);
+        if(ret == REGEX_ELIMIT) {
+            // the engine stopped a runaway search, this counts like an
+            // exceeded budget
+            if(budget) {
+                budget->exceeded = 1;
+            }
+            list->nspans = 0;
+            list->outlen = len;
+            return 0;
+        }
         if(ret) {
             break;
         }
         
+        // an empty match directly behind the previous match is not
+        // replaced, same as in sed
+        const char *match_start = str + matches[0].rm_so;
+        const char *match_end = str + matches[0].rm_eo;
+        int empty = match_start == match_end;
+        if(!empty || match_start != prev_end) {
+            match_spans_add(list, matches, rule_replacement_length(rule, str, matches));
+        }
+        
+        in = match_end;
+        prev_end = in;
+        
+        if(empty) {
+            // empty match: continue behind the next character
+            if(in == end) {
+                break;
+            }
+            size_t charlen = 1;
+            while(in + charlen < end && (in[charlen] & 0xC0) == 0x80 && charlen < 4) {
+                charlen++;
+            }
+            in += charlen;
+        }
+    }
+    
+    return list->nspans > 0;
+}
+
+void rule_expand_spans(
+        TextReplacementRule *rule,
+        const char *str,
+        size_t len,
+        const MatchSpanList *list,
+        char *out)
+{
+    size_t pos = 0;
+    size_t in = 0;
+    for(size_t i=0;i<list->nspans;i++) {
+        const MatchSpan *span = &list->spans[i];
         // add anything before the match
-        size_t cplen = matches[0].rm_so;
-        if(cplen >= alloc) {
-            alloc += cplen + 1024;
-            newstr = g_realloc(newstr, alloc);
+        memcpy(out + pos, str + in, span->start - in);
+        pos += span->start - in;
+        // replace the match with the expanded template
+        pos += rule_replacement_expand(rule, str, list->groups + i * list->nmatch, out + pos);
+        in = span->end;
+    }
+    memcpy(out + pos, str + in, len - in);
+    pos += len - in;
+    out[pos] = 0;
+}
+
+char* apply_rule_n(
+        char *msg_in,
+        size_t len,
+        TextReplacementRule *rule,
+        ApplyBudget *budget,
+        size_t *outlen)
+{
+    MatchSpanList spans;
+    match_spans_init(&spans);
+    *outlen = len;
+    if(!rule_match_spans(rule, msg_in, len, budget, &spans)) {
+        // if no match was found, we can return the original msg ptr
+        match_spans_free(&spans);
+        return msg_in;
+    }
+    
+    // the exact size of the result is known after the first pass
+    char *newstr = g_malloc(spans.outlen + 1);
+    rule_expand_spans(rule, msg_in, len, &spans, newstr);
+    *outlen = spans.outlen;
+    match_spans_free(&spans);
+    g_free(msg_in);
+    return newstr;
+}
+
+const char* rule_status(TextReplacementRule *rule) {
+    if(!rule->pattern || strlen(rule->pattern) == 0 || (rule->flags & RULE_FLAG_DISABLED)) {
+        return NULL;
+    }
+    if(rule->compile_pending) {
+        return "compiling";
+    }
+    if(rule->compile_lazy) {
+        return "not compiled yet";
+    }
+    if(!rule->regex) {
+        return "invalid pattern";
+    }
+    if(rule->disabled) {
+        return "disabled: too slow";
+    }
+    return NULL;
+}
+
+/*
+ * counts a budget overrun and disables the rule after RULE_MAX_OVERRUNS
+ * the budget grows with the message length, an overrun means, that the
+ * rule needs much more time per byte than other rules
+ */
+static void rule_overrun(TextReplacementRule *rule) {
+    rule->overruns++;
+    fprintf(stderr, "regex-text-replacement: rule %s exceeded the execution budget\n", rule->pattern);
+    if(rule->overruns >= RULE_MAX_OVERRUNS && !rule->disabled) {
+        rule->disabled = 1;
+        fprintf(stderr, "regex-text-replacement: rule %s disabled\n", rule->pattern);
+        ui_rules_status_changed();
+    }
+}
+
+unsigned long apply_heap_allocs(void) {
+    return heap_allocs + message_state.pieces.heap_allocs + message_state.arena.heap_allocs;
+}
+
+void apply_all_rules(char **msg) {
+    size_t len = strlen(*msg);
+    apply_all_rules_n(msg, &len);
+}
+
+void apply_state_init(ApplyState *state) {
+    memset(state, 0, sizeof(ApplyState));
+}
+
+void apply_state_free(ApplyState *state) {
+    piece_table_free(&state->pieces);
+    arena_free(&state->arena);
+    free(state->edits);
+    match_spans_free(&state->spans);
+    memset(state, 0, sizeof(ApplyState));
+}
+
+static PieceEdit* state_edit_add(ApplyState *state, size_t *nedits) {
+    if(*nedits == state->edits_alloc) {
+        state->edits_alloc = state->edits_alloc ? state->edits_alloc * 2 : 16;
+        state->edits = realloc(state->edits, state->edits_alloc * sizeof(PieceEdit));
+        heap_allocs++;
+    }
+    return &state->edits[(*nedits)++];
+}
+
+/*
+ * searches all occurrences of the pattern of a literal_only rule in the
+ * message pieces and returns the number of edits
+ */
+static size_t rule_find_literal_edits(
+        ApplyState *state,
+        TextReplacementRule *rule,
+        ApplyBudget *budget)
+{
+    size_t nedits = 0;
+    const char *replacement = NULL;
+    size_t replacement_len = 0;
+    size_t pos = 0;
+    for(;;) {
+        if(apply_budget_step(budget)) {
+            return 0;
+        }
+        size_t found;
+        if(!piece_table_find(&state->pieces, rule->literal, rule->literal_len, pos, &found)) {
+            break;
+        }
+        if(!replacement) {
+            // every match is the same string, expand the template once
+            regmatch_t match;
+            match.rm_so = 0;
+            match.rm_eo = rule->literal_len;
+            replacement_len = template_length(&rule->template, &match);
+            char *buf = arena_alloc(&state->arena, replacement_len);
+            template_expand(&rule->template, rule->literal, &match, buf);
+            replacement = buf;
+        }
+        PieceEdit *edit = state_edit_add(state, &nedits);
+        edit->start = found;
+        edit->end = found + rule->literal_len;
+        edit->data = replacement;
+        edit->len = replacement_len;
+        pos = edit->end;
+    }
+    return nedits;
+}
+
+/*
+ * runs the regex of a rule on the message and returns the number of edits
+ */
+static size_t rule_find_regex_edits(
+        ApplyState *state,
+        TextReplacementRule *rule,
+        ApplyBudget *budget)
+{
+    size_t found;
+    if(rule->literal && !rule->literal_icase && state->pieces.npieces > 1 && !piece_table_find(
+            &state->pieces,
+            rule->literal,
+            rule->literal_len,
+            0,
+            &found))
+    {
+        // skip the rule without building a contiguous copy of the message
+        rule->prefilter_skips++;
+        return 0;
+    }
+    
+    const char *text = piece_table_text(&state->pieces);
+    if(!rule_match_spans(rule, text, state->pieces.len, budget, &state->spans)) {
+        return 0;
+    }
+    
+    // the replacements are expanded to the arena, because the contiguous
+    // copy of the message is overwritten after the next edit
+    size_t nedits = 0;
+    for(size_t i=0;i<state->spans.nspans;i++) {
+        const MatchSpan *span = &state->spans.spans[i];
+        char *buf = arena_alloc(&state->arena, span->length);
+        rule_replacement_expand(
+                rule,
+                text,
+                state->spans.groups + i * state->spans.nmatch,
+                buf);
+        PieceEdit *edit = state_edit_add(state, &nedits);
+        edit->start = span->start;
+        edit->end = span->end;
+        edit->data = buf;
+        edit->len = span->length;
+    }
+    return nedits;
+}
+
+/*
+ * starts the message deadline of the state
+ */
+static void apply_state_start(ApplyState *state, const RulesFileOptions *options) {
+    state->deadline = 0;
+    if(options->message_limit > 0) {
+        state->deadline = g_get_monotonic_time() + (gint64)options->message_limit * 1000;
+    }
+    state->expired = 0;
+}
+
+size_t apply_state_rule(
+        ApplyState *state,
+        TextReplacementRule *rule,
+        const RulesFileOptions *options)
+{
+    if(!rule->regex || rule->disabled || state->expired) {
+        return 0;
+    }
+    ApplyBudget budget;
+    apply_budget_init_rule(&budget, options->time_limit, options->step_limit, state->pieces.len);
+    gint64 rule_deadline = budget.deadline;
+    if(state->deadline > 0 && (budget.deadline == 0 || state->deadline < budget.deadline)) {
+        budget.deadline = state->deadline;
+    }
+    size_t nedits = rule->literal_only ?
+            rule_find_literal_edits(state, rule, &budget) :
+            rule_find_regex_edits(state, rule, &budget);
+    if(budget.exceeded) {
+        gint64 now = g_get_monotonic_time();
+        if(state->deadline > 0 && now > state->deadline) {
+            state->expired = 1;
+            fprintf(stderr, "regex-text-replacement: message limit reached, skipping the remaining rules\n");
         }
-        if(cplen > 0) {
-            memcpy(newstr+pos, in, cplen);
-            pos += cplen;
+        // only a rule, that exceeded its own budget or an engine limit,
+        // counts towards disabling it, the following rules are applied to
+        // the message
+        int steps_exceeded = budget.has_step_limit && budget.steps == 0;
+        if(!state->expired || steps_exceeded || (rule_deadline > 0 && now > rule_deadline)) {
+            rule_overrun(rule);
+        }
+        return 0;
+    }
+    if(nedits > 0) {
+        piece_table_splice(&state->pieces, state->edits, nedits);
+    }
+    return nedits;
+}
+
+int apply_rules(
+        ApplyState *state,
+        TextReplacementRule *rules,
+        size_t nrules,
+        const RulesFileOptions *options,
+        const char *msg,
+        size_t len)
+{
+    // the replacements of the previous message are not used anymore
+    arena_reset(&state->arena);
+    piece_table_reset(&state->pieces, msg, len);
+    apply_state_start(state, options);
+    int changed = 0;
+    for(size_t i=0;i<nrules && !state->expired;i++) {
+        if(apply_state_rule(state, &rules[i], options) > 0) {
+            changed = 1;
         }
+    }
+    return changed;
+}
+
+/*
+ * adds the trigram index candidates for the text around the edits
+ * 
+ * Trigrams, that don't overlap with a replacement, were already part of
+ * the message before the edits.
+ */
+static void rules_index_add_edits(size_t nedits, size_t from) {
+    ssize_t shift = 0;
+    for(size_t i=0;i<nedits;i++) {
+        const PieceEdit *edit = &message_state.edits[i];
+        size_t start = edit->start + shift;
+        size_t end = start + edit->len;
+        shift += (ssize_t)edit->len - (ssize_t)(edit->end - edit->start);
         
-        // replace matches[0] with replacement
-        // if a capture group exists, adjust the replacement
-        char *rpl = rule->replacement;
-        if(matches[1].rm_so >= 0) {
-            size_t cg_len = matches[1].rm_eo - matches[1].rm_so;
-            char *capture_group = malloc(cg_len + 1);
-            memcpy(capture_group, in+matches[1].rm_so, cg_len);
-            capture_group[cg_len] = 0;
-            rpl = str_unescape_and_replace(rule->replacement, "$1", capture_group);
-            free(capture_group);
-        }
-        size_t rpl_len = strlen(rpl);
+        start = start >= 2 ? start - 2 : 0;
+        end = end + 2 < message_state.pieces.len ? end + 2 : message_state.pieces.len;
+        char *window = arena_alloc(&message_state.arena, end - start);
+        piece_table_copy(&message_state.pieces, start, end, window);
+        trigram_index_add(&rules_index, window, end - start, from);
+    }
+}
+
+static void literal_groups_free(void) {
+    for(size_t i=0;i<nliteral_groups;i++) {
+        aho_corasick_free(&literal_groups[i].ac);
+    }
+    free(literal_groups);
+    free(literal_group_of);
+    free(literal_hits);
+    literal_groups = NULL;
+    nliteral_groups = 0;
+    literal_group_of = NULL;
+    literal_hits = NULL;
+    literal_groups_valid = 0;
+}
+
+/*
+ * groups runs of consecutive literal_only rules
+ */
+static void literal_groups_build(void) {
+    literal_groups_free();
+    literal_groups_generation = rules_generation;
+    literal_groups_valid = 1;
+    if(nrules == 0) {
+        return;
+    }
+    literal_group_of = malloc(nrules * sizeof(int32_t));
+    literal_hits = malloc(nrules);
+    size_t alloc = 0;
+    for(size_t i=0;i<nrules;) {
+        size_t n = 0;
+        while(i + n < nrules
+                && rules[i+n].regex
+                && rules[i+n].literal_only
+                && rules[i+n].literal_len > 0)
+        {
+            n++;
+        }
+        if(n < RULES_LITERAL_GROUP_MIN) {
+            // a single literal is searched faster without the automaton
+            literal_group_of[i] = -1;
+            i++;
+            continue;
+        }
         
-        if(pos + rpl_len >= alloc) {
-            alloc += rpl_len + 1024;
-            newstr = g_realloc(newstr, alloc);
+        if(nliteral_groups == alloc) {
+            alloc = alloc ? alloc * 2 : 8;
+            literal_groups = realloc(literal_groups, alloc * sizeof(LiteralGroup));
         }
-        memcpy(newstr + pos, rpl, rpl_len);
-        pos += rpl_len;
-        if(rpl != rule->replacement) {
-            free(rpl); // rpl was allocated by str_replace
+        LiteralGroup *g = &literal_groups[nliteral_groups];
+        g->first = i;
+        g->last = i + n;
+        aho_corasick_init(&g->ac);
+        for(size_t r=g->first;r<g->last;r++) {
+            aho_corasick_add(&g->ac, rules[r].literal, rules[r].literal_len);
+            literal_group_of[r] = nliteral_groups;
         }
+        aho_corasick_build(&g->ac);
+        nliteral_groups++;
+        i += n;
+    }
+}
+
+/*
+ * searches the literals of all rules of the group in the message
+ */
+static void literal_group_scan(LiteralGroup *g) {
+    memset(literal_hits, 0, g->last - g->first);
+    uint32_t state = 0;
+    for(size_t k=0;k<message_state.pieces.npieces;k++) {
+        const Piece *p = &message_state.pieces.pieces[k];
+        state = aho_corasick_scan(&g->ac, state, p->data, p->len, literal_hits);
+    }
+}
+
+/*
+ * adds the literals of the group, that occur in the text around the
+ * edits, to the literal hits
+ * 
+ * Occurrences, that don't overlap with a replacement, were already part
+ * of the message before the edits.
+ */
+static void literal_group_add_edits(LiteralGroup *g, size_t nedits) {
+    size_t margin = g->ac.max_len - 1;
+    ssize_t shift = 0;
+    for(size_t i=0;i<nedits;i++) {
+        const PieceEdit *edit = &message_state.edits[i];
+        size_t start = edit->start + shift;
+        size_t end = start + edit->len;
+        shift += (ssize_t)edit->len - (ssize_t)(edit->end - edit->start);
         
-        in = in + matches[0].rm_eo;
+        start = start >= margin ? start - margin : 0;
+        end = end + margin < message_state.pieces.len ? end + margin : message_state.pieces.len;
+        char *window = arena_alloc(&message_state.arena, end - start);
+        piece_table_copy(&message_state.pieces, start, end, window);
+        aho_corasick_scan(&g->ac, 0, window, end - start, literal_hits);
     }
-    
-    // if no match was found, we can return the original msg ptr
-    if(!newstr) {
-        return msg_in;
+}
+
+/*
+ * returns 1, if the required literal of a lazy rule is contained in the
+ * message, or if the rule has no required literal
+ */
+static int lazy_rule_may_match(TextReplacementRule *rule) {
+    size_t pos;
+    if(!rule->literal) {
+        return 1;
+    }
+    if(rule->literal_icase) {
+        const char *text = piece_table_text(&message_state.pieces);
+        if(regex_literal_find(text, message_state.pieces.len, rule->literal, rule->literal_len, 1)) {
+            return 1;
+        }
+    } else if(piece_table_find(&message_state.pieces, rule->literal, rule->literal_len, 0, &pos)) {
+        return 1;
+    }
+    rule->prefilter_skips++;
+    return 0;
+}
+
+/*
+ * applies all rules to msg and returns the result or NULL, if no rule
+ * changed the message
+ * the result is allocated with g_malloc, outlen is set to its length
+ */
+static char* apply_all_rules_result(const char *msg, size_t msglen, size_t *outlen) {
+    if(rules_options.strict && compile_worker_pending() > 0) {
+        // strict mode: don't skip rules, that are not compiled yet
+        compile_worker_wait();
     }
     
-    // add remaining str
-    size_t remaining = end - in;
-    if(pos + remaining >= alloc) {
-        alloc += remaining + 1;
-        newstr = g_realloc(newstr, alloc);
+    // the rules only replace pieces of the message, the result is
+    // copied to a g_malloc'd string after the last rule
+    piece_table_reset(&message_state.pieces, msg, msglen);
+    apply_state_start(&message_state, &rules_options);
+    int changed = 0;
+    
+    // if the union doesn't match, only rules, that are not part of the
+    // union, need to be applied
+    // the union is computed when the first union member is reached and
+    // again after the message was changed (-1: unknown)
+    int union_match = -1;
+    
+    // for large rule sets, only rules with a trigram, that is contained
+    // in the message, are tried
+    int use_index = nrules >= TRIGRAM_INDEX_MIN_RULES && rules_index.nrules == nrules;
+    if(use_index) {
+        trigram_index_match(&rules_index, msg, msglen, 0);
     }
-    if(remaining > 0) {
-        memcpy(newstr+pos, in, remaining);
-        pos += remaining;
+    
+    // consecutive literal rules are searched with one scan per group
+    if(!literal_groups_valid || literal_groups_generation != rules_generation) {
+        literal_groups_build();
     }
+    int32_t current_group = -1;
     
-    if(pos >= alloc) {
-        alloc++;
-        newstr = g_realloc(newstr, alloc);
+    size_t i = use_index ? trigram_index_next(&rules_index, 0) : 0;
+    while(i < nrules && !message_state.expired) {
+        TextReplacementRule *rule = &rules[i];
+        if(rule->compile_lazy && lazy_rule_may_match(rule)) {
+            rule_compile_deferred(i);
+            // the union could be changed
+            union_match = -1;
+        }
+        int32_t group = literal_group_of ? literal_group_of[i] : -1;
+        int literal_miss = 0;
+        if(group >= 0 && rule->regex && !rule->disabled) {
+            LiteralGroup *g = &literal_groups[group];
+            if(group != current_group) {
+                literal_group_scan(g);
+                current_group = group;
+            }
+            literal_miss = !literal_hits[i - g->first];
+            if(literal_miss) {
+                rule->prefilter_skips++;
+            }
+        }
+        // the automaton is an exact prefilter, the union is not needed for
+        // rules of a literal group
+        if(group < 0 && rule->regex && !rule->disabled && rule->union_member && union_match < 0) {
+            union_match = rule_union_match(
+                    &rules_union,
+                    piece_table_text(&message_state.pieces),
+                    message_state.pieces.len);
+        }
+        if(!literal_miss && (union_match || !rule->union_member || group >= 0)) {
+            size_t nedits = apply_state_rule(&message_state, rule, &rules_options);
+            if(nedits > 0) {
+                changed = 1;
+                
+                // later rules see the modified message, therefore the
+                // union result and candidates are not valid anymore
+                union_match = -1;
+                if(use_index) {
+                    rules_index_add_edits(nedits, i+1);
+                }
+                if(group >= 0 && i + 1 < literal_groups[group].last) {
+                    literal_group_add_edits(&literal_groups[group], nedits);
+                }
+            }
+        }
+        i = use_index ? trigram_index_next(&rules_index, i+1) : i+1;
     }
-    newstr[pos] = 0;
     
-    g_free(msg_in);
-    return newstr ? newstr : msg_in;
+    char *result = NULL;
+    if(changed) {
+        size_t len = message_state.pieces.len;
+        result = g_malloc(len + 1);
+        piece_table_copy(&message_state.pieces, 0, len, result);
+        result[len] = 0;
+        heap_allocs++;
+        *outlen = len;
+    }
+    arena_reset(&message_state.arena);
+    return result;
 }
 
-void apply_all_rules(char **msg) {
-    char *msg_in = *msg;
-    for(int i=0;i<nrules;i++) {
-        if(rules[i].compiled) {
-            msg_in = apply_rule(msg_in, &rules[i]);
-        }
+void apply_all_rules_n(char **msg, size_t *msglen) {
+    size_t len;
+    char *result = apply_all_rules_result(*msg, *msglen, &len);
+    if(result) {
+        g_free(*msg);
+        *msg = result;
+        *msglen = len;
     }
-    *msg = msg_in;
 }
@@ -24,6 +24,12 @@
 
 #include <regex.h>
 
+#include "regex-engine.h"
+#include "result-cache.h"
+#include "aho-corasick.h"
+#include "piece-table.h"
+#include "arena.h"
+
 /* libpurple includes */
 #include <notify.h>
 #include <plugin.h>
@@ -36,12 +42,150 @@
 
 #define REGEX_TEXT_REPLACEMENT_RULES_FILE "regex-text-replacement.rules"
 
+/*
+ * max number of capture groups, that can be referenced in a replacement ($0-$9)
+ */
+#define RULE_MAX_GROUPS 9
+
+/*
+ * max length of the combined pattern of all rules
+ * if the rules exceed this limit, no union matcher is used
+ */
+#define RULE_UNION_MAX_PATTERN 65536
+
+/*
+ * default execution budget of a rule for one message
+ * time limit in milliseconds and max number of regexec calls
+ */
+#define RULES_DEFAULT_TIME_LIMIT 100
+#define RULES_DEFAULT_STEP_LIMIT 100000
+
+/*
+ * default time limit in milliseconds for applying all rules to a message
+ */
+#define RULES_DEFAULT_MESSAGE_LIMIT 500
+
+/*
+ * the budget of a rule grows with the length of the message by this time
+ * in nanoseconds and this number of regexec calls per byte
+ * a rule needs at most one regexec call per byte, therefore only runaway
+ * rules exceed the budget of long messages
+ */
+#define RULE_BUDGET_NS_PER_BYTE 1000
+#define RULE_BUDGET_STEPS_PER_BYTE 1
+
+/*
+ * number of budget overruns, after which a rule is disabled
+ */
+#define RULE_MAX_OVERRUNS 3
+
+/*
+ * number of rules per background compile job
+ */
+#define RULES_COMPILE_BATCH 64
+
+/*
+ * number of lazy rules, that are compiled per idle callback
+ */
+#define RULES_WARMUP_BATCH 16
+
+/*
+ * min number of consecutive literal rules, that are searched with one
+ * Aho-Corasick automaton
+ */
+#define RULES_LITERAL_GROUP_MIN 2
+
+/*
+ * rule flags, stored in the flags column of ?v2 rules files
+ */
+
+/*
+ * l: the pattern is a plain string, that is matched without regex
+ */
+#define RULE_FLAG_LITERAL  0x1
+/*
+ * i: case-insensitive matching
+ */
+#define RULE_FLAG_ICASE    0x2
+/*
+ * w: only whole words are replaced
+ */
+#define RULE_FLAG_WORD     0x4
+/*
+ * d: the rule is not compiled and not applied, but kept in the file
+ */
+#define RULE_FLAG_DISABLED 0x8
+/*
+ * t: the pattern is the path of a dictionary file (dictionary.h), every
+ * word of the message, that is contained in the dictionary, is replaced
+ * relative paths are relative to the directory of the rules file
+ */
+#define RULE_FLAG_DICTIONARY 0x10
+
 #ifdef DEBUG
 #define DEBUG_PRINTF(...) printf( __VA_ARGS__ )
 #else
 #define DEBUG_PRINTF(...)
 #endif
 
+/*
+ * Part of a parsed replacement string
+ */
+typedef struct ReplacementSegment {
+    /*
+     * capture group index or -1, if the segment is literal text
+     */
+    int group;
+    /*
+     * position of literal text in ReplacementTemplate.text
+     */
+    size_t offset;
+    size_t length;
+} ReplacementSegment;
+
+/*
+ * Precompiled replacement string
+ * 
+ * The replacement is split into literal text and capture group references,
+ * so that a match can be expanded without parsing the replacement again.
+ */
+typedef struct ReplacementTemplate {
+    /*
+     * unescaped literal text of all segments
+     */
+    char *text;
+    
+    ReplacementSegment *segments;
+    size_t nsegments;
+    
+    /*
+     * highest referenced capture group or -1, if the replacement doesn't
+     * contain any group references
+     */
+    int max_group;
+    
+    /*
+     * text and segments are stored in a rules snapshot (rules-snapshot.h)
+     * and are not freed
+     */
+    int mapped;
+} ReplacementTemplate;
+
+/*
+ * Pattern and replacement strings of all rules of a rules file
+ * 
+ * The block is shared by the rules and freed, when the last rule, that
+ * references it, is freed.
+ */
+typedef struct RuleStrings {
+    /*
+     * number of rules, that reference the block
+     */
+    size_t refs;
+    size_t size;
+    char data[];
+} RuleStrings;
+
 typedef struct TextReplacementRule {
     /*
      * regex pattern
@@ -50,7 +194,7 @@ typedef struct TextReplacementRule {
     
     /*
      * replacement string
-     * If the string contains "$1", it is replaced with the first capture group
+     * $0 is replaced with the whole match and $1-$9 with the capture groups
      * Escaping rules:
      * \$: "$"
      * \t: <tab>
@@ -59,16 +203,325 @@ typedef struct TextReplacementRule {
     char *replacement;
     
     /*
-     * compiled regex
+     * regex engine used for this rule
      */
-    regex_t regex;
+    RegexEngineType engine;
     
     /*
-     * regex compiled successfully
+     * RULE_FLAG_* flags
      */
-    int compiled;
+    unsigned int flags;
+    
+    /*
+     * compiled regex or NULL, if the pattern is empty or couldn't be compiled
+     */
+    CompiledRegex *regex;
+    
+    /*
+     * parsed replacement string
+     * only valid, if the regex is compiled
+     */
+    ReplacementTemplate template;
+    
+    /*
+     * pattern is part of the union matcher
+     */
+    int union_member;
+    
+    /*
+     * literal string, that is part of every match of the pattern
+     * or NULL, if the pattern doesn't contain a required literal
+     * 
+     * regexec is only called, if the literal is found in the message
+     */
+    char *literal;
+    size_t literal_len;
+    
+    /*
+     * every match starts with the literal
+     */
+    int literal_prefix;
+    
+    /*
+     * the pattern is a plain string without any regex syntax
+     * 
+     * In apply_all_rules, matches of such rules are searched directly in
+     * the pieces of the message, without regexec and without building a
+     * contiguous copy of the message.
+     */
+    int literal_only;
+    
+    /*
+     * the literal is folded to lower case and must be searched
+     * case-insensitive (RULE_FLAG_ICASE)
+     */
+    int literal_icase;
+    
+    /*
+     * number of regexec calls after the literal was found
+     */
+    unsigned long prefilter_hits;
+    
+    /*
+     * number of regexec calls, that were skipped, because the literal
+     * was not found
+     */
+    unsigned long prefilter_skips;
+    
+    /*
+     * number of messages, for which the rule exceeded the execution budget
+     */
+    unsigned int overruns;
+    
+    /*
+     * rule was disabled after RULE_MAX_OVERRUNS budget overruns
+     * disabled rules are not applied, until the pattern is changed
+     */
+    int disabled;
+    
+    /*
+     * unique id of the rule
+     * a new id is assigned, whenever the pattern is changed
+     */
+    unsigned int id;
+    
+    /*
+     * the pattern is compiled in the background
+     * the rule is skipped, until the compiled regex is available
+     */
+    int compile_pending;
+    
+    /*
+     * the pattern is compiled, when the rule is used the first time
+     * the required literal is already available for the prefilter
+     */
+    int compile_lazy;
+    
+    /*
+     * string block of the rules file or NULL
+     * 
+     * pattern and replacement can be stored in this block. Changing
+     * them replaces the string with a separately allocated copy.
+     */
+    RuleStrings *strings;
 } TextReplacementRule;
 
+/*
+ * Combined regex of all rule patterns: (pattern0)|(pattern1)|...
+ * 
+ * If the union doesn't match a message, none of the member rules can match,
+ * and the message can be skipped with a single regexec call.
+ */
+typedef struct RuleUnion {
+    regex_t regex;
+    int compiled;
+} RuleUnion;
+
+/*
+ * Run of consecutive literal_only rules
+ * 
+ * apply_all_rules searches the literals of all rules of the group with one
+ * Aho-Corasick scan, when the first rule of the group is reached. Rules,
+ * whose literal was not found, are skipped. The rules are still applied
+ * one after another in the order of the rules array.
+ */
+typedef struct LiteralGroup {
+    /*
+     * rules first - last-1
+     * pattern i of the automaton is the literal of rule first+i
+     */
+    size_t first;
+    size_t last;
+    AhoCorasick ac;
+} LiteralGroup;
+
+/*
+ * Options from the rules file header line
+ * 
+ * Format:
+ * ?v<1|2> [engine=<posix|pcre2|dfa>] [time_limit=<ms>] [step_limit=<n>]
+ *     [message_limit=<ms>] [strict=<0|1>] [lazy=<0|1>] [warmup=<0|1>]
+ */
+typedef struct RulesFileOptions {
+    /*
+     * file format version
+     * 1: <pattern>\t<replacement>
+     * 2: <flags>\t<pattern>\t<replacement>
+     */
+    int version;
+    
+    /*
+     * engine for all rules in the file
+     */
+    RegexEngineType engine;
+    
+    /*
+     * max time in milliseconds for applying a rule to a message
+     * (+ RULE_BUDGET_NS_PER_BYTE per byte of the message)
+     * 0: no limit
+     */
+    unsigned int time_limit;
+    
+    /*
+     * max number of regexec calls for applying a rule to a message
+     * (+ RULE_BUDGET_STEPS_PER_BYTE per byte of the message)
+     * 0: no limit
+     */
+    size_t step_limit;
+    
+    /*
+     * max time in milliseconds for applying all rules to a message, the
+     * remaining rules are skipped after this time
+     * 0: no limit
+     */
+    unsigned int message_limit;
+    
+    /*
+     * 1: messages wait for rules, that are compiled in the background
+     * 0: such rules are skipped
+     */
+    int strict;
+    
+    /*
+     * 1: rules are compiled, when they are used the first time
+     */
+    int lazy;
+    
+    /*
+     * 1: lazy rules are compiled in small batches, when the main loop
+     * is idle
+     */
+    int warmup;
+} RulesFileOptions;
+
+/*
+ * Match of a rule, recorded by rule_match_spans
+ */
+typedef struct MatchSpan {
+    /*
+     * position of the match in the input string
+     */
+    size_t start;
+    size_t end;
+    
+    /*
+     * length of the expanded replacement
+     */
+    size_t length;
+} MatchSpan;
+
+/*
+ * All matches of a rule in a string
+ */
+typedef struct MatchSpanList {
+    MatchSpan *spans;
+    size_t nspans;
+    size_t alloc;
+    
+    /*
+     * capture groups of the spans, nmatch entries per span
+     */
+    regmatch_t *groups;
+    size_t groups_alloc;
+    size_t nmatch;
+    
+    /*
+     * length of the string after replacing all spans
+     */
+    size_t outlen;
+} MatchSpanList;
+
+/*
+ * Execution budget of a rule for one message
+ * 
+ * The budget is checked before every regexec call. A single regexec call
+ * is not interrupted, therefore the time limit is not a hard upper bound
+ * for POSIX and PCRE2 rules. Only patterns, that were detected as risky,
+ * use the linear-time DFA engine automatically.
+ */
+typedef struct ApplyBudget {
+    /*
+     * monotonic time (g_get_monotonic_time) after which the budget is
+     * exceeded or 0, if there is no time limit
+     */
+    gint64 deadline;
+    
+    /*
+     * remaining regexec calls, only used if has_step_limit is set
+     */
+    size_t steps;
+    int has_step_limit;
+    
+    /*
+     * set to 1, when the budget was exceeded
+     */
+    int exceeded;
+} ApplyBudget;
+
+/*
+ * Message state for applying rules
+ * 
+ * The message is a piece table of slices of the original message and of
+ * replacements stored in the arena. All buffers are kept across messages.
+ * apply_all_rules uses one state for the plugin, other users of the engine
+ * (rtr-rewrite-logs) need one state per thread.
+ */
+typedef struct ApplyState {
+    PieceTable pieces;
+    Arena arena;
+    
+    /*
+     * edits of the current rule
+     */
+    PieceEdit *edits;
+    size_t edits_alloc;
+    
+    /*
+     * match spans of the current rule
+     */
+    MatchSpanList spans;
+    
+    /*
+     * monotonic time, after which the remaining rules are skipped for the
+     * current message, or 0 (RulesFileOptions.message_limit)
+     */
+    gint64 deadline;
+    
+    /*
+     * set to 1, when the deadline of the current message was reached
+     */
+    int expired;
+} ApplyState;
+
+/*
+ * Loads the rules file and prepares the loaded rules for apply_all_rules
+ * returns 0 on success
+ */
+int rules_init(const char *file);
+
+/*
+ * compiles up to n lazy rules
+ * returns the number of rules, that are not compiled yet
+ */
+size_t rules_compile_lazy(size_t n);
+
+/*
+ * Loads the rules file again and replaces the current rules
+ * 
+ * The new rules are compiled and indexed, before they replace the
+ * current rules at once. Reloaded rules are never compiled lazily. If
+ * the file cannot be loaded or a pattern cannot be compiled, the current
+ * rules stay active.
+ * 
+ * returns 0 on success
+ */
+int rules_reload(const char *file);
+
+/*
+ * Frees all loaded rules and the matcher state
+ */
+void rules_cleanup(void);
+
 /*
  * returns path to ~/.purple/regex-text-replacement.rules
  * 
@@ -76,15 +529,46 @@ typedef struct TextReplacementRule {
  */
 char *rules_file_path(void);
 
+/*
+ * Initializes options with the default values
+ */
+void rules_options_default(RulesFileOptions *options);
+
+/*
+ * Parses the rules file header line
+ * returns 0 on success, 1 if the version or an option is unknown
+ */
+int parse_rules_header(const char *line, RulesFileOptions *options);
+
 /*
  * Loads text replacement rules from a rules definition file
  * 
  * Format:
- * # comment
+ * ?v1 [options]
  * <pattern>\t<replacement>
  * 
+ * ?v2 [options]
+ * <flags>\t<pattern>\t<replacement>
+ * 
+ * flags: any combination of l (literal), i (ignore case), w (whole word)
+ * and d (disabled) or - for no flags
+ * 
+ * options: if not NULL, the header options are stored in this struct
  */
-int load_rules(const char *file, TextReplacementRule **rules, size_t *len);
+int load_rules(
+        const char *file,
+        TextReplacementRule **rules,
+        size_t *len,
+        RulesFileOptions *options);
+
+/*
+ * Same as load_rules, but the rules are not compiled
+ */
+int parse_rules_file(
+        const char *file,
+        TextReplacementRule **rules,
+        size_t *len,
+        RulesFileOptions *options);
 
 /*
  * Frees a TextReplacementRule array, including all pattern and replacement
@@ -92,6 +576,95 @@ int load_rules(const char *file, TextReplacementRule **rules, size_t *len);
  */
 void free_rules(TextReplacementRule *rules, size_t nelm);
 
+/*
+ * Compiles the rule's pattern and parses the replacement template
+ * Relative dictionary paths are resolved against the directory of the
+ * current rules file, therefore only the main thread can use this function.
+ * returns 1 if the pattern was compiled successfully
+ */
+int rule_compile(TextReplacementRule *rule);
+
+/*
+ * Same as rule_compile, but relative dictionary paths are resolved against
+ * dir (NULL: current working directory)
+ */
+int rule_compile_dir(TextReplacementRule *rule, const char *dir);
+
+/*
+ * Moves the compiled regex, template and literal from src to dst
+ * dst must not have a compiled regex
+ */
+void rule_move_compiled(TextReplacementRule *dst, TextReplacementRule *src);
+
+/*
+ * Frees the compiled regex and the replacement template, but not the
+ * pattern and replacement strings
+ */
+void rule_free_compiled(TextReplacementRule *rule);
+
+/*
+ * Extracts the longest literal substring, that is part of every match of
+ * the extended regex pattern
+ * 
+ * returns a malloc'd string or NULL, if no required literal was found
+ * len: length of the literal
+ * prefix: set to 1, if every match starts with the literal
+ */
+char* pattern_required_literal(const char *pattern, size_t *len, int *prefix);
+
+/*
+ * Parses a replacement string
+ * 
+ * Group references $0-$nsub are replaced with the capture groups, all other
+ * $ characters are copied. Escape sequences are the same as in
+ * str_unescape_and_replace.
+ */
+void template_compile(
+        ReplacementTemplate *t,
+        const char *replacement,
+        size_t nsub);
+
+void template_free(ReplacementTemplate *t);
+
+/*
+ * returns the length of the expanded template for the matched string
+ */
+size_t template_length(
+        const ReplacementTemplate *t,
+        const regmatch_t *matches);
+
+/*
+ * writes the expanded template to out
+ * out must have space for at least template_length bytes
+ * 
+ * str: string that was passed to regexec
+ * returns the number of written bytes
+ */
+size_t template_expand(
+        const ReplacementTemplate *t,
+        const char *str,
+        const regmatch_t *matches,
+        char *out);
+
+/*
+ * Builds the union matcher from all compiled rules
+ * 
+ * Patterns, that can't be embedded in the union (back-references,
+ * unbalanced parentheses) are not members of the union and their
+ * union_member flag is set to 0.
+ * 
+ * returns 1 if the union was compiled
+ */
+int rule_union_build(RuleUnion *u, TextReplacementRule *rules, size_t nrules);
+
+/*
+ * returns 1 if any member rule of the union matches str with length len
+ * returns 1 if the union is not compiled
+ */
+int rule_union_match(RuleUnion *u, const char *str, size_t len);
+
+void rule_union_free(RuleUnion *u);
+
 /*
  * returns the array of loaded text replacement rules
  */
@@ -99,11 +672,23 @@ TextReplacementRule* get_rules(size_t *numelm);
 
 /*
  * replace the rule's pattern
- * returns 1 if the pattern was compiled successfully
+ * 
+ * If the compile worker is running, the pattern is compiled in the
+ * background and the rule is skipped until it is compiled.
+ * 
+ * returns 1 if the pattern was compiled successfully or is compiled
+ * in the background
  * returns 0 if the pattern couldn't be compiled
  */
 int rule_update_pattern(size_t index, char *new_pattern);
 
+/*
+ * changes the RULE_FLAG_* flags of the rule at the specified index and
+ * compiles the pattern again
+ * returns 0 if the pattern couldn't be compiled or the rule is disabled
+ */
+int rule_update_flags(size_t index, unsigned int flags);
+
 /*
  * replace the rule's text replacement at the specified index
  */
@@ -125,6 +710,9 @@ size_t add_empty_rule(void);
 
 /*
  * save loaded rules to ~/.purple/regex-text-replacement.rules 
+ * 
+ * The file is written in the ?v1 format, which can be read by older
+ * versions of the plugin, unless a rule has flags.
  */
 int save_rules(void);
 
@@ -146,9 +734,187 @@ char* str_unescape_and_replace(
  */
 char* apply_rule(char *msg_in, TextReplacementRule *rule);
 
+/*
+ * Same as apply_rule, but for a string with a known length
+ * 
+ * msg_in doesn't need to be terminated, the result is always terminated.
+ * outlen: set to the length of the result
+ * 
+ * The rule stops when the budget is exceeded. In this case
+ * budget->exceeded is set, the rule is not applied and msg_in is returned.
+ * budget can be NULL.
+ */
+char* apply_rule_n(
+        char *msg_in,
+        size_t len,
+        TextReplacementRule *rule,
+        ApplyBudget *budget,
+        size_t *outlen);
+
+/*
+ * Initializes a budget, that starts now
+ * time_limit: milliseconds, step_limit: regexec calls, 0: no limit
+ */
+void apply_budget_init(
+        ApplyBudget *budget,
+        unsigned int time_limit,
+        size_t step_limit);
+
+/*
+ * Initializes the budget of a rule for a message with the length len
+ * The limits of the rules file are increased by RULE_BUDGET_NS_PER_BYTE
+ * and RULE_BUDGET_STEPS_PER_BYTE per byte.
+ */
+void apply_budget_init_rule(
+        ApplyBudget *budget,
+        unsigned int time_limit,
+        size_t step_limit,
+        size_t len);
+
+/*
+ * Consumes one step from the budget
+ * returns 1 if the budget is exceeded
+ */
+int apply_budget_step(ApplyBudget *budget);
+
+void match_spans_init(MatchSpanList *list);
+
+void match_spans_free(MatchSpanList *list);
+
+/*
+ * Finds all matches of the rule in str with the length len
+ * 
+ * This is the first pass of a rewrite: the spans and the expanded length
+ * of every replacement are stored in list, list->outlen is the exact length
+ * of the rewritten string. list can be reused for multiple calls.
+ * 
+ * returns 1 if the rule matches, 0 if there is no match or the budget was
+ * exceeded
+ */
+int rule_match_spans(
+        TextReplacementRule *rule,
+        const char *str,
+        size_t len,
+        ApplyBudget *budget,
+        MatchSpanList *list);
+
+/*
+ * Writes the rewritten string to out
+ * 
+ * This is the second pass of a rewrite, list must contain the spans of
+ * rule_match_spans for the same string. out must have space for
+ * list->outlen + 1 bytes.
+ */
+void rule_expand_spans(
+        TextReplacementRule *rule,
+        const char *str,
+        size_t len,
+        const MatchSpanList *list,
+        char *out);
+
+/*
+ * returns a short status text of the rule for the config UI or NULL,
+ * if the rule is ok
+ */
+const char* rule_status(TextReplacementRule *rule);
+
+/*
+ * returns the number of heap allocations made for rewriting messages
+ * 
+ * In apply_all_rules, the message is a piece table of slices of the
+ * original message and of replacements stored in an arena. The piece
+ * arrays, the arena and the buffer for the contiguous text are kept
+ * across messages. Only growing them and the result of a changed
+ * message need an allocation.
+ */
+unsigned long apply_heap_allocs(void);
+
 /*
  * apply all (compiled) rules to msg
+ * 
+ * Every rule is applied within its own budget (apply_budget_init_rule).
+ * A rule, that exceeds the budget, is not applied to the message, the
+ * following rules are still applied. The rule is disabled after
+ * RULE_MAX_OVERRUNS overruns.
+ * 
+ * All rules together are limited by the message_limit of the rules file.
+ * When it is reached, the current and all remaining rules are skipped,
+ * the message contains the replacements of the previous rules.
+ * 
+ * Rules only replace pieces of the message, unchanged parts are not copied.
+ * The result string is built once after the last rule.
+ * 
+ * If any rule changes the message, *msg is freed with g_free and replaced
+ * with a new string allocated with g_malloc.
  */
 void apply_all_rules(char **msg);
 
+/*
+ * Same as apply_all_rules, but for a message with a known length
+ * msglen: length of *msg, updated if the message is changed
+ */
+void apply_all_rules_n(char **msg, size_t *msglen);
+
+void apply_state_init(ApplyState *state);
+
+void apply_state_free(ApplyState *state);
+
+/*
+ * applies one rule to state->pieces
+ * 
+ * The rule gets its own budget from options (apply_budget_init_rule), which
+ * ends at state->deadline at the latest. If the budget of the rule is
+ * exceeded, the overrun is counted and the message is not changed. If the
+ * deadline is reached, state->expired is set instead.
+ * Rules without a compiled regex and disabled rules are skipped.
+ * 
+ * returns the number of applied edits
+ */
+size_t apply_state_rule(
+        ApplyState *state,
+        TextReplacementRule *rule,
+        const RulesFileOptions *options);
+
+/*
+ * applies the rules in order to msg with apply_state_rule
+ * 
+ * The deadline of the state is set from options->message_limit, the loop
+ * stops, when it is reached.
+ * This is the rule loop of apply_all_rules without the plugin prefilters.
+ * The result is state->pieces, which is valid until the next call.
+ * msg must stay valid as long as the result is used.
+ * 
+ * returns 1 if any rule changed the message
+ */
+int apply_rules(
+        ApplyState *state,
+        TextReplacementRule *rules,
+        size_t nrules,
+        const RulesFileOptions *options,
+        const char *msg,
+        size_t len);
+
+/*
+ * sending-im-msg and sending-chat-msg handler
+ * 
+ * Applies all rules to the outgoing message and stores the original
+ * message and the result for the writing handler of the conversation.
+ */
+void handle_sending_msg(const void *conv, char **message);
+
+/*
+ * writing-im-msg and writing-chat-msg handler
+ * 
+ * Outgoing messages, that were passed to handle_sending_msg with the
+ * current rules, are replaced with the result of handle_sending_msg. The
+ * result itself is not changed. Other outgoing messages are rewritten
+ * with all rules.
+ */
+void handle_writing_msg(const void *conv, char **message, PurpleMessageFlags flags);
+
+/*
+ * returns the cache of rewritten outgoing messages
+ */
+ResultCache* get_sent_results(void);
+
 #endif /* RTR_H */
@@ -0,0 +1,130 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "result-cache.h"
+
+#include <string.h>
+
+void result_cache_init(ResultCache *cache) {
+    memset(cache, 0, sizeof(ResultCache));
+}
+
+static void entry_clear(ResultCacheEntry *entry) {
+    free(entry->input);
+    free(entry->result);
+    memset(entry, 0, sizeof(ResultCacheEntry));
+}
+
+void result_cache_free(ResultCache *cache) {
+    for(int i=0;i<RESULT_CACHE_SIZE;i++) {
+        entry_clear(&cache->entries[i]);
+    }
+    cache->next = 0;
+}
+
+uint64_t result_cache_hash(const char *str, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i=0;i<len;i++) {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void result_cache_store(
+        ResultCache *cache,
+        const void *conv,
+        unsigned int generation,
+        const char *input,
+        size_t input_len,
+        const char *result,
+        size_t len)
+{
+    if(!conv) {
+        return;
+    }
+    ResultCacheEntry *entry = &cache->entries[cache->next];
+    cache->next = (cache->next + 1) % RESULT_CACHE_SIZE;
+    entry_clear(entry);
+    
+    entry->conv = conv;
+    entry->generation = generation;
+    entry->input_hash = result_cache_hash(input, input_len);
+    entry->input = malloc(input_len + 1);
+    memcpy(entry->input, input, input_len);
+    entry->input_len = input_len;
+    if(result) {
+        entry->hash = result_cache_hash(result, len);
+        entry->result = malloc(len + 1);
+        memcpy(entry->result, result, len);
+        entry->result[len] = 0;
+        entry->len = len;
+    }
+}
+
+int result_cache_take(
+        ResultCache *cache,
+        const void *conv,
+        unsigned int generation,
+        const char *str,
+        size_t len,
+        char **result,
+        size_t *result_len)
+{
+    uint64_t hash = 0;
+    int hashed = 0;
+    for(int i=0;i<RESULT_CACHE_SIZE;i++) {
+        ResultCacheEntry *entry = &cache->entries[i];
+        if(!entry->conv || entry->conv != conv || entry->generation != generation) {
+            continue;
+        }
+        int is_input = entry->input_len == len;
+        int is_result = entry->result && entry->len == len;
+        if(!is_input && !is_result) {
+            continue;
+        }
+        if(!hashed) {
+            hash = result_cache_hash(str, len);
+            hashed = 1;
+        }
+        if(is_input && entry->input_hash == hash && !memcmp(entry->input, str, len)) {
+            // the result is moved to the caller
+            *result = entry->result;
+            *result_len = entry->len;
+            entry->result = NULL;
+        } else if(is_result && entry->hash == hash && !memcmp(entry->result, str, len)) {
+            *result = NULL;
+            *result_len = 0;
+        } else {
+            continue;
+        }
+        entry_clear(entry);
+        cache->hits++;
+        return 1;
+    }
+    cache->misses++;
+    return 0;
+}
+
+void result_cache_remove(ResultCache *cache, const void *conv) {
+    for(int i=0;i<RESULT_CACHE_SIZE;i++) {
+        if(cache->entries[i].conv == conv) {
+            entry_clear(&cache->entries[i]);
+        }
+    }
+}
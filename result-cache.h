@@ -0,0 +1,129 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_RESULT_CACHE_H
+#define RTR_RESULT_CACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * number of cached results of all conversations
+ */
+#define RESULT_CACHE_SIZE 16
+
+typedef struct ResultCacheEntry {
+    /*
+     * conversation or NULL, if the entry is unused
+     */
+    const void *conv;
+    
+    /*
+     * rules generation, that produced the result
+     */
+    unsigned int generation;
+    
+    /*
+     * original message, that was passed to the sending handler
+     */
+    uint64_t input_hash;
+    char *input;
+    size_t input_len;
+    
+    /*
+     * rewritten message or NULL, if the rules didn't change the message
+     */
+    uint64_t hash;
+    char *result;
+    size_t len;
+} ResultCacheEntry;
+
+/*
+ * Results of outgoing messages
+ * 
+ * An outgoing message is rewritten in the sending-*-msg signal handler.
+ * libpurple copies the message for the conversation window before the
+ * sending signal is emitted, therefore the writing-im-msg handler receives
+ * the original message. Chat messages are written, when the server echoes
+ * the sent message, the writing-chat-msg handler receives the result.
+ * 
+ * The cache stores the original message and the result per conversation,
+ * so that the writing handler can use the result of the sending handler
+ * for both cases instead of applying the rules a second time.
+ * 
+ * Entries are replaced round-robin.
+ */
+typedef struct ResultCache {
+    ResultCacheEntry entries[RESULT_CACHE_SIZE];
+    size_t next;
+    
+    /*
+     * statistics: number of lookups, that found a result or not
+     */
+    unsigned long hits;
+    unsigned long misses;
+} ResultCache;
+
+void result_cache_init(ResultCache *cache);
+
+void result_cache_free(ResultCache *cache);
+
+/*
+ * FNV-1a hash of a message
+ */
+uint64_t result_cache_hash(const char *str, size_t len);
+
+/*
+ * stores the original message of a conversation and the result
+ * result: rewritten message or NULL, if the message was not changed
+ * if conv is NULL, nothing is stored
+ */
+void result_cache_store(
+        ResultCache *cache,
+        const void *conv,
+        unsigned int generation,
+        const char *input,
+        size_t input_len,
+        const char *result,
+        size_t len);
+
+/*
+ * Searches an entry of the conversation, that was produced by the same
+ * rules generation, for the message str. str can be the original message
+ * or the result.
+ * 
+ * If an entry is found, it is removed from the cache and 1 is returned.
+ * If str is the original message and the rules changed it, result is set
+ * to the result (malloc'd, terminated, freed by the caller) and result_len
+ * to its length, otherwise result is set to NULL.
+ */
+int result_cache_take(
+        ResultCache *cache,
+        const void *conv,
+        unsigned int generation,
+        const char *str,
+        size_t len,
+        char **result,
+        size_t *result_len);
+
+/*
+ * removes all results of a conversation
+ */
+void result_cache_remove(ResultCache *cache, const void *conv);
+
+#endif /* RTR_RESULT_CACHE_H */
@@ -0,0 +1,127 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * rtr-filter: applies the rules of a rules file to the messages read from
+ * stdin and writes the result to stdout
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "regex-text-replacement.h"
+#include "filter.h"
+
+static void usage(FILE *out) {
+    fprintf(out, "Usage: rtr-filter [-0] [--stats] [--chunk-size bytes] [--max-message bytes] rules-file\n\n");
+    fprintf(out, "Reads messages from stdin, applies the rules and writes the result to stdout.\n\n");
+    fprintf(out, "  -0, --null           messages are separated by NUL instead of newline\n");
+    fprintf(out, "  --stats              print throughput statistics to stderr\n");
+    fprintf(out, "  --chunk-size bytes   size of the input chunks (default: %d)\n", FILTER_CHUNK_SIZE);
+    fprintf(out, "  --max-message bytes  fail on longer messages (default: %d)\n", FILTER_MAX_MESSAGE);
+}
+
+/*
+ * parses a positive number of bytes
+ * returns 0 on success
+ */
+static int parse_bytes(const char *arg, const char *name, size_t *value) {
+    char *end;
+    long long n = strtoll(arg, &end, 10);
+    if(*end || n <= 0) {
+        fprintf(stderr, "rtr-filter: invalid %s: %s\n", name, arg);
+        return 1;
+    }
+    *value = n;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    FilterOptions options;
+    memset(&options, 0, sizeof(FilterOptions));
+    options.delim = '\n';
+    int stats = 0;
+    const char *file = NULL;
+    
+    for(int i=1;i<argc;i++) {
+        const char *arg = argv[i];
+        if(!strcmp(arg, "-0") || !strcmp(arg, "--null")) {
+            options.delim = '\0';
+        } else if(!strcmp(arg, "--stats")) {
+            stats = 1;
+        } else if(!strcmp(arg, "--chunk-size") && i+1 < argc) {
+            if(parse_bytes(argv[++i], "chunk size", &options.chunk_size)) {
+                return 2;
+            }
+        } else if(!strcmp(arg, "--max-message") && i+1 < argc) {
+            if(parse_bytes(argv[++i], "max message size", &options.max_message)) {
+                return 2;
+            }
+        } else if(!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            usage(stdout);
+            return 0;
+        } else if(arg[0] == '-' || file) {
+            usage(stderr);
+            return 2;
+        } else {
+            file = arg;
+        }
+    }
+    if(!file) {
+        usage(stderr);
+        return 2;
+    }
+    
+    // load_rules would create a missing file
+    if(access(file, R_OK)) {
+        fprintf(stderr, "rtr-filter: cannot read rules file %s\n", file);
+        return 1;
+    }
+    
+    // all rules are compiled by load_rules, the rules file is only read
+    if(load_rules(file, &options.rules, &options.nrules, &options.rules_options)) {
+        fprintf(stderr, "rtr-filter: cannot load rules file %s\n", file);
+        return 1;
+    }
+    // skipping an invalid rule would change the result of the following
+    // rules
+    for(size_t i=0;i<options.nrules;i++) {
+        TextReplacementRule *rule = &options.rules[i];
+        if(strlen(rule->pattern) > 0 && !rule->regex && !(rule->flags & RULE_FLAG_DISABLED)) {
+            fprintf(stderr, "rtr-filter: invalid pattern %s\n", rule->pattern);
+            free_rules(options.rules, options.nrules);
+            return 1;
+        }
+    }
+    // the execution budget of the rules file is meant for interactive
+    // messages, the output of the filter must not depend on the CPU load
+    options.rules_options.time_limit = 0;
+    options.rules_options.step_limit = 0;
+    options.rules_options.message_limit = 0;
+    
+    FilterStats s;
+    int err = filter_stream(STDIN_FILENO, stdout, &options, &s);
+    if(stats) {
+        filter_stats_print(stderr, &s);
+    }
+    
+    free_rules(options.rules, options.nrules);
+    return err;
+}
@@ -0,0 +1,115 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * rtr-rewrite-logs: applies the rules of a rules file to all Pidgin log
+ * files in a directory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "log-rewrite.h"
+
+static void usage(FILE *out) {
+    fprintf(out, "Usage: rtr-rewrite-logs [-j threads] [--checkpoint file] [--quiet] rules-file [logs-dir]\n\n");
+    fprintf(out, "Applies the rules to the message text of all .txt and .html files in\n");
+    fprintf(out, "logs-dir (default: ~/.purple/logs) and replaces the changed files.\n");
+    fprintf(out, "In .html files only the text of sent messages is changed, not the markup.\n\n");
+    fprintf(out, "  -j threads           number of worker threads (default: number of processors)\n");
+    fprintf(out, "  --checkpoint file    completed files are stored in this file and skipped,\n");
+    fprintf(out, "                       when the command is started again\n");
+    fprintf(out, "                       (default: logs-dir/%s)\n", LOG_REWRITE_CHECKPOINT);
+    fprintf(out, "  --quiet              don't print the progress\n");
+}
+
+int main(int argc, char **argv) {
+    LogRewriteOptions options;
+    memset(&options, 0, sizeof(LogRewriteOptions));
+    options.progress = 1;
+    
+    for(int i=1;i<argc;i++) {
+        const char *arg = argv[i];
+        if(!strcmp(arg, "-j") && i+1 < argc) {
+            char *end;
+            long n = strtol(argv[++i], &end, 10);
+            if(*end || n <= 0) {
+                fprintf(stderr, "rtr-rewrite-logs: invalid number of threads: %s\n", argv[i]);
+                return 2;
+            }
+            options.nthreads = n;
+        } else if(!strcmp(arg, "--checkpoint") && i+1 < argc) {
+            options.checkpoint = argv[++i];
+        } else if(!strcmp(arg, "--quiet")) {
+            options.progress = 0;
+        } else if(!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            usage(stdout);
+            return 0;
+        } else if(arg[0] == '-') {
+            usage(stderr);
+            return 2;
+        } else if(!options.rules_file) {
+            options.rules_file = arg;
+        } else if(!options.root) {
+            options.root = arg;
+        } else {
+            usage(stderr);
+            return 2;
+        }
+    }
+    if(!options.rules_file) {
+        usage(stderr);
+        return 2;
+    }
+    // load_rules would create a missing file
+    if(access(options.rules_file, R_OK)) {
+        fprintf(stderr, "rtr-rewrite-logs: cannot read rules file %s\n", options.rules_file);
+        return 1;
+    }
+    
+    char *root = NULL;
+    if(!options.root) {
+        // default libpurple user dir, without initializing libpurple
+        root = g_build_filename(g_get_home_dir(), ".purple", "logs", NULL);
+        options.root = root;
+    }
+    char *checkpoint = NULL;
+    if(!options.checkpoint) {
+        checkpoint = g_build_filename(options.root, LOG_REWRITE_CHECKPOINT, NULL);
+        options.checkpoint = checkpoint;
+    }
+    
+    LogRewriteStats stats;
+    int err = log_rewrite(&options, &stats);
+    if(options.progress) {
+        fprintf(stderr, "%zu files, %zu skipped (checkpoint), %zu rewritten, %zu changed, %zu failed\n",
+                stats.files,
+                stats.skipped,
+                stats.processed,
+                stats.changed,
+                stats.failed);
+    }
+    
+    g_free(root);
+    g_free(checkpoint);
+    return err;
+}
@@ -0,0 +1,371 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rules-snapshot.h"
+#include "regex-engine.h"
+#include "dfa.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define SNAPSHOT_MAGIC "RTRSNAP"
+
+/*
+ * detects snapshots of a different architecture, the stored structs are
+ * used directly
+ */
+#define SNAPSHOT_BYTEORDER 0x01020304
+#define SNAPSHOT_ABI (sizeof(size_t) | sizeof(ReplacementSegment) << 8 | sizeof(NfaInst) << 16)
+
+/*
+ * rule entry contains a compiled DFA rule
+ */
+#define SNAPSHOT_RULE_COMPILED 1
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint64_t abi;
+    uint64_t hash;
+    /*
+     * file size
+     */
+    uint64_t size;
+    uint64_t nrules;
+} SnapshotHeader;
+
+/*
+ * rule entry, all offsets are relative to the beginning of the file and
+ * aligned to 8 bytes
+ */
+typedef struct SnapshotRule {
+    uint32_t flags;
+    uint32_t nsub;
+    int32_t max_group;
+    uint32_t nclasses;
+    
+    /*
+     * REGEX_ICASE, REGEX_WORD
+     */
+    uint32_t regex_flags;
+    
+    /*
+     * template text, text_len doesn't include the terminator
+     */
+    uint64_t text;
+    uint64_t text_len;
+    uint64_t segments;
+    uint64_t nsegments;
+    
+    /*
+     * classes shared by both programs
+     */
+    uint64_t classes;
+    
+    /*
+     * index 0: forward program, index 1: reverse program
+     */
+    uint64_t insts[2];
+    uint32_t ninsts[2];
+    uint32_t start[2];
+} SnapshotRule;
+
+char* rules_snapshot_path(const char *rules_file) {
+    size_t len = strlen(rules_file);
+    char *path = malloc(len + sizeof(RULES_SNAPSHOT_SUFFIX));
+    memcpy(path, rules_file, len);
+    memcpy(path + len, RULES_SNAPSHOT_SUFFIX, sizeof(RULES_SNAPSHOT_SUFFIX));
+    return path;
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for(size_t i=0;i<len;i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t rules_snapshot_hash(TextReplacementRule *rules, size_t nrules) {
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i=0;i<nrules;i++) {
+        TextReplacementRule *rule = &rules[i];
+        const char *pattern = rule->pattern ? rule->pattern : "";
+        const char *replacement = rule->replacement ? rule->replacement : "";
+        uint32_t engine = rule->engine;
+        uint32_t flags = rule->flags;
+        // the terminators separate the strings
+        h = fnv1a(h, pattern, strlen(pattern) + 1);
+        h = fnv1a(h, replacement, strlen(replacement) + 1);
+        h = fnv1a(h, &engine, sizeof(engine));
+        h = fnv1a(h, &flags, sizeof(flags));
+    }
+    return h;
+}
+
+/*
+ * returns a pointer to the range offset - offset+len of the mapping or
+ * NULL, if the range is not inside of the file or not aligned
+ */
+static const char* snapshot_range(RulesSnapshot *snapshot, uint64_t offset, uint64_t len) {
+    if(offset % 8 || offset > snapshot->size || len > snapshot->size - offset) {
+        return NULL;
+    }
+    return (const char*)snapshot->map + offset;
+}
+
+RulesSnapshot* rules_snapshot_open(const char *path, uint64_t hash, size_t nrules) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat s;
+    if(fstat(fd, &s) || s.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    // a shared mapping of the file uses the same physical pages in all
+    // processes
+    void *map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return NULL;
+    }
+    
+    const SnapshotHeader *header = map;
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))
+            || header->version != RULES_SNAPSHOT_VERSION
+            || header->byteorder != SNAPSHOT_BYTEORDER
+            || header->abi != SNAPSHOT_ABI
+            || header->hash != hash
+            || header->size != (uint64_t)s.st_size
+            || header->nrules != nrules
+            || nrules > (s.st_size - sizeof(SnapshotHeader)) / sizeof(SnapshotRule))
+    {
+        munmap(map, s.st_size);
+        return NULL;
+    }
+    
+    RulesSnapshot *snapshot = malloc(sizeof(RulesSnapshot));
+    snapshot->map = map;
+    snapshot->size = s.st_size;
+    snapshot->nrules = nrules;
+    return snapshot;
+}
+
+/*
+ * checks the template segments of a rule entry
+ */
+static int snapshot_template_valid(
+        const SnapshotRule *entry,
+        const ReplacementSegment *segments)
+{
+    if(entry->max_group > (int32_t)entry->nsub || entry->max_group > RULE_MAX_GROUPS) {
+        return 0;
+    }
+    for(uint64_t i=0;i<entry->nsegments;i++) {
+        const ReplacementSegment *seg = &segments[i];
+        if(seg->group < 0) {
+            if(seg->offset > entry->text_len || seg->length > entry->text_len - seg->offset) {
+                return 0;
+            }
+        } else if(seg->group > entry->max_group) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int rules_snapshot_load_rule(RulesSnapshot *snapshot, size_t index, TextReplacementRule *rule) {
+    if(index >= snapshot->nrules) {
+        return 0;
+    }
+    const SnapshotRule *entry = (const SnapshotRule*)((const char*)snapshot->map + sizeof(SnapshotHeader)) + index;
+    if(!(entry->flags & SNAPSHOT_RULE_COMPILED)) {
+        return 0;
+    }
+    
+    uint64_t max = snapshot->size;
+    const char *text = entry->text_len >= max ? NULL
+            : snapshot_range(snapshot, entry->text, entry->text_len + 1);
+    const char *segments = entry->nsegments > max / sizeof(ReplacementSegment) ? NULL
+            : snapshot_range(snapshot, entry->segments, entry->nsegments * sizeof(ReplacementSegment));
+    const char *classes = snapshot_range(snapshot, entry->classes, (uint64_t)entry->nclasses * 32);
+    if(!text || text[entry->text_len] != '\0' || !segments || !classes) {
+        return 0;
+    }
+    if(!snapshot_template_valid(entry, (const ReplacementSegment*)segments)) {
+        return 0;
+    }
+    
+    NfaProgram prog[2];
+    for(int i=0;i<2;i++) {
+        const char *insts = snapshot_range(snapshot, entry->insts[i], (uint64_t)entry->ninsts[i] * sizeof(NfaInst));
+        if(!insts) {
+            return 0;
+        }
+        // the programs are only read, the mapping is used without a copy
+        prog[i].insts = (NfaInst*)insts;
+        prog[i].ninsts = entry->ninsts[i];
+        prog[i].classes = (uint8_t*)classes;
+        prog[i].nclasses = entry->nclasses;
+        prog[i].start = entry->start[i];
+    }
+    CompiledRegex *regex = regex_dfa_load(&prog[0], &prog[1], entry->nsub, entry->regex_flags);
+    if(!regex) {
+        return 0;
+    }
+    
+    rule->regex = regex;
+    rule->template.text = (char*)text;
+    rule->template.segments = (ReplacementSegment*)segments;
+    rule->template.nsegments = entry->nsegments;
+    rule->template.max_group = entry->max_group;
+    rule->template.mapped = 1;
+    return 1;
+}
+
+void rules_snapshot_close(RulesSnapshot *snapshot) {
+    if(!snapshot) {
+        return;
+    }
+    munmap(snapshot->map, snapshot->size);
+    free(snapshot);
+}
+
+/*
+ * growable output buffer of rules_snapshot_save
+ */
+typedef struct SnapshotBuffer {
+    char *data;
+    size_t size;
+    size_t alloc;
+} SnapshotBuffer;
+
+/*
+ * appends data, aligned to 8 bytes
+ * returns the offset of the data
+ */
+static uint64_t buffer_append(SnapshotBuffer *buf, const void *data, size_t len) {
+    size_t offset = (buf->size + 7) & ~(size_t)7;
+    if(offset + len > buf->alloc) {
+        while(offset + len > buf->alloc) {
+            buf->alloc *= 2;
+        }
+        buf->data = realloc(buf->data, buf->alloc);
+    }
+    memset(buf->data + buf->size, 0, offset - buf->size);
+    if(len > 0) {
+        memcpy(buf->data + offset, data, len);
+    }
+    buf->size = offset + len;
+    return offset;
+}
+
+int rules_snapshot_save(const char *path, TextReplacementRule *rules, size_t nrules) {
+    // only DFA rules are stored, a snapshot without them is useless
+    size_t ndfa = 0;
+    for(size_t i=0;i<nrules;i++) {
+        if(rules[i].regex && rules[i].regex->type == REGEX_ENGINE_DFA) {
+            ndfa++;
+        }
+    }
+    if(ndfa == 0) {
+        return 0;
+    }
+    
+    SnapshotBuffer buf;
+    buf.size = sizeof(SnapshotHeader) + nrules * sizeof(SnapshotRule);
+    buf.alloc = buf.size + 4096;
+    buf.data = calloc(1, buf.alloc);
+    
+    for(size_t i=0;i<nrules;i++) {
+        TextReplacementRule *rule = &rules[i];
+        if(!rule->regex || rule->regex->type != REGEX_ENGINE_DFA) {
+            continue;
+        }
+        ReplacementTemplate *t = &rule->template;
+        DfaRegex *dfa = rule->regex->data;
+        const NfaProgram *fwd = dfa_program(dfa, 0);
+        const NfaProgram *rev = dfa_program(dfa, 1);
+        
+        SnapshotRule entry;
+        memset(&entry, 0, sizeof(SnapshotRule));
+        entry.flags = SNAPSHOT_RULE_COMPILED;
+        entry.nsub = rule->regex->nsub;
+        entry.max_group = t->max_group;
+        entry.nclasses = fwd->nclasses;
+        entry.regex_flags = rule->regex->flags;
+        entry.text_len = strlen(t->text);
+        entry.text = buffer_append(&buf, t->text, entry.text_len + 1);
+        entry.segments = buffer_append(&buf, t->segments, t->nsegments * sizeof(ReplacementSegment));
+        entry.nsegments = t->nsegments;
+        entry.classes = buffer_append(&buf, fwd->classes, fwd->nclasses * 32);
+        entry.insts[0] = buffer_append(&buf, fwd->insts, fwd->ninsts * sizeof(NfaInst));
+        entry.ninsts[0] = fwd->ninsts;
+        entry.start[0] = fwd->start;
+        entry.insts[1] = buffer_append(&buf, rev->insts, rev->ninsts * sizeof(NfaInst));
+        entry.ninsts[1] = rev->ninsts;
+        entry.start[1] = rev->start;
+        memcpy(buf.data + sizeof(SnapshotHeader) + i * sizeof(SnapshotRule), &entry, sizeof(SnapshotRule));
+    }
+    
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = RULES_SNAPSHOT_VERSION;
+    header.byteorder = SNAPSHOT_BYTEORDER;
+    header.abi = SNAPSHOT_ABI;
+    header.hash = rules_snapshot_hash(rules, nrules);
+    header.size = buf.size;
+    header.nrules = nrules;
+    memcpy(buf.data, &header, sizeof(SnapshotHeader));
+    
+    // other processes could use the current snapshot, therefore it is
+    // replaced and not overwritten
+    size_t pathlen = strlen(path);
+    char *tmp = malloc(pathlen + 32);
+    snprintf(tmp, pathlen + 32, "%s.%ld.tmp", path, (long)getpid());
+    int err = 1;
+    FILE *out = fopen(tmp, "w");
+    if(out) {
+        err = fwrite(buf.data, 1, buf.size, out) != buf.size;
+        // the data must be on disk, before the rename replaces the old file
+        err |= fflush(out) != 0;
+        err |= fsync(fileno(out)) != 0;
+        err |= fclose(out) != 0;
+        if(!err) {
+            err = rename(tmp, path) != 0;
+        }
+        if(err) {
+            unlink(tmp);
+        }
+    }
+    if(err) {
+        fprintf(stderr, "regex-text-replacement: cannot write snapshot %s\n", path);
+    }
+    free(tmp);
+    free(buf.data);
+    return err;
+}
@@ -0,0 +1,100 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_RULES_SNAPSHOT_H
+#define RTR_RULES_SNAPSHOT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "regex-text-replacement.h"
+
+/*
+ * file name suffix of the snapshot, that is stored next to the rules file
+ */
+#define RULES_SNAPSHOT_SUFFIX ".snapshot"
+
+/*
+ * format version, must be changed, whenever the file layout or the
+ * NFA program format of the DFA engine changes
+ */
+#define RULES_SNAPSHOT_VERSION 2
+
+/*
+ * Compiled rule set, that is stored next to the rules file
+ * 
+ * The snapshot contains the NFA programs of all rules, that use the DFA
+ * engine, and their parsed replacement templates. The file is mapped
+ * read-only and the rules use the programs and templates directly from
+ * the mapping, therefore several processes, that load the same snapshot,
+ * share the physical pages.
+ * 
+ * POSIX and PCRE2 rules can't be stored and are compiled normally.
+ * 
+ * The snapshot is keyed by a hash of the patterns, replacements, engines
+ * and flags of the rules. If the rules were changed, the snapshot is
+ * ignored and rewritten after the rules are compiled.
+ */
+typedef struct RulesSnapshot {
+    void *map;
+    size_t size;
+    size_t nrules;
+} RulesSnapshot;
+
+/*
+ * returns the snapshot path for a rules file
+ * the result must be freed with free()
+ */
+char* rules_snapshot_path(const char *rules_file);
+
+/*
+ * FNV-1a hash of the patterns, replacements, engines and flags of the rules
+ */
+uint64_t rules_snapshot_hash(TextReplacementRule *rules, size_t nrules);
+
+/*
+ * Maps a snapshot
+ * 
+ * returns NULL if the file doesn't exist, is invalid or was created for
+ * other rules (hash or number of rules don't match)
+ */
+RulesSnapshot* rules_snapshot_open(const char *path, uint64_t hash, size_t nrules);
+
+/*
+ * Sets the compiled regex and the template of a rule from the snapshot
+ * 
+ * The regex and the template reference the mapping, which must not be
+ * closed, until the rule is freed or recompiled.
+ * returns 1 if the rule was loaded, 0 if the snapshot doesn't contain
+ * the compiled rule
+ */
+int rules_snapshot_load_rule(RulesSnapshot *snapshot, size_t index, TextReplacementRule *rule);
+
+void rules_snapshot_close(RulesSnapshot *snapshot);
+
+/*
+ * Writes a snapshot of all compiled DFA rules
+ * 
+ * The snapshot is written to a temporary file, that replaces the previous
+ * snapshot, so that other processes can still use their mapping of the
+ * old file. If no rule uses the DFA engine, nothing is written.
+ * returns 0 on success
+ */
+int rules_snapshot_save(const char *path, TextReplacementRule *rules, size_t nrules);
+
+#endif /* RTR_RULES_SNAPSHOT_H */
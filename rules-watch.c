@@ -0,0 +1,115 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rules-watch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/inotify.h>
+
+#include <glib.h>
+
+struct RulesWatch {
+    int fd;
+    char *name;
+    GIOChannel *channel;
+    guint io_source;
+    guint timeout_source;
+    rules_watch_func callback;
+    void *userdata;
+};
+
+static gboolean watch_timeout(gpointer data) {
+    RulesWatch *watch = data;
+    watch->timeout_source = 0;
+    watch->callback(watch->userdata);
+    return FALSE;
+}
+
+static gboolean watch_io(GIOChannel *source, GIOCondition condition, gpointer data) {
+    RulesWatch *watch = data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    
+    int changed = 0;
+    for(;;) {
+        ssize_t r = read(watch->fd, buf, sizeof(buf));
+        if(r <= 0) {
+            break;
+        }
+        char *p = buf;
+        while(p < buf + r) {
+            struct inotify_event *event = (struct inotify_event*)p;
+            if(event->len > 0 && !strcmp(event->name, watch->name)) {
+                changed = 1;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    
+    if(changed) {
+        // wait until the file is not changed anymore
+        if(watch->timeout_source) {
+            g_source_remove(watch->timeout_source);
+        }
+        watch->timeout_source = g_timeout_add(RULES_WATCH_DELAY, watch_timeout, watch);
+    }
+    return TRUE;
+}
+
+RulesWatch* rules_watch_new(const char *path, rules_watch_func callback, void *userdata) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0) {
+        fprintf(stderr, "regex-text-replacement: inotify_init1 failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    
+    char *dir = g_path_get_dirname(path);
+    int wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    g_free(dir);
+    if(wd < 0) {
+        fprintf(stderr, "regex-text-replacement: cannot watch %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    
+    RulesWatch *watch = calloc(1, sizeof(RulesWatch));
+    watch->fd = fd;
+    watch->name = g_path_get_basename(path);
+    watch->callback = callback;
+    watch->userdata = userdata;
+    watch->channel = g_io_channel_unix_new(fd);
+    watch->io_source = g_io_add_watch(watch->channel, G_IO_IN, watch_io, watch);
+    return watch;
+}
+
+void rules_watch_free(RulesWatch *watch) {
+    if(!watch) {
+        return;
+    }
+    if(watch->timeout_source) {
+        g_source_remove(watch->timeout_source);
+    }
+    g_source_remove(watch->io_source);
+    g_io_channel_unref(watch->channel);
+    close(watch->fd);
+    g_free(watch->name);
+    free(watch);
+}
@@ -0,0 +1,46 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_RULES_WATCH_H
+#define RTR_RULES_WATCH_H
+
+/*
+ * time in milliseconds without further changes, before the callback
+ * is called
+ */
+#define RULES_WATCH_DELAY 200
+
+typedef void (*rules_watch_func)(void *userdata);
+
+typedef struct RulesWatch RulesWatch;
+
+/*
+ * Watches a file with inotify
+ * 
+ * The directory of the file is watched, therefore files, that are replaced
+ * with rename, are detected. The callback is called from the GLib main
+ * loop, after the file was written and no further changes happened for
+ * RULES_WATCH_DELAY milliseconds.
+ * 
+ * returns NULL, if inotify is not available
+ */
+RulesWatch* rules_watch_new(const char *path, rules_watch_func callback, void *userdata);
+
+void rules_watch_free(RulesWatch *watch);
+
+#endif /* RTR_RULES_WATCH_H */
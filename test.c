@@ -20,15 +20,52 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "test.h"
+#include "trigram-index.h"
+#include "dfa.h"
+#include "arena.h"
+#include "piece-table.h"
+#include "compile-worker.h"
+#include "rules-snapshot.h"
+#include "dictionary.h"
+#include "filter.h"
+#include "log-rewrite.h"
 #include "ui.h"
+#include "alloc-count.h"
 
 int main(int argc, char **argv) {
     CxTestSuite *suite = cx_test_suite_new("regex-text-replacement");
     cx_test_register(suite, test_load_rules);
     cx_test_register(suite, test_str_unescape_and_replace);
     cx_test_register(suite, test_apply_rule);
+    cx_test_register(suite, test_rule_union);
+    cx_test_register(suite, test_pattern_required_literal);
+    cx_test_register(suite, test_trigram_index);
+    cx_test_register(suite, test_dfa);
+    cx_test_register(suite, test_apply_budget);
+    cx_test_register(suite, test_rule_budget);
+    cx_test_register(suite, test_message_limit);
+    cx_test_register(suite, test_apply_rule_n);
+    cx_test_register(suite, test_match_spans);
+    cx_test_register(suite, test_arena);
+    cx_test_register(suite, test_piece_table);
+    cx_test_register(suite, test_apply_all_rules);
+    cx_test_register(suite, test_apply_all_rules_allocs);
+    cx_test_register(suite, test_sent_results);
+    cx_test_register(suite, test_rules_reload);
+    cx_test_register(suite, test_compile_worker);
+    cx_test_register(suite, test_lazy_compile);
+    cx_test_register(suite, test_rule_strings);
+    cx_test_register(suite, test_rules_snapshot);
+    cx_test_register(suite, test_rule_flags);
+    cx_test_register(suite, test_aho_corasick);
+    cx_test_register(suite, test_literal_groups);
+    cx_test_register(suite, test_dictionary);
+    cx_test_register(suite, test_dictionary_rule);
+    cx_test_register(suite, test_filter_stream);
+    cx_test_register(suite, test_log_rewrite);
     cx_test_run_stdout(suite);
     cx_test_suite_free(suite);
 }
@@ -44,7 +81,7 @@ CX_TEST(test_load_rules) {
     CX_TEST_DO {
         TextReplacementRule *rules;
         size_t nrules;
-        int ret = load_rules("testfile", &rules, &nrules);
+        int ret = load_rules("testfile", &rules, &nrules, NULL);
         CX_TEST_ASSERT(ret == 0);
         CX_TEST_ASSERT(rules);
         CX_TEST_ASSERT(nrules == 3);
@@ -58,7 +95,30 @@ CX_TEST(test_load_rules) {
         CX_TEST_ASSERT(!strcmp(rules[2].pattern, "pattern"));
         CX_TEST_ASSERT(!strcmp(rules[2].replacement, "replacement"));
         
+        // all strings are stored in one block
+        CX_TEST_ASSERT(rules[0].strings);
+        CX_TEST_ASSERT(rules[0].strings == rules[2].strings);
+        CX_TEST_ASSERT(rules[0].strings->refs == 3);
+        
         free_rules(rules, nrules);
+        
+        RulesFileOptions options;
+        CX_TEST_ASSERT(!parse_rules_header("?v1", &options));
+        CX_TEST_ASSERT(options.engine == REGEX_ENGINE_POSIX);
+        // the file is rejected, if the engine is not compiled in
+        if(regex_engine_available(REGEX_ENGINE_PCRE2)) {
+            CX_TEST_ASSERT(!parse_rules_header("?v1 engine=pcre2", &options));
+            CX_TEST_ASSERT(options.engine == REGEX_ENGINE_PCRE2);
+        } else {
+            CX_TEST_ASSERT(parse_rules_header("?v1 engine=pcre2", &options));
+        }
+        CX_TEST_ASSERT(parse_rules_header("?v1 engine=unknown", &options));
+        CX_TEST_ASSERT(parse_rules_header("?v12", &options));
+        CX_TEST_ASSERT(!parse_rules_header("?v1 time_limit=20 step_limit=0 message_limit=300", &options));
+        CX_TEST_ASSERT(options.time_limit == 20);
+        CX_TEST_ASSERT(options.step_limit == 0);
+        CX_TEST_ASSERT(options.message_limit == 300);
+        CX_TEST_ASSERT(parse_rules_header("?v1 time_limit=-1", &options));
     }
     
     unlink("testfile");
@@ -135,9 +195,16 @@ CX_TEST(test_str_unescape_and_replace) {
 
 CX_TEST(test_apply_rule) {
     TextReplacementRule rule0;
+    memset(&rule0, 0, sizeof(TextReplacementRule));
     rule0.pattern = "X([0-9]*)";
     rule0.replacement = "id=$1";
-    regcomp(&rule0.regex, rule0.pattern, REG_EXTENDED);
+    rule_compile(&rule0);
+    
+    TextReplacementRule rule1;
+    memset(&rule1, 0, sizeof(TextReplacementRule));
+    rule1.pattern = "([a-z]+)@([a-z]+)";
+    rule1.replacement = "$2:$1 ($0) \\$1 $3";
+    rule_compile(&rule1);
     
     CX_TEST_DO {
         char *in = g_strdup("hello X123 test end");
@@ -170,7 +237,1542 @@ CX_TEST(test_apply_rule) {
         CX_TEST_ASSERT(result != NULL);
         CX_TEST_ASSERT(!strcmp(result, "different cg values id=1 test id=23 TEST id=345 test id=4567 TEST id=56789 end"));
         g_free(result);
+        
+        in = g_strdup("mail user@host end");
+        result = apply_rule(in, &rule1);
+        CX_TEST_ASSERT(result != NULL);
+        CX_TEST_ASSERT(!strcmp(result, "mail host:user (user@host) $1 $3 end"));
+        g_free(result);
+    }
+    
+    rule_free_compiled(&rule0);
+    rule_free_compiled(&rule1);
+}
+
+CX_TEST(test_rule_union) {
+    TextReplacementRule rules[3];
+    memset(rules, 0, sizeof(rules));
+    rules[0].pattern = "abc";
+    rules[0].replacement = "";
+    rules[1].pattern = "X([0-9]+)";
+    rules[1].replacement = "$1";
+    rules[2].pattern = "(a)\\1";
+    rules[2].replacement = "";
+    for(int i=0;i<3;i++) {
+        rule_compile(&rules[i]);
+    }
+    
+    CX_TEST_DO {
+        RuleUnion u;
+        CX_TEST_ASSERT(rule_union_build(&u, rules, 3));
+        CX_TEST_ASSERT(rules[0].union_member);
+        CX_TEST_ASSERT(rules[1].union_member);
+        CX_TEST_ASSERT(!rules[2].union_member);
+        
+        CX_TEST_ASSERT(rule_union_match(&u, "test abc test", 13));
+        CX_TEST_ASSERT(rule_union_match(&u, "X12", 3));
+        CX_TEST_ASSERT(!rule_union_match(&u, "no match X aa", 13));
+        // only the first len bytes are searched
+        CX_TEST_ASSERT(!rule_union_match(&u, "test abc test", 6));
+        
+        rule_union_free(&u);
+    }
+    
+    for(int i=0;i<3;i++) {
+        rule_free_compiled(&rules[i]);
+    }
+}
+
+CX_TEST(test_pattern_required_literal) {
+    CX_TEST_DO {
+        size_t len;
+        int prefix;
+        char *lit = pattern_required_literal("gh#([0-9]+)", &len, &prefix);
+        CX_TEST_ASSERT(lit && !strcmp(lit, "gh#"));
+        CX_TEST_ASSERT(len == 3);
+        CX_TEST_ASSERT(prefix);
+        free(lit);
+        
+        lit = pattern_required_literal("[0-9]+ab?cdef*g", &len, &prefix);
+        CX_TEST_ASSERT(lit && !strcmp(lit, "cde"));
+        CX_TEST_ASSERT(!prefix);
+        free(lit);
+        
+        lit = pattern_required_literal("x(abc)+\\.org", &len, &prefix);
+        CX_TEST_ASSERT(lit && !strcmp(lit, ".org"));
+        free(lit);
+        
+        lit = pattern_required_literal("abc|def", &len, &prefix);
+        CX_TEST_ASSERT(lit == NULL);
+        
+        lit = pattern_required_literal("[a-z]*", &len, &prefix);
+        CX_TEST_ASSERT(lit == NULL);
+    }
+}
+
+CX_TEST(test_trigram_index) {
+    TrigramIndex idx;
+    memset(&idx, 0, sizeof(TrigramIndex));
+    
+    CX_TEST_DO {
+        trigram_index_append(&idx, "gh#", 3, 1);    // 0
+        trigram_index_append(&idx, "ab", 2, 1);     // 1: always
+        trigram_index_append(&idx, "ticket", 6, 1); // 2
+        trigram_index_append(&idx, "xyz", 3, 0);    // 3: not compiled
+        trigram_index_append(&idx, "gh#", 3, 1);    // 4
+        
+        const char *msg = "see gh#12";
+        trigram_index_match(&idx, msg, strlen(msg), 0);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 0) == 0);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 1) == 1);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 2) == 4);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 5) == 5);
+        
+        trigram_index_remove(&idx, 0);
+        trigram_index_swap(&idx, 0, 1);
+        // 0: ticket, 1: ab, 2: xyz, 3: gh#
+        msg = "ticket gh#1";
+        trigram_index_match(&idx, msg, strlen(msg), 0);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 0) == 0);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 1) == 1);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 2) == 3);
+        
+        trigram_index_set(&idx, 3, "none", 4, 1);
+        trigram_index_match(&idx, msg, strlen(msg), 2);
+        CX_TEST_ASSERT(trigram_index_next(&idx, 2) == 4);
+    }
+    
+    trigram_index_free(&idx);
+}
+
+CX_TEST(test_dfa) {
+    size_t nsub = 0;
+    DfaRegex *re = dfa_compile("([a-z]+)@([a-z]+)(x)?", &nsub);
+    regmatch_t m[4];
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(re);
+        CX_TEST_ASSERT(nsub == 3);
+        
+        const char *str = "mail: user@example, admin@test";
+        CX_TEST_ASSERT(dfa_exec(re, str, strlen(str), 4, m, 0) == 0);
+        CX_TEST_ASSERT(m[0].rm_so == 6 && m[0].rm_eo == 18);
+        CX_TEST_ASSERT(m[1].rm_so == 6 && m[1].rm_eo == 10);
+        CX_TEST_ASSERT(m[2].rm_so == 11 && m[2].rm_eo == 18);
+        CX_TEST_ASSERT(m[3].rm_so == -1 && m[3].rm_eo == -1);
+        CX_TEST_ASSERT(dfa_exec(re, "no match", 8, 4, m, 0) == REG_NOMATCH);
+        dfa_free(re);
+        
+        // leftmost-longest
+        re = dfa_compile("a|ab|abc", &nsub);
+        CX_TEST_ASSERT(dfa_exec(re, "xabcd", 5, 1, m, 0) == 0);
+        CX_TEST_ASSERT(m[0].rm_so == 1 && m[0].rm_eo == 4);
+        dfa_free(re);
+        
+        // anchors
+        re = dfa_compile("^a+$", &nsub);
+        CX_TEST_ASSERT(dfa_exec(re, "aaa", 3, 1, m, 0) == 0);
+        CX_TEST_ASSERT(dfa_exec(re, "aaa", 3, 1, m, REG_NOTBOL) == REG_NOMATCH);
+        CX_TEST_ASSERT(dfa_exec(re, "aab", 3, 1, m, 0) == REG_NOMATCH);
+        dfa_free(re);
+        
+        // . matches a complete UTF-8 sequence
+        re = dfa_compile("x.y", &nsub);
+        CX_TEST_ASSERT(dfa_exec(re, "x\xC3\xA4y", 4, 1, m, 0) == 0);
+        CX_TEST_ASSERT(m[0].rm_so == 0 && m[0].rm_eo == 4);
+        dfa_free(re);
+        
+        // nested quantifiers don't backtrack
+        re = dfa_compile("(a+)+b", &nsub);
+        char buf[4096];
+        memset(buf, 'a', 4095);
+        buf[4095] = 0;
+        CX_TEST_ASSERT(dfa_exec(re, buf, 4095, 2, m, 0) == REG_NOMATCH);
+        dfa_free(re);
+        re = NULL;
+        
+        // unsupported syntax
+        CX_TEST_ASSERT(!dfa_compile("(a)\\1", &nsub));
+        CX_TEST_ASSERT(!dfa_compile("\\bword", &nsub));
+        CX_TEST_ASSERT(!dfa_compile("(a", &nsub));
+        
+        CX_TEST_ASSERT(dfa_pattern_risky("(a+)*"));
+        CX_TEST_ASSERT(dfa_pattern_risky("(a|ab)+c"));
+        CX_TEST_ASSERT(!dfa_pattern_risky("(a+)b*"));
+        CX_TEST_ASSERT(!dfa_pattern_risky("[(a+)]*"));
+        
+        // risky POSIX rules use the DFA engine
+        TextReplacementRule rule;
+        memset(&rule, 0, sizeof(TextReplacementRule));
+        rule.pattern = "(x+)+y";
+        rule.replacement = "<$1>";
+        CX_TEST_ASSERT(rule_compile(&rule));
+        CX_TEST_ASSERT(rule.regex->type == REGEX_ENGINE_DFA);
+        char *out = apply_rule(g_strdup("axxxyb"), &rule);
+        CX_TEST_ASSERT(!strcmp(out, "a<xxx>b"));
+        g_free(out);
+        rule_free_compiled(&rule);
     }
     
-    regfree(&rule0.regex);
+    dfa_free(re);
+}
+
+CX_TEST(test_apply_budget) {
+    TextReplacementRule rule;
+    memset(&rule, 0, sizeof(TextReplacementRule));
+    rule.pattern = "X*";
+    rule.replacement = "-";
+    rule_compile(&rule);
+    
+    TextReplacementRule rule_bol;
+    memset(&rule_bol, 0, sizeof(TextReplacementRule));
+    rule_bol.pattern = "^a";
+    rule_bol.replacement = ">";
+    rule_compile(&rule_bol);
+    
+    CX_TEST_DO {
+        // empty matches make progress and are not replaced directly
+        // behind a previous match
+        char *result = apply_rule(g_strdup("aXXb"), &rule);
+        CX_TEST_ASSERT(!strcmp(result, "-a-b-"));
+        g_free(result);
+        
+        result = apply_rule(g_strdup(""), &rule);
+        CX_TEST_ASSERT(!strcmp(result, "-"));
+        g_free(result);
+        
+        // ^ only matches at the beginning of the message
+        result = apply_rule(g_strdup("aaa"), &rule_bol);
+        CX_TEST_ASSERT(!strcmp(result, ">aa"));
+        g_free(result);
+        
+        // step limit: 5 matches require 5 regexec calls
+        ApplyBudget budget;
+        apply_budget_init(&budget, 0, 4);
+        char *in = g_strdup("abcd");
+        size_t len;
+        result = apply_rule_n(in, 4, &rule, &budget, &len);
+        CX_TEST_ASSERT(budget.exceeded);
+        CX_TEST_ASSERT(result == in);
+        CX_TEST_ASSERT(!strcmp(result, "abcd"));
+        
+        apply_budget_init(&budget, 0, 5);
+        result = apply_rule_n(in, 4, &rule, &budget, &len);
+        CX_TEST_ASSERT(!budget.exceeded);
+        CX_TEST_ASSERT(!strcmp(result, "-a-b-c-d-"));
+        g_free(result);
+        
+        // an exceeded budget stays exceeded
+        CX_TEST_ASSERT(apply_budget_step(&budget));
+        
+        CX_TEST_ASSERT(rule_status(&rule) == NULL);
+        rule.disabled = 1;
+        CX_TEST_ASSERT(rule_status(&rule) != NULL);
+    }
+    
+    rule_free_compiled(&rule);
+    rule_free_compiled(&rule_bol);
+}
+
+CX_TEST(test_rule_budget) {
+    // every match needs one regexec call, the default step limit is
+    // exceeded without the per-byte budget
+    size_t len = RULES_DEFAULT_STEP_LIMIT + 50000;
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1 engine=dfa\n", testfile);
+    fputs("[a]\tb\n", testfile);
+    fputs("b\tc\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        ApplyBudget budget;
+        apply_budget_init_rule(&budget, 0, 10, 100);
+        CX_TEST_ASSERT(budget.steps == 10 + 100 * RULE_BUDGET_STEPS_PER_BYTE);
+        CX_TEST_ASSERT(budget.deadline == 0);
+        apply_budget_init_rule(&budget, 100, 0, 100);
+        CX_TEST_ASSERT(!budget.has_step_limit);
+        CX_TEST_ASSERT(budget.deadline > 0);
+        
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        char *msg = g_malloc(len + 1);
+        memset(msg, 'a', len);
+        msg[len] = 0;
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(strlen(msg) == len);
+        CX_TEST_ASSERT(strspn(msg, "c") == len);
+        g_free(msg);
+        
+        size_t n;
+        TextReplacementRule *rules = get_rules(&n);
+        CX_TEST_ASSERT(rules[0].overruns == 0);
+        
+        rules_cleanup();
+        
+        // a PCRE2 search, that reaches the match limit, is an overrun
+        if(regex_engine_available(REGEX_ENGINE_PCRE2)) {
+            FILE *f = fopen("testfile", "w");
+            fputs("?v1 engine=pcre2 time_limit=0 step_limit=0 message_limit=0\n", f);
+            fputs("(a+)+b\tx\n", f);
+            fclose(f);
+            CX_TEST_ASSERT(!rules_init("testfile"));
+            msg = g_strdup("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaac");
+            apply_all_rules(&msg);
+            CX_TEST_ASSERT(!strcmp(msg, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaac"));
+            g_free(msg);
+            rules = get_rules(&n);
+            CX_TEST_ASSERT(rules[0].overruns == 1);
+            rules_cleanup();
+        }
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_message_limit) {
+    // every rule scans the whole message, all rules together take much
+    // longer than the message limit
+    size_t nrules_file = 2000;
+    size_t len = 100000;
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1 engine=dfa time_limit=0 step_limit=0 message_limit=1\n", testfile);
+    for(size_t i=0;i<nrules_file;i++) {
+        fputs("[yz]\tx\n", testfile);
+    }
+    fclose(testfile);
+    char *in = g_malloc(len + 1);
+    memset(in, 'a', len);
+    in[len] = 0;
+    
+    CX_TEST_DO {
+        TextReplacementRule *rules;
+        size_t nrules;
+        RulesFileOptions options;
+        CX_TEST_ASSERT(!load_rules("testfile", &rules, &nrules, &options));
+        CX_TEST_ASSERT(options.message_limit == 1);
+        
+        ApplyState state;
+        apply_state_init(&state);
+        gint64 start = g_get_monotonic_time();
+        CX_TEST_ASSERT(!apply_rules(&state, rules, nrules, &options, in, len));
+        gint64 elapsed = g_get_monotonic_time() - start;
+        CX_TEST_ASSERT(state.expired);
+        CX_TEST_ASSERT(elapsed < 50000);
+        // the message limit doesn't count as an overrun of a rule
+        for(size_t i=0;i<nrules;i++) {
+            CX_TEST_ASSERT(rules[i].overruns == 0 && !rules[i].disabled);
+        }
+        
+        // without the limit, all rules are applied
+        options.message_limit = 0;
+        CX_TEST_ASSERT(!apply_rules(&state, rules, nrules, &options, in, len));
+        CX_TEST_ASSERT(!state.expired);
+        apply_state_free(&state);
+        free_rules(rules, nrules);
+        
+        // same limit in the plugin
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        char *msg = g_strdup(in);
+        start = g_get_monotonic_time();
+        apply_all_rules(&msg);
+        elapsed = g_get_monotonic_time() - start;
+        CX_TEST_ASSERT(elapsed < 50000);
+        CX_TEST_ASSERT(!strcmp(msg, in));
+        g_free(msg);
+        rules_cleanup();
+    }
+    
+    g_free(in);
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_arena) {
+    Arena arena;
+    arena_init(&arena);
+    
+    CX_TEST_DO {
+        char *a = arena_alloc(&arena, 100);
+        CX_TEST_ASSERT(a);
+        CX_TEST_ASSERT(arena.heap_allocs == 1);
+        memset(a, 'a', 100);
+        
+        // the most recent allocation is resized in place
+        char *b = arena_realloc(&arena, a, 100, 1000);
+        CX_TEST_ASSERT(a == b);
+        
+        // larger than a block
+        char *c = arena_alloc(&arena, ARENA_BLOCK_SIZE * 2);
+        CX_TEST_ASSERT(c);
+        CX_TEST_ASSERT(arena.heap_allocs == 2);
+        
+        char *d = arena_realloc(&arena, b, 1000, 2000);
+        CX_TEST_ASSERT(d != b);
+        CX_TEST_ASSERT(d[99] == 'a');
+        
+        // after a reset, the same allocations fit in one block
+        arena_reset(&arena);
+        unsigned long heap_allocs = arena.heap_allocs;
+        arena_alloc(&arena, 100);
+        arena_alloc(&arena, ARENA_BLOCK_SIZE * 2);
+        arena_alloc(&arena, 2000);
+        arena_reset(&arena);
+        CX_TEST_ASSERT(arena.heap_allocs == heap_allocs);
+    }
+    
+    arena_free(&arena);
+}
+
+CX_TEST(test_piece_table) {
+    PieceTable pt;
+    piece_table_init(&pt);
+    
+    CX_TEST_DO {
+        const char *msg = "hello world hello";
+        piece_table_reset(&pt, msg, strlen(msg));
+        CX_TEST_ASSERT(piece_table_text(&pt) == msg);
+        
+        PieceEdit edits[2];
+        edits[0].start = 0;
+        edits[0].end = 5;
+        edits[0].data = msg;
+        edits[0].len = 2;
+        edits[1].start = 12;
+        edits[1].end = 17;
+        edits[1].data = "";
+        edits[1].len = 0;
+        piece_table_splice(&pt, edits, 2);
+        CX_TEST_ASSERT(pt.len == 9);
+        CX_TEST_ASSERT(pt.npieces == 2);
+        CX_TEST_ASSERT(!memcmp(piece_table_text(&pt), "he world ", 9));
+        
+        // matches across piece boundaries
+        size_t pos;
+        CX_TEST_ASSERT(piece_table_find(&pt, "he w", 4, 0, &pos));
+        CX_TEST_ASSERT(pos == 0);
+        CX_TEST_ASSERT(piece_table_find(&pt, "o", 1, 3, &pos));
+        CX_TEST_ASSERT(pos == 4);
+        CX_TEST_ASSERT(piece_table_find(&pt, "ld ", 3, 0, &pos));
+        CX_TEST_ASSERT(pos == 6);
+        CX_TEST_ASSERT(!piece_table_find(&pt, "hello", 5, 0, &pos));
+        CX_TEST_ASSERT(!piece_table_find(&pt, "he", 2, 1, &pos));
+        
+        // contiguous pieces are merged
+        edits[0].start = 2;
+        edits[0].end = 2;
+        edits[0].data = msg + 2;
+        edits[0].len = 3;
+        piece_table_splice(&pt, edits, 1);
+        CX_TEST_ASSERT(pt.npieces == 1);
+        CX_TEST_ASSERT(piece_table_text(&pt) == msg);
+        CX_TEST_ASSERT(pt.len == 12);
+        
+        char buf[8];
+        piece_table_copy(&pt, 4, 9, buf);
+        CX_TEST_ASSERT(!memcmp(buf, "o wor", 5));
+    }
+    
+    piece_table_free(&pt);
+}
+
+CX_TEST(test_apply_all_rules) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1\n", testfile);
+    fputs("foo\tbar\n", testfile);
+    fputs("b(a)r\t<$1>\n", testfile);
+    fputs("x+\ty\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        
+        char *msg = g_strdup("foo xx foo");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "<a> y <a>"));
+        g_free(msg);
+        
+        // unchanged messages are not copied
+        msg = g_strdup("nothing");
+        char *msg_in = msg;
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(msg == msg_in);
+        g_free(msg);
+        
+        // once the scratch buffers are large enough, only the result
+        // of a changed message is allocated
+        unsigned long heap_allocs = 0;
+        for(int i=0;i<10;i++) {
+            if(i == 1) {
+                heap_allocs = apply_heap_allocs();
+            }
+            msg = g_strdup("foo bar foo xxx");
+            apply_all_rules(&msg);
+            CX_TEST_ASSERT(!strcmp(msg, "<a> <a> <a> y"));
+            g_free(msg);
+        }
+        CX_TEST_ASSERT(apply_heap_allocs() == heap_allocs + 9);
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_apply_all_rules_allocs) {
+    // the POSIX engine allocates memory in regexec, therefore the
+    // allocations are counted with the DFA engine
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1 engine=dfa\n", testfile);
+    fputs("foo\tbar\n", testfile);
+    fputs("b(a)r\t<$1>\n", testfile);
+    fputs("[0-9]+\t#\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        
+        const char *unchanged = "nothing to replace here";
+        const char *changed = "foo 123 bar";
+        // warm up: scratch buffers and DFA states
+        for(int i=0;i<2;i++) {
+            char *msg = g_strdup(unchanged);
+            apply_all_rules(&msg);
+            g_free(msg);
+            msg = g_strdup(changed);
+            apply_all_rules(&msg);
+            CX_TEST_ASSERT(!strcmp(msg, "<a> # <a>"));
+            g_free(msg);
+        }
+        
+#ifdef ALLOC_COUNT_ENABLED
+        char *msg = g_strdup(unchanged);
+        alloc_count_start();
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(alloc_count_stop() == 0);
+        g_free(msg);
+        
+        msg = g_strdup(changed);
+        alloc_count_start();
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(alloc_count_stop() == 1);
+        g_free(msg);
+#endif
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_apply_rule_n) {
+    TextReplacementRule rule_eol;
+    memset(&rule_eol, 0, sizeof(TextReplacementRule));
+    rule_eol.pattern = "a$";
+    rule_eol.replacement = "<";
+    rule_compile(&rule_eol);
+    
+    TextReplacementRule rule_dfa;
+    memset(&rule_dfa, 0, sizeof(TextReplacementRule));
+    rule_dfa.pattern = "^x|y";
+    rule_dfa.replacement = "-";
+    rule_dfa.engine = REGEX_ENGINE_DFA;
+    rule_compile(&rule_dfa);
+    
+    CX_TEST_DO {
+        // only the first len bytes are used
+        size_t len;
+        char *in = g_strdup("aaa aaa");
+        char *result = apply_rule_n(in, 3, &rule_eol, NULL, &len);
+        CX_TEST_ASSERT(result != in);
+        CX_TEST_ASSERT(len == 3);
+        CX_TEST_ASSERT(!strcmp(result, "aa<"));
+        g_free(result);
+        
+        // ^ doesn't match at the position after a previous match
+        in = g_strdup("xxyx");
+        result = apply_rule_n(in, 4, &rule_dfa, NULL, &len);
+        CX_TEST_ASSERT(len == 4);
+        CX_TEST_ASSERT(!strcmp(result, "-x-x"));
+        g_free(result);
+        
+        in = g_strdup("no match");
+        result = apply_rule_n(in, 8, &rule_dfa, NULL, &len);
+        CX_TEST_ASSERT(result == in);
+        CX_TEST_ASSERT(len == 8);
+        g_free(result);
+    }
+    
+    rule_free_compiled(&rule_eol);
+    rule_free_compiled(&rule_dfa);
+}
+
+CX_TEST(test_match_spans) {
+    TextReplacementRule rule;
+    memset(&rule, 0, sizeof(TextReplacementRule));
+    rule.pattern = "X([0-9]+)";
+    rule.replacement = "<$1$1>";
+    rule_compile(&rule);
+    
+    MatchSpanList spans;
+    match_spans_init(&spans);
+    
+    CX_TEST_DO {
+        const char *str = "a X1 b X22";
+        CX_TEST_ASSERT(rule_match_spans(&rule, str, 10, NULL, &spans));
+        CX_TEST_ASSERT(spans.nspans == 2);
+        CX_TEST_ASSERT(spans.spans[0].start == 2 && spans.spans[0].end == 4);
+        CX_TEST_ASSERT(spans.spans[0].length == 4);
+        CX_TEST_ASSERT(spans.spans[1].start == 7 && spans.spans[1].end == 10);
+        CX_TEST_ASSERT(spans.spans[1].length == 6);
+        CX_TEST_ASSERT(spans.outlen == 15);
+        
+        char out[16];
+        rule_expand_spans(&rule, str, 10, &spans, out);
+        CX_TEST_ASSERT(!strcmp(out, "a <11> b <2222>"));
+        
+        // the list is reused
+        CX_TEST_ASSERT(!rule_match_spans(&rule, "none", 4, NULL, &spans));
+        CX_TEST_ASSERT(spans.nspans == 0);
+        CX_TEST_ASSERT(spans.outlen == 4);
+    }
+    
+    match_spans_free(&spans);
+    rule_free_compiled(&rule);
+}
+
+CX_TEST(test_sent_results) {
+    // foo -> foofoo is not idempotent, every additional pass changes
+    // the message
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1\n", testfile);
+    fputs("foo\tfoofoo\n", testfile);
+    fclose(testfile);
+    
+    int conv1, conv2;
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        ResultCache *cache = get_sent_results();
+        
+        // libpurple copies the message for the conversation window,
+        // then emits sending-im-msg with the message and writing-im-msg
+        // with the copy of the original message
+        char *sent = g_strdup("foo");
+        char *displayed = g_strdup(sent);
+        handle_sending_msg(&conv1, &sent);
+        CX_TEST_ASSERT(!strcmp(sent, "foofoo"));
+        handle_writing_msg(&conv1, &displayed, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(displayed, "foofoo"));
+        CX_TEST_ASSERT(cache->hits == 1);
+        g_free(displayed);
+        
+        // the result is only used once
+        displayed = g_strdup("foo");
+        handle_writing_msg(&conv1, &displayed, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(displayed, "foofoo"));
+        CX_TEST_ASSERT(cache->misses == 1);
+        g_free(displayed);
+        g_free(sent);
+        
+        // chat messages are written, when the server echoes the sent
+        // message, the result is not rewritten again
+        sent = g_strdup("foo");
+        handle_sending_msg(&conv2, &sent);
+        CX_TEST_ASSERT(!strcmp(sent, "foofoo"));
+        char *echo = g_strdup(sent);
+        handle_writing_msg(&conv2, &echo, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(echo, "foofoo"));
+        CX_TEST_ASSERT(cache->hits == 2);
+        g_free(echo);
+        g_free(sent);
+        
+        // unchanged messages are found, too
+        sent = g_strdup("bar");
+        displayed = g_strdup(sent);
+        handle_sending_msg(&conv1, &sent);
+        handle_writing_msg(&conv1, &displayed, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(displayed, "bar"));
+        CX_TEST_ASSERT(cache->hits == 3);
+        g_free(displayed);
+        g_free(sent);
+        
+        // results are stored per conversation
+        sent = g_strdup("foo");
+        displayed = g_strdup(sent);
+        handle_sending_msg(&conv1, &sent);
+        char *other = g_strdup("foo");
+        handle_writing_msg(&conv2, &other, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(other, "foofoo"));
+        CX_TEST_ASSERT(cache->misses == 2);
+        handle_writing_msg(&conv1, &displayed, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(displayed, "foofoo"));
+        CX_TEST_ASSERT(cache->hits == 4);
+        g_free(other);
+        g_free(displayed);
+        g_free(sent);
+        
+        // received messages are not changed
+        char *msg = g_strdup("foo");
+        handle_writing_msg(&conv1, &msg, PURPLE_MESSAGE_RECV);
+        CX_TEST_ASSERT(!strcmp(msg, "foo"));
+        
+        // results of older rules are not used
+        displayed = g_strdup(msg);
+        handle_sending_msg(&conv1, &msg);
+        rule_update_replacement(0, "foobar");
+        handle_writing_msg(&conv1, &displayed, PURPLE_MESSAGE_SEND);
+        CX_TEST_ASSERT(!strcmp(displayed, "foobar"));
+        CX_TEST_ASSERT(cache->hits == 4);
+        g_free(displayed);
+        g_free(msg);
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_rules_reload) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1\n", testfile);
+    fputs("foo\tbar\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        
+        testfile = fopen("testfile", "w");
+        fputs("?v1 engine=dfa\n", testfile);
+        fputs("foo\tbaz\n", testfile);
+        fputs("x+\ty\n", testfile);
+        fclose(testfile);
+        CX_TEST_ASSERT(!rules_reload("testfile"));
+        
+        size_t nrules;
+        get_rules(&nrules);
+        CX_TEST_ASSERT(nrules == 2);
+        char *msg = g_strdup("foo xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "baz y"));
+        g_free(msg);
+        
+        // a file with an invalid pattern doesn't replace the current rules
+        testfile = fopen("testfile", "w");
+        fputs("?v1\n", testfile);
+        fputs("(foo\tbar\n", testfile);
+        fclose(testfile);
+        CX_TEST_ASSERT(rules_reload("testfile"));
+        CX_TEST_ASSERT(rules_reload("nonexistent-testfile"));
+        
+        msg = g_strdup("foo xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "baz y"));
+        g_free(msg);
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+static int compile_job_test_compiled;
+
+static void compile_job_test_done(CompileJob *job) {
+    compile_job_test_compiled = job->rules[0].regex != NULL;
+    compile_job_free(job);
+}
+
+CX_TEST(test_compile_worker) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1 strict=1\n", testfile);
+    fputs("foo\tbar\n", testfile);
+    fputs("b(a)r\t<$1>\n", testfile);
+    fputs("x+\ty\n", testfile);
+    fclose(testfile);
+    mkdir("testfile.dir", 0755);
+    FILE *words = fopen("testfile.dir/testfile.words", "w");
+    fputs("teh\tthe\n", words);
+    fclose(words);
+    
+    CX_TEST_DO {
+        compile_worker_start();
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        
+        // strict mode: the message waits for the compile worker
+        char *msg = g_strdup("foo xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "<a> y"));
+        CX_TEST_ASSERT(compile_worker_pending() == 0);
+        g_free(msg);
+        
+        size_t nrules;
+        TextReplacementRule *rules = get_rules(&nrules);
+        CX_TEST_ASSERT(rule_update_pattern(2, "z+"));
+        CX_TEST_ASSERT(rule_update_pattern(2, "x{2}"));
+        // only the last pattern is used, the results of older jobs
+        // are discarded
+        compile_worker_wait();
+        CX_TEST_ASSERT(!rules[2].compile_pending);
+        CX_TEST_ASSERT(!strcmp(rules[2].pattern, "x{2}"));
+        CX_TEST_ASSERT(rule_status(&rules[2]) == NULL);
+        
+        // the replacement can be changed, while the pattern is compiled
+        CX_TEST_ASSERT(rule_update_pattern(0, "fo+"));
+        rule_update_replacement(0, "baz");
+        compile_worker_wait();
+        msg = g_strdup("foo xxx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "baz yx"));
+        g_free(msg);
+        
+        rule_update_pattern(1, "b(a");
+        compile_worker_wait();
+        CX_TEST_ASSERT(!strcmp(rule_status(&rules[1]), "invalid pattern"));
+        
+        // the job uses its own copy of the rules directory
+        TextReplacementRule *dict_rule = calloc(1, sizeof(TextReplacementRule));
+        dict_rule->pattern = strdup("testfile.words");
+        dict_rule->flags = RULE_FLAG_DICTIONARY;
+        char *dir = strdup("testfile.dir");
+        CompileJob *job = compile_job_new(dict_rule, 1, dir, compile_job_test_done, NULL);
+        free(dir);
+        compile_worker_submit(job);
+        compile_worker_wait();
+        CX_TEST_ASSERT(compile_job_test_compiled == 1);
+        
+        compile_worker_stop();
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+    unlink("testfile.dir/testfile.words");
+    rmdir("testfile.dir");
+}
+
+CX_TEST(test_lazy_compile) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1 lazy=1\n", testfile);
+    fputs("foo\tbar\n", testfile);
+    fputs("x+\ty\n", testfile);
+    fputs("never\tnothing\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        size_t nrules;
+        TextReplacementRule *rules = get_rules(&nrules);
+        CX_TEST_ASSERT(nrules == 3);
+        for(int i=0;i<3;i++) {
+            CX_TEST_ASSERT(rules[i].compile_lazy);
+            CX_TEST_ASSERT(!rules[i].regex);
+            CX_TEST_ASSERT(rules[i].literal);
+        }
+        
+        // only rules, whose literal is found, are compiled
+        char *msg = g_strdup("foo");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "bar"));
+        g_free(msg);
+        CX_TEST_ASSERT(rules[0].regex);
+        CX_TEST_ASSERT(!rules[1].regex);
+        CX_TEST_ASSERT(!strcmp(rule_status(&rules[1]), "not compiled yet"));
+        
+        // warm-up
+        CX_TEST_ASSERT(rules_compile_lazy(1) == 1);
+        CX_TEST_ASSERT(rules[1].regex);
+        CX_TEST_ASSERT(rules_compile_lazy(RULES_WARMUP_BATCH) == 0);
+        CX_TEST_ASSERT(rules[2].regex);
+        
+        msg = g_strdup("foo xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "bar y"));
+        g_free(msg);
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_rule_strings) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1\n", testfile);
+    fputs("foo\tbar\n", testfile);
+    fputs("\tinvalid\n", testfile);
+    fputs("\n", testfile);
+    fputs("x+\t\n", testfile);
+    fputs("abc\t123", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        size_t nrules;
+        TextReplacementRule *rules = get_rules(&nrules);
+        CX_TEST_ASSERT(nrules == 3);
+        CX_TEST_ASSERT(!strcmp(rules[1].pattern, "x+"));
+        CX_TEST_ASSERT(!strcmp(rules[1].replacement, ""));
+        CX_TEST_ASSERT(!strcmp(rules[2].replacement, "123"));
+        
+        // changed strings are copied out of the block
+        rule_update_pattern(0, "fo+");
+        rule_update_replacement(0, "baz");
+        rule_update_replacement(0, "qux");
+        CX_TEST_ASSERT(rules[0].strings->refs == 3);
+        rule_remove(1);
+        CX_TEST_ASSERT(rules[0].strings->refs == 2);
+        
+        char *msg = g_strdup("foo abc");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "qux 123"));
+        g_free(msg);
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_rules_snapshot) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1 engine=dfa\n", testfile);
+    fputs("a(b+)c\t<$1>\n", testfile);
+    fputs("x+\ty\n", testfile);
+    fclose(testfile);
+    unlink("testfile.snapshot");
+    
+    CX_TEST_DO {
+        // the first load compiles the rules and writes the snapshot
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        size_t nrules;
+        TextReplacementRule *rules = get_rules(&nrules);
+        CX_TEST_ASSERT(nrules == 2);
+        CX_TEST_ASSERT(!rules[0].template.mapped);
+        struct stat s;
+        CX_TEST_ASSERT(!stat("testfile.snapshot", &s));
+        char *msg = g_strdup("abbc xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "<bb> y"));
+        g_free(msg);
+        rules_cleanup();
+        
+        // the second load uses the snapshot
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        rules = get_rules(&nrules);
+        CX_TEST_ASSERT(rules[0].template.mapped);
+        CX_TEST_ASSERT(rules[1].template.mapped);
+        CX_TEST_ASSERT(rules[0].regex && rules[0].regex->nsub == 1);
+        msg = g_strdup("abbc xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "<bb> y"));
+        g_free(msg);
+        
+        // rules from the snapshot can be changed
+        rule_update_replacement(0, "[$1]");
+        CX_TEST_ASSERT(!rules[0].template.mapped);
+        CX_TEST_ASSERT(rule_update_pattern(1, "x"));
+        msg = g_strdup("abbc xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "[bb] yy"));
+        g_free(msg);
+        rules_cleanup();
+        
+        // a snapshot of other rules is not used
+        uint64_t hash = 0;
+        CX_TEST_ASSERT(!rules_snapshot_open("testfile.snapshot", hash, 2));
+        testfile = fopen("testfile", "w");
+        fputs("?v1 engine=dfa\n", testfile);
+        fputs("a(b+)c\t$1\n", testfile);
+        fputs("x+\ty\n", testfile);
+        fclose(testfile);
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        rules = get_rules(&nrules);
+        CX_TEST_ASSERT(!rules[0].template.mapped);
+        hash = rules_snapshot_hash(rules, nrules);
+        RulesSnapshot *snapshot = rules_snapshot_open("testfile.snapshot", hash, nrules);
+        CX_TEST_ASSERT(snapshot);
+        rules_snapshot_close(snapshot);
+        rules_cleanup();
+        
+        // truncated snapshot
+        CX_TEST_ASSERT(!truncate("testfile.snapshot", 100));
+        CX_TEST_ASSERT(!rules_snapshot_open("testfile.snapshot", hash, 2));
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        rules = get_rules(&nrules);
+        CX_TEST_ASSERT(!rules[0].template.mapped);
+        msg = g_strdup("abbc xx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "bb y"));
+        g_free(msg);
+        rules_cleanup();
+        
+        // no snapshot without dfa rules
+        unlink("testfile.snapshot");
+        testfile = fopen("testfile", "w");
+        fputs("?v1 engine=posix\n", testfile);
+        fputs("a(b+)c\t$1\n", testfile);
+        fclose(testfile);
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        CX_TEST_ASSERT(stat("testfile.snapshot", &s));
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_rule_flags) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v2\n", testfile);
+    fputs("l\ta.b\t[$0]\n", testfile);
+    fputs("i\th(e)llo\thi$1\n", testfile);
+    fputs("w\tcat\tdog\n", testfile);
+    fputs("d\tfoo\tbar\n", testfile);
+    fputs("-\tz+\tZ\n", testfile);
+    fputs("liw\tTHE\tthe\n", testfile);
+    fputs("x\tunknown\tflag\n", testfile);
+    fputs("missing flags\n", testfile);
+    fclose(testfile);
+    
+    TextReplacementRule *rules;
+    size_t nrules;
+    RulesFileOptions options;
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!load_rules("testfile", &rules, &nrules, &options));
+        CX_TEST_ASSERT(options.version == 2);
+        CX_TEST_ASSERT(nrules == 6);
+        CX_TEST_ASSERT(rules[0].flags == RULE_FLAG_LITERAL);
+        CX_TEST_ASSERT(rules[1].flags == RULE_FLAG_ICASE);
+        CX_TEST_ASSERT(rules[2].flags == RULE_FLAG_WORD);
+        CX_TEST_ASSERT(rules[3].flags == RULE_FLAG_DISABLED);
+        CX_TEST_ASSERT(rules[4].flags == 0);
+        CX_TEST_ASSERT(rules[5].flags == (RULE_FLAG_LITERAL|RULE_FLAG_ICASE|RULE_FLAG_WORD));
+        CX_TEST_ASSERT(!strcmp(rules[1].pattern, "h(e)llo"));
+        CX_TEST_ASSERT(!strcmp(rules[1].replacement, "hi$1"));
+        
+        // literal: no regex syntax
+        CX_TEST_ASSERT(rules[0].regex && rules[0].regex->type == REGEX_ENGINE_LITERAL);
+        CX_TEST_ASSERT(rules[0].literal_only);
+        char *msg = apply_rule(g_strdup("axb a.b"), &rules[0]);
+        CX_TEST_ASSERT(!strcmp(msg, "axb [a.b]"));
+        g_free(msg);
+        
+        // case-insensitive: folded prefilter literal
+        CX_TEST_ASSERT(rules[1].literal_icase);
+        CX_TEST_ASSERT(!strcmp(rules[1].literal, "llo"));
+        msg = apply_rule(g_strdup("HELLO hello"), &rules[1]);
+        CX_TEST_ASSERT(!strcmp(msg, "hiE hie"));
+        g_free(msg);
+        
+        // whole word
+        msg = apply_rule(g_strdup("cat concat cats cat."), &rules[2]);
+        CX_TEST_ASSERT(!strcmp(msg, "dog concat cats dog."));
+        g_free(msg);
+        
+        // disabled: not compiled, but valid
+        CX_TEST_ASSERT(!rules[3].regex);
+        CX_TEST_ASSERT(!rule_status(&rules[3]));
+        
+        msg = apply_rule(g_strdup("The theme THE"), &rules[5]);
+        CX_TEST_ASSERT(!strcmp(msg, "the theme the"));
+        g_free(msg);
+        
+        free_rules(rules, nrules);
+        
+        // case-insensitive DFA
+        size_t nsub;
+        DfaRegex *re = dfa_compile_flags("h[a-c]llo [^x]", DFA_ICASE, &nsub);
+        regmatch_t m[1];
+        CX_TEST_ASSERT(dfa_exec(re, "HBLLO y", 7, 1, m, 0) == 0);
+        CX_TEST_ASSERT(dfa_exec(re, "HBLLO X", 7, 1, m, 0) == REG_NOMATCH);
+        dfa_free(re);
+        
+        // apply_all_rules and rule_update_flags
+        testfile = fopen("testfile", "w");
+        fputs("?v2\n", testfile);
+        fputs("d\tfoo\tbar\n", testfile);
+        fputs("i\tbaz\tqux\n", testfile);
+        fclose(testfile);
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        msg = g_strdup("foo BAZ");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "foo qux"));
+        g_free(msg);
+        CX_TEST_ASSERT(rule_update_flags(0, RULE_FLAG_WORD));
+        CX_TEST_ASSERT(!rule_update_flags(1, RULE_FLAG_DISABLED));
+        msg = g_strdup("foo food BAZ");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "bar food BAZ"));
+        g_free(msg);
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_aho_corasick) {
+    CX_TEST_DO {
+        AhoCorasick ac;
+        aho_corasick_init(&ac);
+        aho_corasick_add(&ac, "he", 2);
+        aho_corasick_add(&ac, "she", 3);
+        aho_corasick_add(&ac, "his", 3);
+        aho_corasick_add(&ac, "hers", 4);
+        aho_corasick_add(&ac, "she", 3);
+        aho_corasick_build(&ac);
+        CX_TEST_ASSERT(ac.max_len == 4);
+        
+        char found[5] = { 0 };
+        aho_corasick_scan(&ac, 0, "ushers", 6, found);
+        CX_TEST_ASSERT(found[0] && found[1] && !found[2] && found[3]);
+        // duplicate patterns are found both
+        CX_TEST_ASSERT(found[4]);
+        
+        memset(found, 0, sizeof(found));
+        aho_corasick_scan(&ac, 0, "this", 4, found);
+        CX_TEST_ASSERT(!found[0] && !found[1] && found[2] && !found[3]);
+        
+        // a match, that is split across pieces
+        memset(found, 0, sizeof(found));
+        uint32_t state = aho_corasick_scan(&ac, 0, "xx h", 4, found);
+        state = aho_corasick_scan(&ac, state, "e", 1, found);
+        aho_corasick_scan(&ac, state, "r", 1, found);
+        CX_TEST_ASSERT(found[0] && !found[3]);
+        
+        memset(found, 0, sizeof(found));
+        aho_corasick_scan(&ac, 0, "nothing", 7, found);
+        for(int i=0;i<5;i++) {
+            CX_TEST_ASSERT(!found[i]);
+        }
+        
+        aho_corasick_free(&ac);
+    }
+}
+
+CX_TEST(test_literal_groups) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v2 engine=dfa\n", testfile);
+    fputs("l\tcat\tdog\n", testfile);
+    fputs("l\tdog\tfox\n", testfile);
+    fputs("l\tbird\tcat\n", testfile);
+    fputs("l\txfox\towl\n", testfile);
+    fputs("-\t[0-9]+\t#\n", testfile);
+    fputs("l\tab\tba\n", testfile);
+    fputs("l\tba\tab\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        
+        // rules are still applied in order: cat -> dog -> fox, but the
+        // cat created by rule 3 is not replaced again
+        char *msg = g_strdup("a cat and a bird");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "a fox and a cat"));
+        g_free(msg);
+        
+        // a match of a later rule, that is created by an earlier rule
+        // across the edit boundary
+        msg = g_strdup("xcat 12");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "owl #"));
+        g_free(msg);
+        
+        // literals found by the first scan are searched again in the
+        // changed message
+        msg = g_strdup("dog xfox");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "fox owl"));
+        g_free(msg);
+        
+        msg = g_strdup("ab ba");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "ab ab"));
+        g_free(msg);
+        
+        msg = g_strdup("nothing");
+        char *msg_in = msg;
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(msg == msg_in);
+        g_free(msg);
+        
+        // rules, whose literal is not in the message, are skipped
+        size_t nrules;
+        TextReplacementRule *rules = get_rules(&nrules);
+        CX_TEST_ASSERT(nrules == 7);
+        CX_TEST_ASSERT(rules[3].prefilter_skips > 0);
+        
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+CX_TEST(test_dictionary) {
+    FILE *dictfile = fopen("testfile.dict", "w");
+    fputs("teh\tthe\n", dictfile);
+    fputs("\n", dictfile);
+    fputs("recieve\treceive\r\n", dictfile);
+    fputs("teh\tduplicate\n", dictfile);
+    fputs("brb\tbe right back", dictfile);
+    fclose(dictfile);
+    
+    CX_TEST_DO {
+        Dictionary *dict = dictionary_load("testfile.dict", 0);
+        CX_TEST_ASSERT(dict);
+        CX_TEST_ASSERT(dict->nentries == 3);
+        
+        // the first entry of a duplicate word is used
+        const DictionaryEntry *e = dictionary_lookup(dict, "teh", 3);
+        CX_TEST_ASSERT(e);
+        CX_TEST_ASSERT(!strncmp(dict->data + e->replacement, "the", e->replacement_len));
+        e = dictionary_lookup(dict, "recieve", 7);
+        CX_TEST_ASSERT(e && e->replacement_len == 7);
+        e = dictionary_lookup(dict, "brb", 3);
+        CX_TEST_ASSERT(e && e->replacement_len == 13);
+        CX_TEST_ASSERT(!dictionary_lookup(dict, "Teh", 3));
+        CX_TEST_ASSERT(!dictionary_lookup(dict, "te", 2));
+        
+        // only whole words are found
+        const char *str = "tehx xteh, Teh teh";
+        size_t len = strlen(str);
+        size_t ws, we;
+        e = dictionary_find(dict, str, 0, len, &ws, &we);
+        CX_TEST_ASSERT(e && ws == 15 && we == 18);
+        // a word, that begins before the start, is skipped
+        CX_TEST_ASSERT(!dictionary_find(dict, str, 16, len, &ws, &we));
+        // the end of the range is a word boundary
+        e = dictionary_find(dict, "xx brbx", 0, 6, &ws, &we);
+        CX_TEST_ASSERT(e && ws == 3 && we == 6);
+        dictionary_free(dict);
+        
+        dict = dictionary_load("testfile.dict", 1);
+        e = dictionary_find(dict, str, 0, len, &ws, &we);
+        CX_TEST_ASSERT(e && ws == 11 && we == 14);
+        CX_TEST_ASSERT(dictionary_lookup(dict, "BRB", 3));
+        dictionary_free(dict);
+        
+        CX_TEST_ASSERT(!dictionary_load("testfile.missing", 0));
+        dictfile = fopen("testfile.dict", "w");
+        fputs("word\tok\nno tab\n", dictfile);
+        fclose(dictfile);
+        CX_TEST_ASSERT(!dictionary_load("testfile.dict", 0));
+    }
+    
+    unlink("testfile.dict");
+}
+
+CX_TEST(test_dictionary_rule) {
+    FILE *dictfile = fopen("testfile.dict", "w");
+    fputs("teh\tthe\n", dictfile);
+    fputs("brb\tbe right back\n", dictfile);
+    fputs("foo\tbar\n", dictfile);
+    fclose(dictfile);
+    
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v2\n", testfile);
+    fputs("l\tbaz\tfoo\n", testfile);
+    fputs("ti\ttestfile.dict\t\n", testfile);
+    fputs("-\tbar\tBAR\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        size_t nrules;
+        TextReplacementRule *rules = get_rules(&nrules);
+        CX_TEST_ASSERT(nrules == 3);
+        CX_TEST_ASSERT(rules[1].flags == (RULE_FLAG_DICTIONARY|RULE_FLAG_ICASE));
+        CX_TEST_ASSERT(rules[1].regex);
+        CX_TEST_ASSERT(rules[1].regex->type == REGEX_ENGINE_DICTIONARY);
+        CX_TEST_ASSERT(!rules[1].literal);
+        
+        // the dictionary is applied at its position in the rules order
+        char *msg = g_strdup("Teh baz, brb tehx");
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(!strcmp(msg, "the BAR, be right back tehx"));
+        g_free(msg);
+        
+        msg = g_strdup("nothing");
+        char *msg_in = msg;
+        apply_all_rules(&msg);
+        CX_TEST_ASSERT(msg == msg_in);
+        g_free(msg);
+        
+        msg = apply_rule(g_strdup("teh end"), &rules[1]);
+        CX_TEST_ASSERT(!strcmp(msg, "the end"));
+        g_free(msg);
+        
+        // the flags column is written back
+        CX_TEST_ASSERT(!save_rules());
+        char *path = rules_file_path();
+        TextReplacementRule *saved;
+        size_t nsaved;
+        RulesFileOptions options;
+        CX_TEST_ASSERT(!parse_rules_file(path, &saved, &nsaved, &options));
+        CX_TEST_ASSERT(nsaved == 3);
+        CX_TEST_ASSERT(saved[1].flags == (RULE_FLAG_DICTIONARY|RULE_FLAG_ICASE));
+        CX_TEST_ASSERT(!strcmp(saved[1].pattern, "testfile.dict"));
+        free_rules(saved, nsaved);
+        unlink(path);
+        g_free(path);
+        rules_cleanup();
+        
+        // a missing dictionary is an invalid rule
+        unlink("testfile.dict");
+        CX_TEST_ASSERT(!rules_init("testfile"));
+        rules = get_rules(&nrules);
+        CX_TEST_ASSERT(!rules[1].regex);
+        CX_TEST_ASSERT(rule_status(&rules[1]) != NULL);
+        rules_cleanup();
+    }
+    
+    unlink("testfile");
+    unlink("testfile.dict");
+    unlink("testfile.snapshot");
+}
+
+/*
+ * runs filter_stream with the input string and returns the output
+ */
+static char* filter_string(const char *input, size_t len, const FilterOptions *options, FilterStats *stats) {
+    FILE *in = fopen("testfile.in", "w");
+    fwrite(input, 1, len, in);
+    fclose(in);
+    int fd = open("testfile.in", O_RDONLY);
+    char *result = NULL;
+    size_t result_len = 0;
+    FILE *out = open_memstream(&result, &result_len);
+    int err = filter_stream(fd, out, options, stats);
+    fclose(out);
+    close(fd);
+    unlink("testfile.in");
+    if(err) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+CX_TEST(test_filter_stream) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1\n", testfile);
+    fputs("hello\tbye\n", testfile);
+    fputs("x+\ty\n", testfile);
+    fclose(testfile);
+    
+    CX_TEST_DO {
+        FilterOptions options;
+        memset(&options, 0, sizeof(FilterOptions));
+        CX_TEST_ASSERT(!load_rules("testfile", &options.rules, &options.nrules, &options.rules_options));
+        options.delim = '\n';
+        options.chunk_size = 4;
+        
+        // matches and messages, that cross chunk boundaries
+        const char *input = "hello world\nxxxxxxxxxxxx\n\nno match\nhello";
+        FilterStats stats;
+        char *out = filter_string(input, strlen(input), &options, &stats);
+        CX_TEST_ASSERT(out);
+        CX_TEST_ASSERT(!strcmp(out, "bye world\ny\n\nno match\nbye"));
+        CX_TEST_ASSERT(stats.messages == 5);
+        CX_TEST_ASSERT(stats.changed == 3);
+        CX_TEST_ASSERT(stats.bytes_in == strlen(input));
+        CX_TEST_ASSERT(stats.bytes_out == strlen(out));
+        free(out);
+        
+        // the result doesn't depend on the chunk size
+        for(size_t chunk=1;chunk<=64;chunk*=2) {
+            options.chunk_size = chunk;
+            out = filter_string(input, strlen(input), &options, NULL);
+            CX_TEST_ASSERT(!strcmp(out, "bye world\ny\n\nno match\nbye"));
+            free(out);
+        }
+        
+        // NUL-delimited messages can contain newlines
+        const char nul_input[] = "hello\nhello\0xx\0";
+        options.delim = '\0';
+        options.chunk_size = 3;
+        out = filter_string(nul_input, sizeof(nul_input) - 1, &options, &stats);
+        CX_TEST_ASSERT(out);
+        CX_TEST_ASSERT(!memcmp(out, "bye\nbye\0y\0", 10));
+        CX_TEST_ASSERT(stats.messages == 2);
+        CX_TEST_ASSERT(stats.bytes_out == 10);
+        free(out);
+        
+        options.delim = '\n';
+        options.chunk_size = 4;
+        out = filter_string("", 0, &options, &stats);
+        CX_TEST_ASSERT(out && !strcmp(out, ""));
+        CX_TEST_ASSERT(stats.messages == 0);
+        free(out);
+        
+        // messages longer than max_message fail the stream, also without
+        // a delimiter, the input is not read to the end
+        options.max_message = 8;
+        out = filter_string("hello\n12345678\n", 15, &options, &stats);
+        CX_TEST_ASSERT(out);
+        CX_TEST_ASSERT(!strcmp(out, "bye\n12345678\n"));
+        free(out);
+        CX_TEST_ASSERT(!filter_string("hello\n123456789\nhello\n", 22, &options, &stats));
+        CX_TEST_ASSERT(stats.messages == 1);
+        char *large = malloc(4096);
+        memset(large, 'x', 4096);
+        options.delim = '\0';
+        CX_TEST_ASSERT(!filter_string(large, 4096, &options, &stats));
+        CX_TEST_ASSERT(stats.messages == 0);
+        CX_TEST_ASSERT(stats.bytes_in < 4096);
+        free(large);
+        options.delim = '\n';
+        options.max_message = 0;
+        
+        // write errors fail the stream and are not counted
+        FILE *in = fopen("testfile.in", "w");
+        fputs("hello\nworld\n", in);
+        fclose(in);
+        int fd = open("testfile.in", O_RDONLY);
+        FILE *full = fopen("/dev/full", "w");
+        CX_TEST_ASSERT(full);
+        setvbuf(full, NULL, _IONBF, 0);
+        CX_TEST_ASSERT(filter_stream(fd, full, &options, &stats));
+        CX_TEST_ASSERT(stats.bytes_out == 0);
+        fclose(full);
+        close(fd);
+        unlink("testfile.in");
+        
+        free_rules(options.rules, options.nrules);
+    }
+    
+    unlink("testfile");
+    unlink("testfile.snapshot");
+}
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+static int file_equals(const char *path, const char *content) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        return 0;
+    }
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+    return !strcmp(buf, content);
+}
+
+CX_TEST(test_log_rewrite) {
+    FILE *testfile = fopen("testfile", "w");
+    fputs("?v1\n", testfile);
+    fputs("gh#([0-9]+)\tissue $1\n", testfile);
+    fputs("^issue\tIssue\n", testfile);
+    fclose(testfile);
+    
+    mkdir("testlogs", 0755);
+    mkdir("testlogs/acc1", 0755);
+    mkdir("testlogs/acc1/buddy", 0755);
+    mkdir("testlogs/acc2", 0755);
+    char path[256];
+    for(int i=0;i<40;i++) {
+        snprintf(path, sizeof(path), "testlogs/acc%d/%s%02d.txt", i % 2 + 1, i % 4 == 0 ? "buddy/" : "", i);
+        write_file(path, "Conversation with b gh#0\n(12:00:00) a: see gh#1\ngh#22\n(12:00:01) b left gh#5\n(12:00:02) b: ok");
+    }
+    write_file("testlogs/acc1/unchanged.html", "<b>nothing</b><br/>\n");
+    // only the text of sent messages is changed, not the markup
+    write_file("testlogs/acc1/chat.html",
+            "<html><head><title>Conversation with b gh#0</title></head><body><h3>Conversation with b gh#0</h3>\n"
+            "<font color=\"#16569E\"><font size=\"2\">(12:00:00)</font> <b>gh#9:</b></font> see <a href=\"gh#7\">gh#1</a> gh#2<br/>\n"
+            "<font color=\"#A82F2F\"><font size=\"2\">(12:00:01)</font> <b>b:</b></font> gh#3<br/>\n"
+            "<font size=\"2\">(12:00:02)</font><b> gh#4 left</b><br/>\n"
+            "</body></html>\n");
+    write_file("testlogs/acc1/notalog.dat", "gh#1\n");
+    chmod("testlogs/acc1/buddy/00.txt", 0600);
+    
+    CX_TEST_DO {
+        struct stat unchanged_before;
+        stat("testlogs/acc1/unchanged.html", &unchanged_before);
+        
+        LogRewriteOptions options;
+        memset(&options, 0, sizeof(LogRewriteOptions));
+        options.rules_file = "testfile";
+        options.root = "testlogs";
+        options.checkpoint = "testfile.checkpoint";
+        options.nthreads = 4;
+        LogRewriteStats stats;
+        CX_TEST_ASSERT(!log_rewrite(&options, &stats));
+        CX_TEST_ASSERT(stats.files == 42);
+        CX_TEST_ASSERT(stats.skipped == 0);
+        CX_TEST_ASSERT(stats.processed == 42);
+        CX_TEST_ASSERT(stats.changed == 41);
+        CX_TEST_ASSERT(stats.failed == 0);
+        
+        // every file is rewritten exactly once, the rules are applied to
+        // the text of each message in order, the title, timestamps,
+        // senders and system messages are not changed
+        const char *expected = "Conversation with b gh#0\n(12:00:00) a: see issue 1\nIssue 22\n(12:00:01) b left gh#5\n(12:00:02) b: ok";
+        for(int i=0;i<40;i++) {
+            snprintf(path, sizeof(path), "testlogs/acc%d/%s%02d.txt", i % 2 + 1, i % 4 == 0 ? "buddy/" : "", i);
+            CX_TEST_ASSERT(file_equals(path, expected));
+        }
+        CX_TEST_ASSERT(file_equals("testlogs/acc1/notalog.dat", "gh#1\n"));
+        CX_TEST_ASSERT(file_equals("testlogs/acc1/chat.html",
+                "<html><head><title>Conversation with b gh#0</title></head><body><h3>Conversation with b gh#0</h3>\n"
+                "<font color=\"#16569E\"><font size=\"2\">(12:00:00)</font> <b>gh#9:</b></font> see <a href=\"gh#7\">Issue 1</a> issue 2<br/>\n"
+                "<font color=\"#A82F2F\"><font size=\"2\">(12:00:01)</font> <b>b:</b></font> gh#3<br/>\n"
+                "<font size=\"2\">(12:00:02)</font><b> gh#4 left</b><br/>\n"
+                "</body></html>\n"));
+        struct stat s;
+        stat("testlogs/acc1/buddy/00.txt", &s);
+        CX_TEST_ASSERT((s.st_mode & 0777) == 0600);
+        // unchanged files are not written
+        stat("testlogs/acc1/unchanged.html", &s);
+        CX_TEST_ASSERT(s.st_ino == unchanged_before.st_ino);
+        CX_TEST_ASSERT(access("testlogs/acc1/buddy/00.txt" LOG_REWRITE_TMP_SUFFIX, F_OK) != 0);
+        
+        // resume: completed files are skipped
+        write_file("testlogs/acc2/new.txt", "Conversation with b\n(12:00:00) a: gh#3");
+        CX_TEST_ASSERT(!log_rewrite(&options, &stats));
+        CX_TEST_ASSERT(stats.files == 43);
+        CX_TEST_ASSERT(stats.skipped == 42);
+        CX_TEST_ASSERT(stats.processed == 1);
+        CX_TEST_ASSERT(file_equals("testlogs/acc2/new.txt", "Conversation with b\n(12:00:00) a: Issue 3"));
+        
+        // the checkpoint is not used for other rules
+        write_file("testfile", "?v1\nIssue\tTicket\n");
+        CX_TEST_ASSERT(!log_rewrite(&options, &stats));
+        CX_TEST_ASSERT(stats.skipped == 0);
+        CX_TEST_ASSERT(stats.processed == 43);
+        CX_TEST_ASSERT(file_equals("testlogs/acc2/new.txt", "Conversation with b\n(12:00:00) a: Ticket 3"));
+        
+        // invalid rules don't change any file
+        write_file("testfile", "?v1\n(\tx\n");
+        CX_TEST_ASSERT(log_rewrite(&options, &stats));
+        CX_TEST_ASSERT(file_equals("testlogs/acc2/new.txt", "Conversation with b\n(12:00:00) a: Ticket 3"));
+    }
+    
+    for(int i=0;i<40;i++) {
+        snprintf(path, sizeof(path), "testlogs/acc%d/%s%02d.txt", i % 2 + 1, i % 4 == 0 ? "buddy/" : "", i);
+        unlink(path);
+    }
+    unlink("testlogs/acc1/unchanged.html");
+    unlink("testlogs/acc1/chat.html");
+    unlink("testlogs/acc1/notalog.dat");
+    unlink("testlogs/acc2/new.txt");
+    rmdir("testlogs/acc1/buddy");
+    rmdir("testlogs/acc1");
+    rmdir("testlogs/acc2");
+    rmdir("testlogs");
+    unlink("testfile");
+    unlink("testfile.checkpoint");
 }
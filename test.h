@@ -23,3 +23,29 @@
 CX_TEST(test_load_rules);
 CX_TEST(test_str_unescape_and_replace);
 CX_TEST(test_apply_rule);
+CX_TEST(test_rule_union);
+CX_TEST(test_pattern_required_literal);
+CX_TEST(test_trigram_index);
+CX_TEST(test_dfa);
+CX_TEST(test_apply_budget);
+CX_TEST(test_rule_budget);
+CX_TEST(test_message_limit);
+CX_TEST(test_apply_rule_n);
+CX_TEST(test_match_spans);
+CX_TEST(test_arena);
+CX_TEST(test_piece_table);
+CX_TEST(test_apply_all_rules);
+CX_TEST(test_apply_all_rules_allocs);
+CX_TEST(test_sent_results);
+CX_TEST(test_rules_reload);
+CX_TEST(test_compile_worker);
+CX_TEST(test_lazy_compile);
+CX_TEST(test_rule_strings);
+CX_TEST(test_rules_snapshot);
+CX_TEST(test_rule_flags);
+CX_TEST(test_aho_corasick);
+CX_TEST(test_literal_groups);
+CX_TEST(test_dictionary);
+CX_TEST(test_dictionary_rule);
+CX_TEST(test_filter_stream);
+CX_TEST(test_log_rewrite);
@@ -0,0 +1,275 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trigram-index.h"
+
+#include <string.h>
+
+#define BITSET_WORDS(n) (((n) + 63) / 64)
+
+/*
+ * ASCII letters are folded, so that the index also finds the folded
+ * literals of case-insensitive rules
+ */
+#define FOLD(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + 32 : (c))
+
+static uint32_t trigram_hash(const unsigned char *s) {
+    uint32_t t = ((uint32_t)FOLD(s[0]) << 16) | ((uint32_t)FOLD(s[1]) << 8) | FOLD(s[2]);
+    return (t * 2654435761u) >> 16;
+}
+
+void trigram_index_init(TrigramIndex *idx) {
+    memset(idx, 0, sizeof(TrigramIndex));
+    idx->buckets = calloc(TRIGRAM_INDEX_BUCKETS, sizeof(TrigramBucket));
+    idx->seen = calloc(BITSET_WORDS(TRIGRAM_INDEX_BUCKETS), sizeof(uint64_t));
+}
+
+void trigram_index_free(TrigramIndex *idx) {
+    if(idx->buckets) {
+        for(size_t i=0;i<TRIGRAM_INDEX_BUCKETS;i++) {
+            free(idx->buckets[i].rules);
+        }
+    }
+    free(idx->buckets);
+    free(idx->rule_bucket);
+    free(idx->always);
+    free(idx->candidates);
+    free(idx->seen);
+    memset(idx, 0, sizeof(TrigramIndex));
+}
+
+static void set_always(TrigramIndex *idx, size_t index, int always) {
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    if(always) {
+        idx->always[index / 64] |= bit;
+    } else {
+        idx->always[index / 64] &= ~bit;
+    }
+}
+
+static void bucket_add(TrigramBucket *b, uint32_t rule) {
+    if(b->len == b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 4;
+        b->rules = realloc(b->rules, b->alloc * sizeof(uint32_t));
+    }
+    b->rules[b->len++] = rule;
+}
+
+static void bucket_remove(TrigramBucket *b, uint32_t rule) {
+    for(size_t i=0;i<b->len;i++) {
+        if(b->rules[i] == rule) {
+            b->rules[i] = b->rules[--b->len];
+            return;
+        }
+    }
+}
+
+/*
+ * selects the bucket for a rule
+ * the trigram with the smallest bucket is used, to keep the number of
+ * candidates per trigram low
+ */
+static int32_t select_bucket(
+        TrigramIndex *idx,
+        const char *literal,
+        size_t literal_len,
+        int compiled)
+{
+    if(!compiled) {
+        return TRIGRAM_NEVER;
+    }
+    if(!literal || literal_len < 3) {
+        return TRIGRAM_ALWAYS;
+    }
+    
+    int32_t bucket = -1;
+    size_t min = 0;
+    for(size_t i=0;i+2<literal_len;i++) {
+        uint32_t h = trigram_hash((const unsigned char*)literal + i);
+        if(bucket < 0 || idx->buckets[h].len < min) {
+            bucket = h;
+            min = idx->buckets[h].len;
+        }
+    }
+    return bucket;
+}
+
+void trigram_index_append(
+        TrigramIndex *idx,
+        const char *literal,
+        size_t literal_len,
+        int compiled)
+{
+    if(!idx->buckets) {
+        trigram_index_init(idx);
+    }
+    if(idx->nrules == idx->rules_alloc) {
+        idx->rules_alloc = idx->rules_alloc ? idx->rules_alloc * 2 : 64;
+        idx->rule_bucket = realloc(idx->rule_bucket, idx->rules_alloc * sizeof(int32_t));
+        idx->always = realloc(idx->always, BITSET_WORDS(idx->rules_alloc) * sizeof(uint64_t));
+        idx->candidates = realloc(idx->candidates, BITSET_WORDS(idx->rules_alloc) * sizeof(uint64_t));
+    }
+    size_t index = idx->nrules++;
+    idx->rule_bucket[index] = TRIGRAM_NEVER;
+    trigram_index_set(idx, index, literal, literal_len, compiled);
+}
+
+void trigram_index_set(
+        TrigramIndex *idx,
+        size_t index,
+        const char *literal,
+        size_t literal_len,
+        int compiled)
+{
+    if(index >= idx->nrules) {
+        return;
+    }
+    int32_t old = idx->rule_bucket[index];
+    if(old >= 0) {
+        bucket_remove(&idx->buckets[old], index);
+    }
+    int32_t bucket = select_bucket(idx, literal, literal_len, compiled);
+    if(bucket >= 0) {
+        bucket_add(&idx->buckets[bucket], index);
+    }
+    idx->rule_bucket[index] = bucket;
+    set_always(idx, index, bucket == TRIGRAM_ALWAYS);
+}
+
+void trigram_index_remove(TrigramIndex *idx, size_t index) {
+    if(index >= idx->nrules) {
+        return;
+    }
+    int32_t old = idx->rule_bucket[index];
+    if(old >= 0) {
+        bucket_remove(&idx->buckets[old], index);
+    }
+    
+    // the following rules are shifted by one
+    if(index+1 < idx->nrules) {
+        memmove(idx->rule_bucket+index, idx->rule_bucket+index+1, (idx->nrules-index-1)*sizeof(int32_t));
+        for(size_t i=index;i<idx->nrules-1;i++) {
+            int32_t b = idx->rule_bucket[i];
+            if(b < 0) {
+                continue;
+            }
+            TrigramBucket *bucket = &idx->buckets[b];
+            for(size_t j=0;j<bucket->len;j++) {
+                if(bucket->rules[j] == i+1) {
+                    bucket->rules[j] = i;
+                    break;
+                }
+            }
+        }
+    }
+    idx->nrules--;
+    
+    for(size_t i=index;i<idx->nrules;i++) {
+        set_always(idx, i, idx->rule_bucket[i] == TRIGRAM_ALWAYS);
+    }
+}
+
+static void bucket_replace(TrigramBucket *b, uint32_t old, uint32_t new) {
+    for(size_t i=0;i<b->len;i++) {
+        if(b->rules[i] == old) {
+            b->rules[i] = new;
+            return;
+        }
+    }
+}
+
+void trigram_index_swap(TrigramIndex *idx, size_t a, size_t b) {
+    if(a >= idx->nrules || b >= idx->nrules || a == b) {
+        return;
+    }
+    int32_t ba = idx->rule_bucket[a];
+    int32_t bb = idx->rule_bucket[b];
+    // mark a with an invalid index first, in case both rules are in
+    // the same bucket
+    if(ba >= 0) {
+        bucket_replace(&idx->buckets[ba], a, UINT32_MAX);
+    }
+    if(bb >= 0) {
+        bucket_replace(&idx->buckets[bb], b, a);
+    }
+    if(ba >= 0) {
+        bucket_replace(&idx->buckets[ba], UINT32_MAX, b);
+    }
+    idx->rule_bucket[a] = bb;
+    idx->rule_bucket[b] = ba;
+    set_always(idx, a, bb == TRIGRAM_ALWAYS);
+    set_always(idx, b, ba == TRIGRAM_ALWAYS);
+}
+
+void trigram_index_match(
+        TrigramIndex *idx,
+        const char *msg,
+        size_t len,
+        size_t from)
+{
+    size_t nwords = BITSET_WORDS(idx->nrules);
+    memcpy(idx->candidates, idx->always, nwords * sizeof(uint64_t));
+    memset(idx->seen, 0, BITSET_WORDS(TRIGRAM_INDEX_BUCKETS) * sizeof(uint64_t));
+    trigram_index_add(idx, msg, len, from);
+}
+
+void trigram_index_add(
+        TrigramIndex *idx,
+        const char *msg,
+        size_t len,
+        size_t from)
+{
+    // buckets, that were already seen, added a superset of the rules,
+    // because from only increases
+    const unsigned char *s = (const unsigned char*)msg;
+    for(size_t i=0;i+2<len;i++) {
+        uint32_t h = trigram_hash(s + i);
+        uint64_t bit = (uint64_t)1 << (h % 64);
+        if(idx->seen[h / 64] & bit) {
+            continue;
+        }
+        idx->seen[h / 64] |= bit;
+        
+        TrigramBucket *bucket = &idx->buckets[h];
+        for(size_t j=0;j<bucket->len;j++) {
+            uint32_t r = bucket->rules[j];
+            if(r >= from) {
+                idx->candidates[r / 64] |= (uint64_t)1 << (r % 64);
+            }
+        }
+    }
+}
+
+size_t trigram_index_next(TrigramIndex *idx, size_t from) {
+    size_t nwords = BITSET_WORDS(idx->nrules);
+    size_t w = from / 64;
+    if(w >= nwords) {
+        return idx->nrules;
+    }
+    uint64_t word = idx->candidates[w] & (~(uint64_t)0 << (from % 64));
+    for(;;) {
+        if(word) {
+            size_t i = w * 64 + __builtin_ctzll(word);
+            return i < idx->nrules ? i : idx->nrules;
+        }
+        if(++w >= nwords) {
+            return idx->nrules;
+        }
+        word = idx->candidates[w];
+    }
+}
@@ -0,0 +1,152 @@
+/*
+ * pidgin-regex-text-replacement
+ *
+ * Copyright (C) 2025 Olaf Wintermann
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTR_TRIGRAM_INDEX_H
+#define RTR_TRIGRAM_INDEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * number of hash buckets for trigrams
+ */
+#define TRIGRAM_INDEX_BUCKETS 65536
+
+/*
+ * the index is only used for rule sets with at least this number of rules
+ */
+#define TRIGRAM_INDEX_MIN_RULES 64
+
+/*
+ * rule_bucket value for rules without trigram, that are always candidates
+ */
+#define TRIGRAM_ALWAYS -1
+
+/*
+ * rule_bucket value for rules, that are never candidates (not compiled)
+ */
+#define TRIGRAM_NEVER -2
+
+typedef struct TrigramBucket {
+    uint32_t *rules;
+    size_t len;
+    size_t alloc;
+} TrigramBucket;
+
+/*
+ * Inverted index from trigrams to rule indices
+ * 
+ * Each rule with a required literal of at least 3 bytes is stored in the
+ * bucket of one of the literal's trigrams. A rule can only match a message,
+ * if the message contains this trigram.
+ * 
+ * Trigrams are compared without the case of ASCII letters.
+ */
+typedef struct TrigramIndex {
+    TrigramBucket *buckets;
+    
+    /*
+     * bucket index of each rule or TRIGRAM_ALWAYS/TRIGRAM_NEVER
+     */
+    int32_t *rule_bucket;
+    size_t nrules;
+    size_t rules_alloc;
+    
+    /*
+     * bitset of rules with TRIGRAM_ALWAYS
+     */
+    uint64_t *always;
+    
+    /*
+     * bitset of candidate rules for the current message
+     */
+    uint64_t *candidates;
+    
+    /*
+     * bitset of trigram hashes seen in the current message
+     */
+    uint64_t *seen;
+} TrigramIndex;
+
+void trigram_index_init(TrigramIndex *idx);
+
+void trigram_index_free(TrigramIndex *idx);
+
+/*
+ * adds a rule at the end of the index
+ * a zero-initialized index is initialized on the first call
+ * 
+ * literal: required literal of the rule or NULL
+ * compiled: 0 if the rule can never match
+ */
+void trigram_index_append(
+        TrigramIndex *idx,
+        const char *literal,
+        size_t literal_len,
+        int compiled);
+
+/*
+ * replaces the index entry of the rule at the specified index
+ */
+void trigram_index_set(
+        TrigramIndex *idx,
+        size_t index,
+        const char *literal,
+        size_t literal_len,
+        int compiled);
+
+/*
+ * removes a rule from the index, the index of all following rules
+ * is decremented
+ */
+void trigram_index_remove(TrigramIndex *idx, size_t index);
+
+/*
+ * swaps the index entries of two rules
+ */
+void trigram_index_swap(TrigramIndex *idx, size_t a, size_t b);
+
+/*
+ * computes the candidate rules for a message
+ * rules before the index from are not included
+ */
+void trigram_index_match(
+        TrigramIndex *idx,
+        const char *msg,
+        size_t len,
+        size_t from);
+
+/*
+ * adds the candidate rules for the trigrams of msg to the candidates of
+ * the last trigram_index_match call
+ * 
+ * from must not be smaller than in previous calls
+ */
+void trigram_index_add(
+        TrigramIndex *idx,
+        const char *msg,
+        size_t len,
+        size_t from);
+
+/*
+ * returns the next candidate rule index >= from or idx->nrules
+ * trigram_index_match must be called before
+ */
+size_t trigram_index_next(TrigramIndex *idx, size_t from);
+
+#endif /* RTR_TRIGRAM_INDEX_H */
@@ -27,15 +27,39 @@ static GtkWidget *treeview;
  * treeview list store
  * col0: pattern string
  * col1: replacement string
+ * col2: rule status
+ * col3-col7: rule flags (flag_columns)
  */
 static GtkListStore *liststore;
 
+#define FLAG_COLUMN_START 3
+#define NUM_FLAG_COLUMNS 5
+#define NUM_COLUMNS (FLAG_COLUMN_START + NUM_FLAG_COLUMNS)
+
+typedef struct FlagColumn {
+    const char *title;
+    unsigned int flag;
+    /*
+     * the toggle is active, if the flag is not set
+     */
+    int inverted;
+} FlagColumn;
+
+static const FlagColumn flag_columns[NUM_FLAG_COLUMNS] = {
+    { "Literal", RULE_FLAG_LITERAL, 0 },
+    { "Ignore Case", RULE_FLAG_ICASE, 0 },
+    { "Whole Word", RULE_FLAG_WORD, 0 },
+    { "Dictionary", RULE_FLAG_DICTIONARY, 0 },
+    { "Enabled", RULE_FLAG_DISABLED, 1 }
+};
+
 
 static GtkWidget* create_treeview(void);
 static void update_liststore(TextReplacementRule *rules, size_t numrules);
 
 static void pattern_edited(GtkCellRendererText* self, gchar* path, gchar* new_text, gpointer user_data);
 static void preplacement_edited(GtkCellRendererText* self, gchar* path, gchar* new_text, gpointer user_data);
+static void flag_toggled(GtkCellRendererToggle *self, gchar *path, gpointer user_data);
 
 static void add_button_clicked(GtkWidget *widget, void *userdata);
 static void remove_button_clicked(GtkWidget *widget, void *userdata);
@@ -107,7 +131,7 @@ GtkWidget *get_config_frame(PurplePlugin *plugin) {
     GtkWidget *hbox = gtk_hbox_new(FALSE, 8);
     gtk_table_attach(GTK_TABLE(grid), hbox, 0, 2, 1, 2, 0, GTK_FILL, GTK_FILL, 0);
     
-    GtkWidget *label1 = gtk_label_new("Use $1 in the replacement text to include the text matched by the first regex capture group.");
+    GtkWidget *label1 = gtk_label_new("Use $1 to $9 in the replacement text to include the text matched by the regex capture groups. $0 is replaced with the whole match.");
     gtk_label_set_line_wrap(GTK_LABEL(label1), TRUE);
     gtk_box_pack_start(GTK_BOX(hbox), label1, FALSE, FALSE, 0);
     
@@ -130,6 +154,7 @@ static GtkWidget* create_treeview(void) {
     gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(view), TRUE);
     GtkCellRenderer *renderer0 = gtk_cell_renderer_text_new();
     GtkCellRenderer *renderer1 = gtk_cell_renderer_text_new();
+    GtkCellRenderer *renderer2 = gtk_cell_renderer_text_new();
     g_object_set(renderer0, "editable", TRUE, NULL);
     g_object_set(renderer1, "editable", TRUE, NULL);
     g_signal_connect(renderer0, "edited", G_CALLBACK(pattern_edited), NULL);
@@ -146,6 +171,12 @@ static GtkWidget* create_treeview(void) {
                 "text",
                 1,
                 NULL);
+    GtkTreeViewColumn *column2 = gtk_tree_view_column_new_with_attributes(
+                "Status",
+                renderer2,
+                "text",
+                2,
+                NULL);
     gtk_tree_view_column_set_expand(column0, TRUE);
     gtk_tree_view_column_set_expand(column1, TRUE);
     gtk_tree_view_column_set_resizable(column0, TRUE);
@@ -153,6 +184,19 @@ static GtkWidget* create_treeview(void) {
     
     gtk_tree_view_append_column(GTK_TREE_VIEW(view), column0);
     gtk_tree_view_append_column(GTK_TREE_VIEW(view), column1);
+    for(int i=0;i<NUM_FLAG_COLUMNS;i++) {
+        int col = FLAG_COLUMN_START + i;
+        GtkCellRenderer *renderer = gtk_cell_renderer_toggle_new();
+        g_signal_connect(renderer, "toggled", G_CALLBACK(flag_toggled), GINT_TO_POINTER(col));
+        GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(
+                    flag_columns[i].title,
+                    renderer,
+                    "active",
+                    col,
+                    NULL);
+        gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
+    }
+    gtk_tree_view_append_column(GTK_TREE_VIEW(view), column2);
     
     treeview = view;
     return view;
@@ -160,8 +204,11 @@ static GtkWidget* create_treeview(void) {
 
 
 static void update_liststore(TextReplacementRule *rules, size_t numrules) {
-    GType types[2] = { G_TYPE_STRING, G_TYPE_STRING };
-    liststore = gtk_list_store_newv(2, types);
+    GType types[NUM_COLUMNS] = { G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING };
+    for(int i=FLAG_COLUMN_START;i<NUM_COLUMNS;i++) {
+        types[i] = G_TYPE_BOOLEAN;
+    }
+    liststore = gtk_list_store_newv(NUM_COLUMNS, types);
     
     for(int i=0;i<numrules;i++) {
         GtkTreeIter iter;
@@ -175,13 +222,50 @@ static void update_liststore(TextReplacementRule *rules, size_t numrules) {
         g_value_init(&value2, G_TYPE_STRING);
         g_value_set_string(&value2, rules[i].replacement);
         gtk_list_store_set_value(liststore, &iter, 1, &value2);
+        
+        const char *status = rule_status(&rules[i]);
+        gtk_list_store_set(liststore, &iter, 2, status ? status : "", -1);
+        
+        for(int f=0;f<NUM_FLAG_COLUMNS;f++) {
+            gboolean active = (rules[i].flags & flag_columns[f].flag) != 0;
+            if(flag_columns[f].inverted) {
+                active = !active;
+            }
+            gtk_list_store_set(liststore, &iter, FLAG_COLUMN_START + f, active, -1);
+        }
     }
     
     gtk_tree_view_set_model(GTK_TREE_VIEW(treeview), GTK_TREE_MODEL(liststore));
     g_object_unref(G_OBJECT(liststore));
 }
 
-static void update_text(GtkListStore *store, gchar *path, int col, gchar *new_text) {
+void ui_rules_status_changed(void) {
+    if(!liststore) {
+        return;
+    }
+    size_t nrules;
+    TextReplacementRule *rules = get_rules(&nrules);
+    GtkTreeIter iter;
+    gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(liststore), &iter);
+    for(size_t i=0;i<nrules && valid;i++) {
+        const char *status = rule_status(&rules[i]);
+        gtk_list_store_set(liststore, &iter, 2, status ? status : "", -1);
+        valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(liststore), &iter);
+    }
+}
+
+void ui_rules_reloaded(void) {
+    if(!liststore) {
+        return;
+    }
+    // the file replaced all rules, unsaved changes are discarded
+    size_t nrules;
+    TextReplacementRule *rules = get_rules(&nrules);
+    update_liststore(rules, nrules);
+    rules_modified = 0;
+}
+
+static void update_text(GtkListStore *store, gchar *path, int col, const gchar *new_text) {
     GtkTreeIter iter;
 
     if (gtk_tree_model_get_iter_from_string(GTK_TREE_MODEL(store), &iter, path)) {
@@ -195,6 +279,11 @@ static void pattern_edited(GtkCellRendererText* self, gchar* path, gchar* new_te
     
     int compiled = rule_update_pattern(index, new_text);
     rules_modified = 1;
+    
+    size_t nrules;
+    TextReplacementRule *rules = get_rules(&nrules);
+    const char *status = index < nrules ? rule_status(&rules[index]) : NULL;
+    update_text(liststore, path, 2, status ? status : "");
 }
 
 static void preplacement_edited(GtkCellRendererText* self, gchar* path, gchar* new_text, gpointer user_data) {
@@ -204,6 +293,31 @@ static void preplacement_edited(GtkCellRendererText* self, gchar* path, gchar* n
     rules_modified = 1;
 }
 
+static void flag_toggled(GtkCellRendererToggle *self, gchar *path, gpointer user_data) {
+    int col = GPOINTER_TO_INT(user_data);
+    const FlagColumn *column = &flag_columns[col - FLAG_COLUMN_START];
+    int index = atoi(path);
+    size_t nrules;
+    TextReplacementRule *rules = get_rules(&nrules);
+    if(index < 0 || index >= nrules) {
+        return;
+    }
+    
+    unsigned int flags = rules[index].flags ^ column->flag;
+    rule_update_flags(index, flags);
+    rules_modified = 1;
+    
+    GtkTreeIter iter;
+    if(gtk_tree_model_get_iter_from_string(GTK_TREE_MODEL(liststore), &iter, path)) {
+        gboolean active = (flags & column->flag) != 0;
+        if(column->inverted) {
+            active = !active;
+        }
+        const char *status = rule_status(&rules[index]);
+        gtk_list_store_set(liststore, &iter, col, active, 2, status ? status : "", -1);
+    }
+}
+
 
 // ---------------- gtk treeview helper ----------------
 static int treeview_get_selection(void) {
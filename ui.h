@@ -26,5 +26,15 @@
 
 GtkWidget *get_config_frame(PurplePlugin *plugin);
 
+/*
+ * updates the rule status column, if the config UI is open
+ */
+void ui_rules_status_changed(void);
+
+/*
+ * reloads the rules list, if the config UI is open
+ */
+void ui_rules_reloaded(void);
+
 #endif /* RTR_UI_H */
 